@@ -3,10 +3,12 @@
 
 #include "ai_player.hpp"
 #include "asserts.hpp"
+#include "document_cache.hpp"
 #include "filesystem.hpp"
 #include "foreach.hpp"
 #include "game.hpp"
 #include "game_utils.hpp"
+#include "logging.hpp"
 #include "pathfind.hpp"
 #include "resource.hpp"
 #include "terrain.hpp"
@@ -22,10 +24,10 @@ namespace {
 class default_ai_player : public ai_player
 {
 public:
-	default_ai_player(game& g, int nplayer)
-	  : ai_player(g, nplayer), set_deck_(false)
+	default_ai_player(game& g, int nplayer, bool send_deck)
+	  : ai_player(g, nplayer), set_deck_(!send_deck)
 	{}
-	std::vector<wml::node_ptr> play();
+	std::vector<wml::const_node_ptr> play();
 
 	hex::location player_select_loc(const std::string& prompt,
 	                          boost::function<bool(hex::location)> valid_loc);
@@ -51,16 +53,16 @@ hex::location default_ai_player::player_select_loc(const std::string& prompt,
 	return hex::location();
 }
 
-std::vector<wml::node_ptr> default_ai_player::play()
+std::vector<wml::const_node_ptr> default_ai_player::play()
 {
-	std::vector<wml::node_ptr> result;
+	std::vector<wml::const_node_ptr> result;
 	if(!set_deck_) {
 		set_deck_ = true;
-		result.push_back(wml::parse_xml(sys::read_file("deck.xml")));
+		result.push_back(document_cache::get_xml("deck.xml"));
 		return result;
 	}
 
-	std::cerr << "AI PLAYING: " << get_game().player_casting() << " VS " << player_id() << "\n";
+	LOG_DEBUG_FIELDS(logging::fields().player(player_id()), "ai playing, player casting: " << get_game().player_casting());
 
 	if(get_game().player_casting() != player_id()) {
 		return result;
@@ -109,7 +111,7 @@ std::vector<wml::node_ptr> default_ai_player::play()
 						}
 					}
 
-					std::cerr << "TARGET DISTANCE: " << target_distance << "\n";
+					LOG_DEBUG_FIELDS(logging::fields().player(player_id()), "target distance: " << target_distance);
 
 					if(move_to.valid() && move_to != u->loc()) {
 						const hex::location move_from = u->loc();
@@ -141,7 +143,7 @@ std::vector<wml::node_ptr> default_ai_player::play()
 		}
 	}
 
-	std::cerr << "AI PLAYER...HAS " << player.spells.size() << " CARDS\n";
+	LOG_DEBUG_FIELDS(logging::fields().player(player_id()), "ai player has " << player.spells.size() << " cards");
 	if(result.empty()) {
 		foreach(const held_card& held, player.spells) {
 			if(held.embargo) {
@@ -193,15 +195,15 @@ std::vector<wml::node_ptr> default_ai_player::play()
 		result.push_back(end_turn_node);
 	}
 
-	std::cerr << "AI RESULTS: " << result.size() << "\n";
+	LOG_DEBUG_FIELDS(logging::fields().player(player_id()), "ai results: " << result.size());
 	return result;
 }
 
 }
 
-ai_player* ai_player::create(game& g, int nplayer)
+ai_player* ai_player::create(game& g, int nplayer, bool send_deck)
 {
-	return new default_ai_player(g, nplayer);
+	return new default_ai_player(g, nplayer, send_deck);
 }
 
 ai_player::ai_player(game& g, int nplayer)
@@ -10,11 +10,13 @@ class game;
 
 class ai_player : public card_selector {
 public:
-	static ai_player* create(game& g, int nplayer);
+	//if send_deck is false the player assumes its deck has already been
+	//sent, and goes straight to playing.
+	static ai_player* create(game& g, int nplayer, bool send_deck=true);
 	ai_player(game& g, int nplayer);
 	virtual ~ai_player();
 
-	virtual std::vector<wml::node_ptr> play() = 0;
+	virtual std::vector<wml::const_node_ptr> play() = 0;
 	int player_id() const { return nplayer_; }
 
 	bool player_pay_cost(const std::vector<int>& cost);
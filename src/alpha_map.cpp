@@ -0,0 +1,171 @@
+#include <stdlib.h>
+
+#include <algorithm>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "alpha_map.hpp"
+#include "unit_test.hpp"
+
+namespace graphics
+{
+
+namespace {
+
+//sets a bit for each transparent pixel in the row, 32 to a word. Bits
+//past the end of the row are set too, so that when the map is scaled
+//down they don't stop a block at the edge counting as transparent.
+void build_row(const uint32_t* row, int w, uint32_t alpha_mask, uint32_t* out)
+{
+#if defined(__SSE2__)
+	const __m128i mask = _mm_set1_epi32(alpha_mask);
+	const __m128i zero = _mm_setzero_si128();
+#endif
+
+	for(int word = 0; word*32 < w; ++word) {
+		const uint32_t* p = row + word*32;
+		const int n = std::min(32, w - word*32);
+		uint32_t bits = 0;
+		int i = 0;
+#if defined(__SSE2__)
+		//compare four pixels at a time, and take the top bit of each
+		//comparison as a bit of the result.
+		for(; i + 4 <= n; i += 4) {
+			const __m128i v = _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i)), mask);
+			bits |= uint32_t(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(v, zero)))) << i;
+		}
+#endif
+
+		for(; i < n; ++i) {
+			bits |= uint32_t((p[i] & alpha_mask) == 0) << i;
+		}
+
+		if(n < 32) {
+			bits |= ~0u << n;
+		}
+
+		out[word] = bits;
+	}
+}
+
+//these pack the bits for each block of two or four pixels into a single
+//bit, which is set if all of the block's bits are.
+uint32_t pack_pairs(uint32_t x)
+{
+	x &= x >> 1;
+	x &= 0x55555555;
+	x = (x | (x >> 1)) & 0x33333333;
+	x = (x | (x >> 2)) & 0x0F0F0F0F;
+	x = (x | (x >> 4)) & 0x00FF00FF;
+	x = (x | (x >> 8)) & 0x0000FFFF;
+	return x;
+}
+
+uint32_t pack_quads(uint32_t x)
+{
+	x &= x >> 1;
+	x &= x >> 2;
+	x &= 0x11111111;
+	x = (x | (x >> 3)) & 0x03030303;
+	x = (x | (x >> 6)) & 0x000F000F;
+	x = (x | (x >> 12)) & 0x000000FF;
+	return x;
+}
+
+}
+
+alpha_map::alpha_map(const uint32_t* pixels, int w, int h, int pitch, uint32_t alpha_mask, int scale)
+  : width_(w), height_(h), shift_(scale >= 4 ? 2 : scale >= 2 ? 1 : 0)
+{
+	scale = 1 << shift_;
+	const int scaled_w = (w + scale - 1) >> shift_;
+	const int scaled_h = (h + scale - 1) >> shift_;
+	words_per_row_ = (scaled_w + 31)/32;
+	bits_.resize(words_per_row_*scaled_h);
+	if(bits_.empty()) {
+		return;
+	}
+
+	if(shift_ == 0) {
+		for(int y = 0; y != h; ++y) {
+			build_row(pixels + y*pitch, w, alpha_mask, &bits_[y*words_per_row_]);
+		}
+
+		return;
+	}
+
+	//a block is transparent if it is in every row of the block, so AND
+	//the rows together, and then pack each block's bits down to one.
+	const int full_words = (w + 31)/32;
+	std::vector<uint32_t> row(full_words), block(full_words);
+	for(int y = 0; y != scaled_h; ++y) {
+		block.assign(full_words, ~0u);
+		const int end_row = std::min(h, (y + 1) << shift_);
+		for(int n = y << shift_; n != end_row; ++n) {
+			build_row(pixels + n*pitch, w, alpha_mask, &row[0]);
+			for(int i = 0; i != full_words; ++i) {
+				block[i] &= row[i];
+			}
+		}
+
+		uint32_t* out = &bits_[y*words_per_row_];
+		for(int word = 0; word != words_per_row_; ++word) {
+			uint32_t bits = 0;
+			for(int part = 0; part != scale; ++part) {
+				const int in = word*scale + part;
+				const uint32_t b = in < full_words ? block[in] : ~0u;
+				bits |= (shift_ == 1 ? pack_pairs(b) : pack_quads(b)) << (part*32/scale);
+			}
+
+			out[word] = bits;
+		}
+	}
+}
+
+}
+
+UNIT_TEST(alpha_map) {
+	const uint32_t AlphaMask = 0xFF000000;
+	srand(0);
+	for(int iteration = 0; iteration != 200; ++iteration) {
+		const int w = 1 + rand()%100, h = 1 + rand()%20;
+		const int pitch = w + rand()%3;
+		std::vector<uint32_t> pixels(pitch*h);
+		for(int n = 0; n != pixels.size(); ++n) {
+			//mostly transparent, so whole blocks of it often are.
+			pixels[n] = rand()%8 == 0 ? (rand() | AlphaMask) : (rand() & ~AlphaMask);
+		}
+
+		for(int scale = 1; scale <= 4; scale *= 2) {
+			const graphics::alpha_map m(&pixels[0], w, h, pitch, AlphaMask, scale);
+			for(int y = 0; y != h; ++y) {
+				for(int x = 0; x != w; ++x) {
+					bool expected = true;
+					for(int by = y - y%scale; by != y - y%scale + scale && by < h; ++by) {
+						for(int bx = x - x%scale; bx != x - x%scale + scale && bx < w; ++bx) {
+							expected = expected && (pixels[by*pitch + bx] & AlphaMask) == 0;
+						}
+					}
+
+					CHECK(m.is_alpha(x, y) == expected, w << "x" << h << " scale " << scale << " at " << x << "," << y);
+				}
+			}
+		}
+	}
+}
+
+BENCHMARK(alpha_map)
+{
+	const int Size = 1024;
+	std::vector<uint32_t> pixels(Size*Size);
+	for(int n = 0; n != pixels.size(); ++n) {
+		pixels[n] = (n/7)%3 == 0 ? 0xFF00FF00 : 0;
+	}
+
+	test::set_benchmark_items(Size*Size, "pixels");
+	BENCHMARK_LOOP {
+		graphics::alpha_map m(&pixels[0], Size, Size, Size, 0xFF000000);
+	}
+}
@@ -0,0 +1,48 @@
+#ifndef ALPHA_MAP_HPP_INCLUDED
+#define ALPHA_MAP_HPP_INCLUDED
+
+#include <stdint.h>
+
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+
+namespace graphics
+{
+
+//which pixels of an image are fully transparent, for hit testing, packed
+//one bit to a pixel. It can be built at half or quarter resolution, in
+//which case a point only counts as transparent if every pixel in the
+//block it falls in is.
+class alpha_map
+{
+public:
+	//the pixels are 32 bits each with 'pitch' of them to a row, and are
+	//transparent when all of the bits in alpha_mask are zero. scale must
+	//be 1, 2 or 4.
+	alpha_map(const uint32_t* pixels, int w, int h, int pitch, uint32_t alpha_mask, int scale=1);
+
+	//x and y are in pixels of the original image, whatever the scale.
+	bool is_alpha(int x, int y) const {
+		x >>= shift_;
+		y >>= shift_;
+		return (bits_[y*words_per_row_ + (x >> 5)] >> (x & 31)) & 1;
+	}
+
+	int width() const { return width_; }
+	int height() const { return height_; }
+
+	size_t memory_usage() const { return bits_.size()*sizeof(uint32_t); }
+
+private:
+	int width_, height_;
+	int shift_;
+	int words_per_row_;
+	std::vector<uint32_t> bits_;
+};
+
+typedef boost::shared_ptr<const alpha_map> const_alpha_map_ptr;
+
+}
+
+#endif
@@ -0,0 +1,110 @@
+#ifndef ARENA_ALLOCATOR_HPP_INCLUDED
+#define ARENA_ALLOCATOR_HPP_INCLUDED
+
+#include <stddef.h>
+
+#include <new>
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+
+//a bump allocator which hands out memory from large blocks and frees it
+//all at once when it's destroyed. Individual deallocations are no-ops.
+class arena
+{
+public:
+	explicit arena(size_t block_size=16384) : block_size_(block_size), pos_(NULL), remaining_(0)
+	{}
+
+	~arena() {
+		for(std::vector<char*>::iterator i = blocks_.begin(); i != blocks_.end(); ++i) {
+			delete [] *i;
+		}
+	}
+
+	void* allocate(size_t n) {
+		//keep everything suitably aligned for any type we might hold.
+		n = (n + Alignment - 1) & ~(Alignment - 1);
+		if(n > remaining_) {
+			const size_t size = n > block_size_ ? n : block_size_;
+			blocks_.push_back(new char[size]);
+			pos_ = blocks_.back();
+			remaining_ = size;
+		}
+
+		void* result = pos_;
+		pos_ += n;
+		remaining_ -= n;
+		return result;
+	}
+
+private:
+	arena(const arena&);
+	void operator=(const arena&);
+
+	enum { Alignment = 16 };
+
+	size_t block_size_;
+	std::vector<char*> blocks_;
+	char* pos_;
+	size_t remaining_;
+};
+
+typedef boost::shared_ptr<arena> arena_ptr;
+
+//a standard allocator which allocates from an arena. Every copy of the
+//allocator shares ownership of the arena, so when it is used for
+//boost::allocate_shared the arena lives until the last object
+//allocated from it has been destroyed.
+template<typename T>
+class arena_allocator
+{
+public:
+	typedef T value_type;
+	typedef T* pointer;
+	typedef const T* const_pointer;
+	typedef T& reference;
+	typedef const T& const_reference;
+	typedef size_t size_type;
+	typedef ptrdiff_t difference_type;
+
+	template<typename U>
+	struct rebind { typedef arena_allocator<U> other; };
+
+	explicit arena_allocator(arena_ptr a) : arena_(a)
+	{}
+
+	template<typename U>
+	arena_allocator(const arena_allocator<U>& o) : arena_(o.get_arena())
+	{}
+
+	pointer address(reference r) const { return &r; }
+	const_pointer address(const_reference r) const { return &r; }
+
+	pointer allocate(size_type n, const void* hint=NULL) {
+		return static_cast<pointer>(arena_->allocate(n*sizeof(T)));
+	}
+
+	void deallocate(pointer p, size_type n) {}
+
+	size_type max_size() const { return size_type(-1)/sizeof(T); }
+
+	void construct(pointer p, const T& val) { new (p) T(val); }
+	void destroy(pointer p) { p->~T(); }
+
+	const arena_ptr& get_arena() const { return arena_; }
+private:
+	arena_ptr arena_;
+};
+
+template<typename T, typename U>
+bool operator==(const arena_allocator<T>& a, const arena_allocator<U>& b) {
+	return a.get_arena() == b.get_arena();
+}
+
+template<typename T, typename U>
+bool operator!=(const arena_allocator<T>& a, const arena_allocator<U>& b) {
+	return !(a == b);
+}
+
+#endif
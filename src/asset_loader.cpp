@@ -0,0 +1,123 @@
+#include <boost/bind.hpp>
+
+#include "asset_loader.hpp"
+#include "texture.hpp"
+
+namespace graphics
+{
+
+bool asset_loader::request::operator<(const request& o) const
+{
+	if(type != o.type) {
+		return type < o.type;
+	}
+
+	if(arg != o.arg) {
+		return arg < o.arg;
+	}
+
+	return image < o.image;
+}
+
+asset_loader::asset_loader(int nthreads) : nloading_(0), exiting_(false)
+{
+	texture::init_worker_threads();
+	for(int n = 0; n < nthreads; ++n) {
+		threads_.push_back(boost::shared_ptr<threading::thread>(new threading::thread(boost::bind(&asset_loader::worker_thread, this))));
+	}
+}
+
+asset_loader::~asset_loader()
+{
+	{
+		threading::lock lck(mutex_);
+		exiting_ = true;
+		queue_.clear();
+	}
+
+	queue_cond_.notify_all();
+
+	//destroying a thread waits for it to finish what it's loading.
+	threads_.clear();
+}
+
+void asset_loader::add(const std::string& image)
+{
+	push_request(request::PLAIN, image, 0);
+}
+
+void asset_loader::add_team_color(const std::string& image, int team_color)
+{
+	push_request(request::TEAM_COLOR, image, team_color);
+}
+
+void asset_loader::add_palette_mapped(const std::string& image, int palette)
+{
+	push_request(request::PALETTE_MAPPED, image, palette);
+}
+
+int asset_loader::pending() const
+{
+	threading::lock lck(mutex_);
+	return queue_.size() + nloading_;
+}
+
+void asset_loader::push_request(request::TYPE type, const std::string& image, int arg)
+{
+	if(image.empty()) {
+		return;
+	}
+
+	request r;
+	r.type = type;
+	r.image = image;
+	r.arg = arg;
+	if(requested_.insert(r).second == false) {
+		return;
+	}
+
+	{
+		threading::lock lck(mutex_);
+		queue_.push_back(r);
+	}
+
+	queue_cond_.notify_one();
+}
+
+void asset_loader::worker_thread()
+{
+	for(;;) {
+		request r;
+		{
+			threading::lock lck(mutex_);
+			while(queue_.empty() && !exiting_) {
+				queue_cond_.wait(mutex_);
+			}
+
+			if(exiting_) {
+				return;
+			}
+
+			r = queue_.front();
+			queue_.pop_front();
+			++nloading_;
+		}
+
+		switch(r.type) {
+		case request::PLAIN:
+			texture::prefetch(r.image);
+			break;
+		case request::TEAM_COLOR:
+			texture::prefetch_team_color(r.image, r.arg);
+			break;
+		case request::PALETTE_MAPPED:
+			texture::prefetch_palette_mapped(r.image, r.arg);
+			break;
+		}
+
+		threading::lock lck(mutex_);
+		--nloading_;
+	}
+}
+
+}
@@ -0,0 +1,73 @@
+#ifndef ASSET_LOADER_HPP_INCLUDED
+#define ASSET_LOADER_HPP_INCLUDED
+
+#include <deque>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+
+#include "thread.hpp"
+
+namespace graphics
+{
+
+//Builds textures on a pool of worker threads ahead of them being drawn.
+//
+//The owner adds the images it knows it will soon need. The workers load,
+//convert, team color or palette map, and scale each of them, and leave
+//the result in the texture caches, so the first texture::get() for it
+//finds it there. Uploading needs OpenGL, so that is left for the main
+//thread to do a little of each frame with
+//texture::build_textures_from_worker_threads().
+class asset_loader
+{
+public:
+	//must be created in the main thread, after there is an OpenGL context.
+	explicit asset_loader(int nthreads=2);
+
+	//anything not loaded yet is abandoned.
+	~asset_loader();
+
+	//each image is only loaded once, however often it's added.
+	void add(const std::string& image);
+	void add_team_color(const std::string& image, int team_color);
+	void add_palette_mapped(const std::string& image, int palette);
+
+	//the number of images added which haven't been loaded yet.
+	int pending() const;
+
+private:
+	asset_loader(const asset_loader&);
+	void operator=(const asset_loader&);
+
+	struct request {
+		enum TYPE { PLAIN, TEAM_COLOR, PALETTE_MAPPED };
+		TYPE type;
+		std::string image;
+
+		//the team color or palette.
+		int arg;
+
+		bool operator<(const request& o) const;
+	};
+
+	void push_request(request::TYPE type, const std::string& image, int arg);
+	void worker_thread();
+
+	//only touched by the owning thread.
+	std::set<request> requested_;
+
+	mutable threading::mutex mutex_;
+	threading::condition queue_cond_;
+	std::deque<request> queue_;
+	int nloading_;
+	bool exiting_;
+
+	std::vector<boost::shared_ptr<threading::thread> > threads_;
+};
+
+}
+
+#endif
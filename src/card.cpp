@@ -4,6 +4,7 @@
 #include <map>
 
 #include "asserts.hpp"
+#include "document_cache.hpp"
 #include "card.hpp"
 #include "font.hpp"
 #include "foreach.hpp"
@@ -31,7 +32,7 @@ std::vector<std::string> all_cards;
 void load_cards_map()
 {
 	if(cards_map.empty()) {
-		wml::const_node_ptr cards_node = wml::parse_wml_from_file("data/cards.xml");
+		wml::const_node_ptr cards_node = document_cache::get_wml("data/cards.xml");
 		FOREACH_WML_CHILD(card_node, cards_node, "spell") {
 			const_card_ptr new_card(card::create(card_node));
 			ASSERT_LOG(cards_map.count(new_card->id()) == 0, "CARD REPEATED: " << new_card->id());
@@ -54,6 +55,7 @@ const_card_ptr card::get(const std::string& id)
 {
 	static std::map<std::string, const_card_ptr> ability_cards_map;
 
+	load_cards_map();
 	const_card_ptr card = cards_map[id];
 	if(card.get() == NULL) {
 		card = ability_cards_map[id];
@@ -65,7 +67,7 @@ const_card_ptr card::get(const std::string& id)
 			std::string unit_id(id.begin(), dot);
 			std::string ability_id(dot+1, id.end());
 
-			wml::const_node_ptr unit_node = wml::parse_wml_from_file("data/units/" + unit_id + ".xml");
+			wml::const_node_ptr unit_node = document_cache::get_wml("data/units/" + unit_id + ".xml");
 			if(unit_node.get() != NULL) {
 				FOREACH_WML_CHILD(card_node, unit_node, "ability") {
 					const_card_ptr new_card(create(card_node));
@@ -351,7 +353,7 @@ void attack_card::resolve_card(const resolve_card_info* callable) const
 				wml::node_ptr attack_anim_node(new wml::node("attack_anim"));
 				attack_anim_node->add_child(hex::write_location("from", callable->caster()->loc()));
 				attack_anim_node->add_child(hex::write_location("to", target));
-				game::current()->queue_message(wml::output_xml(attack_anim_node));
+				game::current()->queue_message(wml::output_xml(attack_anim_node, wml::XML_COMPACT));
 
 				const int defense = unit_protection(*game::current(), u);
 
@@ -653,7 +655,9 @@ std::vector<held_card> read_deck(const std::string& str)
 	std::vector<std::string> items = util::split(str);
 	foreach(const std::string& item, items) {
 		std::vector<std::string> v = util::split(item, ' ');
-		ASSERT_LOG(v.size() == 1 || v.size() == 2, "ILLEGAL DECK FORMAT: " << str);
+		//game state sent by the server has a third field saying whether
+		//the card is currently usable, which we don't need.
+		ASSERT_LOG(v.size() >= 1 && v.size() <= 3, "ILLEGAL DECK FORMAT: " << str);
 		int embargo = 0;
 		if(v.size() > 1) {
 			embargo = atoi(v[1].c_str());
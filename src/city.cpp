@@ -1,6 +1,7 @@
 #include "city.hpp"
 #include "wml_node.hpp"
 #include "wml_utils.hpp"
+#include "wml_visitor.hpp"
 
 city::city(wml::const_node_ptr node)
   : loc_(wml::get_int(node, "x"), wml::get_int(node, "y"))
@@ -16,3 +17,8 @@ wml::node_ptr city::write() const
 	wml::node_ptr result = hex::write_location("city", loc_);
 	return result;
 }
+
+void city::write(wml::visitor& v) const
+{
+	hex::write_location(v, "city", loc_);
+}
@@ -12,6 +12,7 @@ public:
 	explicit city(wml::const_node_ptr node);
 	explicit city(const hex::location& loc);
 	wml::node_ptr write() const;
+	void write(wml::visitor& v) const;
 	const hex::location& loc() const { return loc_; }
 private:
 	hex::location loc_;
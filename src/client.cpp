@@ -20,6 +20,7 @@
 #include "raster.hpp"
 #include "terrain.hpp"
 #include "texture.hpp"
+#include "texture_atlas.hpp"
 #include "unit_test.hpp"
 #include "wml_parser.hpp"
 #include "wml_writer.hpp"
@@ -81,6 +82,7 @@ int main(int argc, char** argv)
 
 	SDL_WM_SetCaption("Wizard", "Wizard");
 
+	graphics::texture_atlas::init();
 	terrain::init(wml::parse_wml_from_file("data/terrain.xml"));
 	font::manager font_manager;
 	gui_section::init(wml::parse_wml_from_file("data/gui.xml"));
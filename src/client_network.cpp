@@ -1,7 +1,19 @@
+#include <boost/array.hpp>
 #include <boost/asio.hpp>
+#include <boost/bind.hpp>
+#include <boost/scoped_ptr.hpp>
+
+#include <deque>
+
+#include <sched.h>
 
 #include "client_network.hpp"
+#include "logging.hpp"
+#include "spsc_queue.hpp"
+#include "thread.hpp"
+#include "unit_test.hpp"
 #include "wml_node.hpp"
+#include "wml_parser.hpp"
 #include "xml_parser.hpp"
 #include "xml_writer.hpp"
 
@@ -13,24 +25,141 @@ namespace {
 tcp::socket* socket;
 boost::asio::io_service* io_service;
 
-bool tcp_packet_waiting(tcp::socket& tcp_socket)
+//everything below is only touched by the network thread, apart from the
+//queue of received messages, which the main thread pops, and the flag
+//saying the connection has failed.
+boost::scoped_ptr<threading::thread> network_thread;
+boost::scoped_ptr<boost::asio::io_service::work> work;
+
+spsc_queue<wml::const_node_ptr>* received = NULL;
+volatile bool failed = false;
+
+boost::array<char, 4096> read_buf;
+message_buffer incoming;
+
+//messages which have been parsed but didn't fit in the queue. While
+//there are any, nothing more is read, so the server is held back until
+//the main thread catches up.
+std::deque<wml::const_node_ptr> undelivered;
+boost::asio::deadline_timer* deliver_timer = NULL;
+
+//messages being written out, the front one first.
+std::deque<std::string> outgoing;
+
+void start_read();
+
+void deliver()
+{
+	while(!undelivered.empty() && received->push(undelivered.front())) {
+		undelivered.pop_front();
+	}
+
+	if(undelivered.empty()) {
+		start_read();
+		return;
+	}
+
+	deliver_timer->expires_from_now(boost::posix_time::milliseconds(5));
+	deliver_timer->async_wait(boost::bind(deliver));
+}
+
+void handle_read(const boost::system::error_code& e, size_t nbytes)
 {
-	boost::asio::socket_base::bytes_readable command(true);
-	tcp_socket.io_control(command);
-	return command.get() != 0;
+	//a read is only started once every message before it has been
+	//delivered, so the main thread will have them all before it sees
+	//the connection has failed. The barrier publishes those messages
+	//before the flag, as spsc_queue does for its slots.
+	if(e) {
+		__sync_synchronize();
+		failed = true;
+		socket->close();
+		return;
+	}
+
+	incoming.append(&read_buf[0], &read_buf[0] + nbytes);
+
+	std::string msg;
+	while(incoming.extract(msg)) {
+		try {
+			undelivered.push_back(wml::parse_xml(msg));
+		} catch(wml::parse_error& e) {
+			LOG_WARN("ignoring message from the server which could not be parsed: " << e.message);
+		}
+	}
+
+	deliver();
 }
+
+void start_read()
+{
+	socket->async_read_some(boost::asio::buffer(read_buf), boost::bind(handle_read, _1, _2));
+}
+
+void start_write();
+
+void handle_write(const boost::system::error_code& e, size_t nbytes)
+{
+	//closing the socket makes the read fail, which marks the connection
+	//as failed once the messages already read are delivered.
+	if(e) {
+		outgoing.clear();
+		socket->close();
+		return;
+	}
+
+	outgoing.pop_front();
+	if(!outgoing.empty()) {
+		start_write();
+	}
+}
+
+void start_write()
+{
+	boost::asio::async_write(*socket, boost::asio::buffer(outgoing.front()), boost::bind(handle_write, _1, _2));
+}
+
+void queue_write(const std::string& msg)
+{
+	if(failed) {
+		return;
+	}
+
+	outgoing.push_back(msg);
+	if(outgoing.size() == 1) {
+		start_write();
+	}
+}
+
+void run_network_thread()
+{
+	io_service->run();
+}
+
 }
 
 network::manager::manager()
 {
 	io_service = new boost::asio::io_service;
+	received = new spsc_queue<wml::const_node_ptr>(1024);
 }
 
 network::manager::~manager()
 {
+	if(network_thread) {
+		work.reset();
+		io_service->stop();
+		network_thread->join();
+		network_thread.reset();
+	}
+
+	delete deliver_timer;
 	delete socket;
 	delete io_service;
+	delete received;
+	deliver_timer = NULL;
+	socket = NULL;
 	io_service = 0;
+	received = NULL;
 }
 
 void connect(const std::string& hostname, const std::string& port)
@@ -51,49 +180,90 @@ void connect(const std::string& hostname, const std::string& port)
 	if(error) {
 		throw network_error();
 	}
+
+	deliver_timer = new boost::asio::deadline_timer(*io_service);
+	work.reset(new boost::asio::io_service::work(*io_service));
+	start_read();
+	network_thread.reset(new threading::thread(run_network_thread));
 }
 
-void send(const std::string& msg)
+void frame_message(const std::string& msg, std::vector<char>& buf)
 {
-	std::vector<char> buf(msg.begin(), msg.end());
+	buf.insert(buf.end(), msg.begin(), msg.end());
 	buf.push_back(0);
+}
 
-	boost::system::error_code error = boost::asio::error::host_not_found;
-	socket->write_some(boost::asio::buffer(buf), error);
-	if(error) {
+bool extract_message(std::vector<char>& buf, std::string& msg)
+{
+	std::vector<char>::iterator end = std::find(buf.begin(), buf.end(), 0);
+	if(end == buf.end()) {
+		return false;
+	}
+
+	msg.assign(buf.begin(), end);
+	buf.erase(buf.begin(), end+1);
+	return true;
+}
+
+void message_buffer::append(const char* i1, const char* i2)
+{
+	if(begin_ != 0 && begin_*2 >= buf_.size()) {
+		buf_.erase(buf_.begin(), buf_.begin() + begin_);
+		begin_ = 0;
+	}
+
+	buf_.insert(buf_.end(), i1, i2);
+}
+
+bool message_buffer::extract(std::string& msg)
+{
+	const std::vector<char>::iterator begin = buf_.begin() + begin_;
+	const std::vector<char>::iterator end = std::find(begin + scanned_, buf_.end(), 0);
+	if(end == buf_.end()) {
+		scanned_ = buf_.size() - begin_;
+		return false;
+	}
+
+	msg.assign(begin, end);
+	begin_ = end + 1 - buf_.begin();
+	scanned_ = 0;
+	return true;
+}
+
+void send(const std::string& msg)
+{
+	const bool has_failed = failed;
+	__sync_synchronize();
+	if(has_failed) {
 		throw network_error();
 	}
+
+	std::string framed(msg);
+	framed.push_back(0);
+	io_service->post(boost::bind(queue_write, framed));
 }
 
 void send(wml::const_node_ptr node)
 {
 	std::string str;
-	wml::write_xml(node, str);
+	wml::write_xml(node, str, wml::XML_COMPACT);
 	send(str);
 }
 
-namespace {
-std::vector<char> current_message;
-}
-
 wml::const_node_ptr receive()
 {
-	size_t nbytes;
-	while(tcp_packet_waiting(*socket)) {
-		boost::array<char, 4096> buf;
-		int nbytes = socket->read_some(boost::asio::buffer(buf));
-		if(nbytes <= 0) {
-			throw network_error();
-		}
+	//the flag is read before the queue, so once it's seen, every message
+	//delivered before the connection failed is in the queue.
+	const bool has_failed = failed;
+	__sync_synchronize();
 
-		current_message.insert(current_message.end(), buf.begin(), buf.begin() + nbytes);
+	wml::const_node_ptr msg;
+	if(received->pop(msg)) {
+		return msg;
 	}
 
-	std::vector<char>::iterator end = std::find(current_message.begin(), current_message.end(), 0);
-	if(end != current_message.end()) {
-		std::string msg(current_message.begin(), end);
-		current_message.erase(current_message.begin(), end+1);
-		return wml::parse_xml(msg);
+	if(has_failed) {
+		throw network_error();
 	}
 
 	return wml::const_node_ptr();
@@ -101,3 +271,56 @@ wml::const_node_ptr receive()
 
 }
 
+UNIT_TEST(message_buffer) {
+	std::vector<char> data;
+	network::frame_message("<a/>", data);
+	network::frame_message("", data);
+	network::frame_message("<b x=\"1\"/>", data);
+
+	//however the data is split up as it arrives, the same messages come
+	//out of it.
+	for(int chunk = 1; chunk <= data.size(); ++chunk) {
+		network::message_buffer buf;
+		std::vector<std::string> messages;
+		for(int n = 0; n < data.size(); n += chunk) {
+			buf.append(&data[n], &data[0] + std::min<int>(data.size(), n + chunk));
+			std::string msg;
+			while(buf.extract(msg)) {
+				messages.push_back(msg);
+			}
+		}
+
+		CHECK_EQ(messages.size(), 3);
+		CHECK_EQ(messages[0], "<a/>");
+		CHECK_EQ(messages[1], "");
+		CHECK_EQ(messages[2], "<b x=\"1\"/>");
+		CHECK_EQ(buf.size(), 0);
+	}
+}
+
+namespace {
+void push_numbers(spsc_queue<int>* q, int count)
+{
+	for(int n = 0; n != count; ++n) {
+		while(!q->push(n)) {
+			sched_yield();
+		}
+	}
+}
+}
+
+UNIT_TEST(spsc_queue) {
+	spsc_queue<int> q(16);
+	const int Count = 100000;
+	threading::thread producer(boost::bind(push_numbers, &q, Count));
+	for(int n = 0; n != Count; ++n) {
+		int value;
+		while(!q.pop(value)) {
+			sched_yield();
+		}
+
+		CHECK_EQ(value, n);
+	}
+
+	CHECK(q.empty(), "items left in the queue");
+}
@@ -1,6 +1,9 @@
 #ifndef CLIENT_NETWORK_HPP_INCLUDED
 #define CLIENT_NETWORK_HPP_INCLUDED
 
+#include <string>
+#include <vector>
+
 #include "wml_node_fwd.hpp"
 
 namespace network
@@ -11,11 +14,55 @@ struct manager {
 };
 
 struct network_error {};
+
+//connects and starts a thread which reads and parses messages from the
+//server, and writes out whatever is sent.
 void connect(const std::string& hostname, const std::string& port);
+
+//queues a message to be written out in full by the network thread.
+//Throws network_error if the connection has failed.
 void send(const std::string& msg);
 void send(wml::const_node_ptr node);
+
+//returns the next message the network thread has parsed, or NULL if
+//there isn't one yet. Never waits for the network. Throws network_error
+//once the connection has failed and every message which arrived before
+//that has been returned.
 wml::const_node_ptr receive();
 
+//the framing used on the wire: each message is terminated by a null
+//character. These are independent of the connection above, so tools
+//which manage their own sockets can share them.
+void frame_message(const std::string& msg, std::vector<char>& buf);
+
+//if buf begins with a complete message, removes it from buf and puts
+//it in msg.
+bool extract_message(std::vector<char>& buf, std::string& msg);
+
+//collects the data read from a connection and splits it into messages.
+//Unlike extract_message() it doesn't move the rest of the data along for
+//every message taken out: used data is only dropped once it's half the
+//buffer, and the search for the end of a message carries on from where
+//the last search stopped.
+class message_buffer
+{
+public:
+	message_buffer() : begin_(0), scanned_(0)
+	{}
+
+	void append(const char* i1, const char* i2);
+	bool extract(std::string& msg);
+
+	//the number of bytes not yet extracted.
+	size_t size() const { return buf_.size() - begin_; }
+private:
+	std::vector<char> buf_;
+
+	//the start of the data not yet extracted, and how far past it has
+	//been searched without finding the end of a message.
+	size_t begin_, scanned_;
+};
+
 }
 
 #endif
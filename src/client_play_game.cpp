@@ -16,13 +16,17 @@
 #include "font.hpp"
 #include "foreach.hpp"
 #include "formatter.hpp"
+#include "frame_profiler.hpp"
 #include "game_utils.hpp"
 #include "grid_widget.hpp"
 #include "hex_geometry.hpp"
 #include "image_widget.hpp"
 #include "label.hpp"
+#include "preferences.hpp"
 #include "raster.hpp"
 #include "resource.hpp"
+#include "terrain.hpp"
+#include "tile.hpp"
 #include "tooltip.hpp"
 #include "unit_animation.hpp"
 #include "unit_avatar.hpp"
@@ -51,6 +55,10 @@ private:
 
 const int SideBarWidth = 200;
 
+//how long each frame may spend uploading textures which were built by
+//the asset loader, so a burst of them doesn't stall drawing.
+const int TextureUploadBudgetMs = 4;
+
 }
 
 client_play_game::client_play_game(const std::string& player_name)
@@ -59,7 +67,8 @@ client_play_game::client_play_game(const std::string& player_name)
   end_turn_button_(new gui::button(gui::widget_ptr(new gui::label("End Turn", graphics::color_white())), boost::bind(&client_play_game::end_turn, this))),
   cancel_button_(new gui::button(gui::widget_ptr(new gui::label("Cancel", graphics::color_white())), boost::bind(&client_play_game::cancel_action, this))),
   animation_time_(0),
-  xscroll_(-SideBarWidth), yscroll_(0)
+  xscroll_(-SideBarWidth), yscroll_(0),
+  show_frame_profile_(preferences::show_frame_profile())
 {
 	end_turn_button_->set_loc(20, 640);
 	cancel_button_->set_loc(20, 640);
@@ -72,21 +81,27 @@ client_play_game::~client_play_game()
 void client_play_game::play()
 {
 	for(;;) {
+		frame_profiler::begin_frame();
+
 		wml::const_node_ptr msg;
 		if(animation_time_ <= 0) {
+			const frame_profiler::zone z("network_receive");
 			msg = network::receive();
 		} else {
 			--animation_time_;
 		}
 
-		foreach(unit_avatar_ptr a, unit_avatars_) {
-			a->process();
+		{
+			const frame_profiler::zone z("process_avatars");
+			foreach(unit_avatar_ptr a, unit_avatars_) {
+				a->process();
+			}
 		}
 
 		if(msg) {
 			if(msg->name() == "game") {
-				game_ = boost::intrusive_ptr<game>(new game(msg));
-				game_context_.set(game_.get());
+				game_->update_from_snapshot(msg);
+				prefetch_assets();
 				build_avatars();
 				if(moving_unit_) {
 					const int key = moving_unit_->key();
@@ -198,6 +213,11 @@ void client_play_game::play()
 				case SDL_KEYDOWN:
 					if(event.key.keysym.sym == SDLK_ESCAPE) {
 						return;
+					} else if(event.key.keysym.sym == SDLK_F3) {
+						show_frame_profile_ = !show_frame_profile_;
+					} else if(event.key.keysym.sym == SDLK_F4) {
+						frame_profiler::write_trace_file("frame-trace.json");
+						debug_console::add_message("Wrote frame-trace.json");
 					}
 					break;
 				case SDL_MOUSEMOTION:
@@ -245,11 +265,20 @@ void client_play_game::play()
 			}
 		}
 
+		graphics::texture::build_textures_from_worker_threads(TextureUploadBudgetMs);
+
 		graphics::prepare_raster();
 		glClearColor(0,0,0,0);
 		glClear(GL_COLOR_BUFFER_BIT);
 		draw();
-		SDL_GL_SwapBuffers();
+		if(show_frame_profile_) {
+			frame_profiler::draw_overlay();
+		}
+
+		{
+			const frame_profiler::zone z("swap_buffers");
+			SDL_GL_SwapBuffers();
+		}
 
 		SDL_Delay(20);
 	}
@@ -324,6 +353,7 @@ int cycle_num = 0;
 
 void client_play_game::draw() const
 {
+	const frame_profiler::zone z("draw");
 	++cycle_num;
 
 	glPushMatrix();
@@ -362,6 +392,7 @@ void client_play_game::draw() const
 		}
 
 		while(avatar_itor != avatars.end() && (*avatar_itor)->get_unit()->loc().y() == y) {
+			const frame_profiler::zone z("draw_avatar");
 			(*avatar_itor)->draw();
 			++avatar_itor;
 		}
@@ -428,8 +459,11 @@ void client_play_game::draw() const
 		resourcey += 24;
 	}
 
-	foreach(gui::widget_ptr w, widgets_) {
-		w->draw();
+	{
+		const frame_profiler::zone z("draw_widgets");
+		foreach(gui::widget_ptr w, widgets_) {
+			w->draw();
+		}
 	}
 
 	debug_console::draw();
@@ -533,7 +567,7 @@ void client_play_game::handle_mouse_button_down(const SDL_MouseButtonEvent& even
 				try {
 					wml::node_ptr result = player.spells[card].card->use_card(*this);
 					if(result.get() != NULL) {
-						network::send(wml::output_xml(result));
+						network::send(wml::output_xml(result, wml::XML_COMPACT));
 						network::send("<end_turn/>\n");
 					}
 				} catch(action_cancellation_exception& e) {
@@ -571,7 +605,7 @@ void client_play_game::handle_mouse_button_down(const SDL_MouseButtonEvent& even
 					wml::node_ptr move_node(new wml::node("move"));
 					move_node->add_child(hex::write_location("from", moving_unit_->loc()));
 					move_node->add_child(hex::write_location("to", loc));
-					network::send(wml::output_xml(move_node));
+					network::send(wml::output_xml(move_node, wml::XML_COMPACT));
 
 					const hex::location src_loc = moving_unit_->loc();
 					moving_unit_->set_loc(loc);
@@ -733,7 +767,7 @@ void client_play_game::activate_ability(unit_ptr u, unit_ability_ptr a)
 	try {
 		wml::node_ptr result = a->use_ability(*u, *this);
 		if(result.get() != NULL) {
-			network::send(wml::output_xml(result));
+			network::send(wml::output_xml(result, wml::XML_COMPACT));
 			network::send("<end_turn/>\n");
 
 			moving_unit_.reset();
@@ -772,6 +806,47 @@ void client_play_game::build_avatars()
 	unit_avatars_.insert(unit_avatars_.end(), other_avatars.begin(), other_avatars.end());
 }
 
+void client_play_game::prefetch_assets()
+{
+	//the map, the units on it, and whatever the cards in each player's
+	//hand could put on it. The loader ignores anything it has seen before,
+	//so this only adds what is new since the last game message.
+	for(int y = 0; y != game_->height(); ++y) {
+		for(int x = 0; x != game_->width(); ++x) {
+			const tile* t = game_->get_tile(x, y);
+			if(t) {
+				assets_.add(t->texture());
+				assets_.add(t->overlay_texture());
+			}
+		}
+	}
+
+	assets_.add("terrain/towers.png");
+
+	foreach(unit_ptr u, game_->units()) {
+		unit_avatar::prefetch(u->id(), u->side(), assets_);
+	}
+
+	for(int n = 0; n != game_->players().size(); ++n) {
+		foreach(const held_card& c, game_->players()[n].spells) {
+			if(c.card->monster_id()) {
+				unit_avatar::prefetch(*c.card->monster_id(), n, assets_);
+
+				//cards show the unit in the first player's colors.
+				unit_avatar::prefetch(*c.card->monster_id(), 0, assets_);
+			}
+
+			if(c.card->land_id()) {
+				const_terrain_ptr t = terrain::get(*c.card->land_id());
+				if(t) {
+					assets_.add(t->texture());
+					assets_.add(t->overlay_texture());
+				}
+			}
+		}
+	}
+}
+
 bool client_play_game::is_highlighted_loc(const hex::location& loc) const
 {
 	return current_routes_.get() && current_routes_->count(loc) ||
@@ -11,6 +11,7 @@
 
 #include <set>
 
+#include "asset_loader.hpp"
 #include "button.hpp"
 #include "card.hpp"
 #include "game.hpp"
@@ -77,6 +78,10 @@ private:
 	std::vector<unit_avatar_ptr> unit_avatars_;
 	void build_avatars();
 
+	//loads the textures the game is likely to need before they're drawn.
+	graphics::asset_loader assets_;
+	void prefetch_assets();
+
 	int animation_time_;
 
 	//function which returns the unit to display the stats of
@@ -90,6 +95,9 @@ private:
 
 	int xscroll_, yscroll_;
 	CKey key_;
+
+	//whether the frame profiler's overlay is drawn. F3 toggles it.
+	bool show_frame_profile_;
 };
 
 #endif
@@ -9,7 +9,7 @@ void add_message(const std::string& msg)
 {
 	wml::node_ptr node(new wml::node("debug_msg"));
 	node->set_attr("msg", msg);
-	game::current()->queue_message(wml::output_xml(node));
+	game::current()->queue_message(wml::output_xml(node, wml::XML_COMPACT));
 }
 
 void draw()
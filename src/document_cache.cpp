@@ -0,0 +1,107 @@
+#include <stdio.h>
+#include <utime.h>
+
+#include "concurrent_cache.hpp"
+#include "document_cache.hpp"
+#include "filesystem.hpp"
+#include "unit_test.hpp"
+#include "wml_node.hpp"
+#include "wml_parser.hpp"
+#include "xml_parser.hpp"
+
+namespace document_cache
+{
+
+namespace {
+
+struct document {
+	document() : mod_time(0)
+	{}
+
+	time_t mod_time;
+	wml::const_node_ptr node;
+};
+
+typedef concurrent_cache<std::string, document> cache_type;
+
+cache_type& wml_cache()
+{
+	static cache_type* cache = new cache_type;
+	return *cache;
+}
+
+cache_type& xml_cache()
+{
+	static cache_type* cache = new cache_type;
+	return *cache;
+}
+
+wml::node_ptr parse_wml_file(const std::string& fname)
+{
+	return wml::parse_wml_from_file(fname);
+}
+
+wml::node_ptr parse_xml_file(const std::string& fname)
+{
+	return wml::parse_xml(sys::read_file(fname));
+}
+
+//the file is parsed without the cache locked, so two threads which miss
+//at once may both parse it; whichever finishes last is kept.
+wml::const_node_ptr get(cache_type& cache, const std::string& fname, wml::node_ptr (*parse)(const std::string&))
+{
+	const time_t mod_time = sys::file_mod_time(fname);
+	document doc = cache.get(fname);
+	if(doc.node && doc.mod_time == mod_time) {
+		return doc.node;
+	}
+
+	doc.node = parse(fname);
+	doc.mod_time = mod_time;
+	cache.put(fname, doc);
+	return doc.node;
+}
+
+}
+
+wml::const_node_ptr get_wml(const std::string& fname)
+{
+	return get(wml_cache(), fname, parse_wml_file);
+}
+
+wml::const_node_ptr get_xml(const std::string& fname)
+{
+	return get(xml_cache(), fname, parse_xml_file);
+}
+
+void clear()
+{
+	wml_cache().clear();
+	xml_cache().clear();
+}
+
+}
+
+UNIT_TEST(document_cache) {
+	const std::string fname = "document_cache_test.xml";
+	sys::write_file(fname, "<a x=\"1\"/>");
+
+	wml::const_node_ptr first = document_cache::get_xml(fname);
+	CHECK_EQ(first->attr("x").str(), "1");
+	CHECK(document_cache::get_xml(fname) == first, "document parsed again");
+
+	//the modification time only has a resolution of seconds, so set it
+	//rather than waiting for it to change.
+	sys::write_file(fname, "<a x=\"2\"/>");
+	struct utimbuf times;
+	times.actime = times.modtime = sys::file_mod_time(fname) + 10;
+	utime(fname.c_str(), &times);
+
+	wml::const_node_ptr second = document_cache::get_xml(fname);
+	CHECK(second != first, "changed document not reloaded");
+	CHECK_EQ(second->attr("x").str(), "2");
+	CHECK_EQ(first->attr("x").str(), "1");
+
+	remove(fname.c_str());
+	document_cache::clear();
+}
@@ -0,0 +1,28 @@
+#ifndef DOCUMENT_CACHE_HPP_INCLUDED
+#define DOCUMENT_CACHE_HPP_INCLUDED
+
+#include <string>
+
+#include "wml_node_fwd.hpp"
+
+//documents read from files, parsed once and shared by everyone who asks
+//for them. A file is parsed again only if it has been modified since it
+//was last read. The documents are shared, so they can't be modified;
+//callers which want to change one must copy what they need.
+//
+//Only the file asked for is checked for changes, not anything it
+//includes.
+namespace document_cache
+{
+
+//a file in WML, parsed with wml::parse_wml_from_file().
+wml::const_node_ptr get_wml(const std::string& fname);
+
+//a file in XML, parsed with wml::parse_xml().
+wml::const_node_ptr get_xml(const std::string& fname);
+
+void clear();
+
+}
+
+#endif
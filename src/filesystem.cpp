@@ -525,6 +525,22 @@ bool file_exists(const std::string& name)
 	return do_file_exists(find_file(name));
 }
 
+time_t file_mod_time(const std::string& name)
+{
+	//stat the file directly rather than going through find_file(), which
+	//opens it, since this is called every time a cached file is used.
+	struct stat st;
+	if(::stat(name.c_str(), &st) != -1) {
+		return st.st_mtime;
+	}
+
+	if(have_datadir && ::stat((data_dir + "/" + name).c_str(), &st) != -1) {
+		return st.st_mtime;
+	}
+
+	return 0;
+}
+
 std::string read_file(const std::string& name)
 {
 	std::string fname = find_file(name);
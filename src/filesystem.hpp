@@ -13,6 +13,8 @@
 #ifndef FILESYSTEM_HPP_INCLUDED
 #define FILESYSTEM_HPP_INCLUDED
 
+#include <time.h>
+
 #include <map>
 #include <string>
 #include <vector>
@@ -49,6 +51,9 @@ void write_file(const std::string& fname, const std::string& data);
 bool file_exists(const std::string& fname);
 std::string find_file(const std::string& name);
 
+//the time the file was last modified, or 0 if it can't be found.
+time_t file_mod_time(const std::string& fname);
+
 void make_dir(const std::string& dirname);
 
 void move_file(const std::string& from, const std::string& to);
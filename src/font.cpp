@@ -1,10 +1,17 @@
 #include <iostream>
 #include <map>
 
+#include <boost/bind.hpp>
+
 #include "font.hpp"
 #include "foreach.hpp"
+#include "geometry.hpp"
+#include "lru_cache.hpp"
+#include "preferences.hpp"
+#include "raster.hpp"
 #include "string_utils.hpp"
 #include "surface.hpp"
+#include "text_layout.hpp"
 
 /*  This manages the TTF loading library, and allows you to use fonts.
 	The only thing one will normally need to use is render_text(), and possibly char_width(), char_height() if you need to know the size of the resulting text. */
@@ -37,22 +44,162 @@ TTF_Font* get_font(int size)
 #endif
 }
 
-struct cache_entry
-{
-	std::string text;
-	SDL_Color color;
-	int size;
+//the textures of strings which have been rendered, keyed by the text, the
+//color packed into an integer, and the size.
+typedef std::pair<std::string, std::pair<Uint32, int> > text_key;
+
+lru_cache<text_key, graphics::texture>& cache() {
+	static lru_cache<text_key, graphics::texture> instance(64);
+	return instance;
+}
+
+#if !TARGET_IPHONE_SIMULATOR && !TARGET_OS_HARMATTAN && !TARGET_OS_IPHONE
+const int AtlasSize = 512;
+const int AtlasPadding = 1;
+
+//the glyphs of a font size that have been drawn, rendered in white on a
+//single page. When the page fills up it's cleared and the generation
+//goes up, so that text laid out on the old page is laid out again.
+struct glyph_atlas {
+	glyph_atlas()
+	  : page(SDL_CreateRGBSurface(SDL_SWSURFACE, AtlasSize, AtlasSize, 32, SURFACE_MASK)),
+	    x(0), y(0), row_height(0), generation(0), dirty(true)
+	{
+		SDL_FillRect(page.get(), NULL, 0);
+	}
+
+	graphics::surface page;
+	std::map<Uint16, rect> glyphs;
+
+	//where the next glyph goes, filling rows left to right.
+	int x, y, row_height;
+
+	int generation;
+
+	//whether the page has changed since the texture was made from it.
+	bool dirty;
 	graphics::texture texture;
 };
 
-const int CacheSize = 4;
+glyph_atlas& get_atlas(int size)
+{
+	static std::map<int, glyph_atlas> atlases;
+	return atlases[size];
+}
 
-std::vector<cache_entry>& cache() {
-	static std::vector<cache_entry> instance(CacheSize);
+const rect& get_glyph(glyph_atlas& atlas, TTF_Font* font, Uint16 ch)
+{
+	std::map<Uint16, rect>::const_iterator i = atlas.glyphs.find(ch);
+	if(i != atlas.glyphs.end()) {
+		return i->second;
+	}
+
+	//glyphs with nothing to draw, like spaces, are kept as empty areas.
+	const SDL_Color white = {0xFF, 0xFF, 0xFF, 0xFF};
+	graphics::surface s(TTF_RenderGlyph_Blended(font, ch, white));
+	if(s.get() == NULL || s->w == 0 || s->h == 0) {
+		return atlas.glyphs[ch] = rect();
+	}
+
+	if(atlas.x + s->w > AtlasSize) {
+		atlas.x = 0;
+		atlas.y += atlas.row_height + AtlasPadding;
+		atlas.row_height = 0;
+	}
+
+	if(atlas.y + s->h > AtlasSize) {
+		SDL_FillRect(atlas.page.get(), NULL, 0);
+		atlas.glyphs.clear();
+		atlas.x = atlas.y = atlas.row_height = 0;
+		++atlas.generation;
+	}
+
+	SDL_Rect dst = {atlas.x, atlas.y, s->w, s->h};
+	SDL_SetAlpha(s.get(), 0, SDL_ALPHA_OPAQUE);
+	SDL_BlitSurface(s.get(), NULL, atlas.page.get(), &dst);
+
+	atlas.x += s->w + AtlasPadding;
+	atlas.row_height = std::max<int>(atlas.row_height, s->h);
+	atlas.dirty = true;
+	return atlas.glyphs[ch] = rect(dst.x, dst.y, s->w, s->h);
+}
+
+glyph_metrics get_glyph_metrics(TTF_Font* font, uint16_t ch)
+{
+	glyph_metrics m = {0, 0, 0, 0, 0};
+	TTF_GlyphMetrics(font, ch, &m.minx, &m.maxx, &m.miny, &m.maxy, &m.advance);
+	return m;
+}
+
+//a string laid out as quads on its font size's glyph atlas.
+struct text_run {
+	int generation;
+	std::vector<GLshort> vertex;
+	std::vector<GLfloat> uv;
+};
+
+lru_cache<std::pair<std::string, int>, text_run>& run_cache() {
+	static lru_cache<std::pair<std::string, int>, text_run> instance(256);
 	return instance;
 }
 
-int cache_index = 0;
+void build_run(text_run& run, glyph_atlas& atlas, TTF_Font* font, const text_layout& layout)
+{
+	run.generation = atlas.generation;
+	run.vertex.clear();
+	run.uv.clear();
+	foreach(const glyph_placement& g, layout.glyphs()) {
+		const rect& area = get_glyph(atlas, font, g.ch);
+		if(area.w() == 0) {
+			continue;
+		}
+
+		const GLshort x1 = g.x, x2 = g.x + area.w();
+		const GLshort y1 = g.y, y2 = g.y + area.h();
+		//the page is a power of two in size, so its texture is all page.
+		const GLfloat u1 = GLfloat(area.x())/AtlasSize;
+		const GLfloat u2 = GLfloat(area.x() + area.w())/AtlasSize;
+		const GLfloat v1 = GLfloat(area.y())/AtlasSize;
+		const GLfloat v2 = GLfloat(area.y() + area.h())/AtlasSize;
+
+		const GLshort vx[] = { x1, x2, x1, x2, x1, x2 };
+		const GLshort vy[] = { y1, y1, y2, y1, y2, y2 };
+		const GLfloat tu[] = { u1, u2, u1, u2, u1, u2 };
+		const GLfloat tv[] = { v1, v1, v2, v1, v2, v2 };
+		for(int n = 0; n != 6; ++n) {
+			run.vertex.push_back(vx[n]);
+			run.vertex.push_back(vy[n]);
+			run.uv.push_back(tu[n]);
+			run.uv.push_back(tv[n]);
+		}
+	}
+}
+
+const text_run& get_run(const std::string& text, int size, glyph_atlas& atlas, TTF_Font* font)
+{
+	const std::pair<std::string, int> key(text, size);
+	text_run* run = run_cache().get(key);
+	if(run != NULL && run->generation == atlas.generation) {
+		return *run;
+	}
+
+	const text_layout layout(text, TTF_FontAscent(font), TTF_FontHeight(font),
+	                         boost::bind(get_glyph_metrics, font, _1));
+	if(run == NULL) {
+		const text_run empty = { 0 };
+		run = &run_cache().put(key, empty);
+	}
+
+	//if the page filled up part way through, the glyphs from before it
+	//was cleared are gone, so the string is laid out again on the new page.
+	build_run(*run, atlas, font, layout);
+	if(run->generation != atlas.generation) {
+		build_run(*run, atlas, font, layout);
+	}
+
+	return *run;
+}
+#endif
 
 }
 
@@ -79,10 +226,10 @@ manager::~manager()
 graphics::texture render_text(const std::string& text,
                               const SDL_Color& color, int size)
 {
-	for(int n = 0; n != CacheSize; ++n) {
-		if(text == cache()[n].text && memcmp(&color, &cache()[n].color, sizeof(color)) == 0 && size == cache()[n].size) {
-			return cache()[n].texture;
-		}
+	const Uint32 packed_color = (color.r << 24) | (color.g << 16) | (color.b << 8) | color.unused;
+	const text_key key(text, std::make_pair(packed_color, size));
+	if(const graphics::texture* t = cache().get(key)) {
+		return *t;
 	}
 #if !TARGET_IPHONE_SIMULATOR && !TARGET_OS_HARMATTAN && !TARGET_OS_IPHONE
 	TTF_Font* font = get_font(size);
@@ -121,13 +268,49 @@ graphics::texture render_text(const std::string& text,
 #else
 	graphics::surface s;
 #endif
-	graphics::texture res = graphics::texture::get_no_cache(s);
-	cache_index = (cache_index+1)%CacheSize;
-	cache()[cache_index].text = text;
-	cache()[cache_index].color = color;
-	cache()[cache_index].size = size;
-	cache()[cache_index].texture = res;
-	return res;
+	return cache().put(key, graphics::texture::get_no_cache(s));
+}
+
+void draw_text(const std::string& text, const SDL_Color& color,
+               int size, int x, int y)
+{
+#if !TARGET_IPHONE_SIMULATOR && !TARGET_OS_HARMATTAN && !TARGET_OS_IPHONE
+	TTF_Font* font = get_font(size);
+	glyph_atlas& atlas = get_atlas(size);
+	const text_run& run = get_run(text, size, atlas, font);
+	if(run.vertex.empty()) {
+		return;
+	}
+
+	if(atlas.dirty) {
+		atlas.texture = graphics::texture::get_no_cache(atlas.page.clone());
+		atlas.dirty = false;
+	}
+
+	glEnable(GL_TEXTURE_2D);
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+
+	//blits still queued go underneath the text.
+	graphics::flush_blit_texture();
+
+	//the alpha channel of an SDL_Color is unused, so the text fades with
+	//the current color, as blits do.
+	GLfloat old_color[4];
+	glGetFloatv(GL_CURRENT_COLOR, old_color);
+
+	glPushMatrix();
+	glTranslatef(x&preferences::xypos_draw_mask, y&preferences::xypos_draw_mask, 0.0);
+	glColor4f(color.r/255.0, color.g/255.0, color.b/255.0, old_color[3]);
+
+	atlas.texture.set_as_current_texture();
+	glVertexPointer(2, GL_SHORT, 0, &run.vertex[0]);
+	glTexCoordPointer(2, GL_FLOAT, 0, &run.uv[0]);
+	glDrawArrays(GL_TRIANGLES, 0, run.vertex.size()/2);
+
+	glColor4fv(old_color);
+	glPopMatrix();
+#endif
 }
 
 int char_width(int size)
@@ -35,6 +35,14 @@ struct error {
 graphics::texture render_text(const std::string& text,
                               const SDL_Color& color, int size);
 
+//draws text with its top left at (x, y), from glyphs kept on a texture
+//for each font size, in the same place render_text() would put them. It
+//is meant for text which is drawn every frame, which would otherwise
+//need a texture for every string. The text takes its alpha from the
+//current color, which is left as it was.
+void draw_text(const std::string& text, const SDL_Color& color,
+               int size, int x, int y);
+
 int char_width(int size);
 int char_height(int size);
 
@@ -28,6 +28,7 @@
 #include "formula_function.hpp"
 #include "formula_tokenizer.hpp"
 #include "map_utils.hpp"
+#include "metrics.hpp"
 #include "random.hpp"
 #include "unit_test.hpp"
 #include "wml_node.hpp"
@@ -1499,8 +1500,13 @@ void formula::output_debug_info() const
 	std::cerr << str_ << "\n";
 }
 
+namespace {
+metrics::counter formula_executions("wizard_formula_executions_total", "Formulas executed.");
+}
+
 variant formula::execute(const formula_callable& variables) const
 {
+	formula_executions.add();
 	last_executed_formula = this;
 	try {
 		return expr_->evaluate(variables);
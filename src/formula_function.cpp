@@ -20,6 +20,7 @@
 #include "formula_callable.hpp"
 #include "formula_callable_utils.hpp"
 #include "formula_function.hpp"
+#include "random.hpp"
 
 #include "SDL.h"
 
@@ -340,7 +341,7 @@ private:
 				formula_callable_ptr callable(new formula_variant_callable_with_backup(items[n], variables));
 				val = args()[1]->evaluate(*callable);
 			} else {
-				val = variant(rand());
+				val = variant(rng::generate());
 			}
 
 			if(max_index == -1 || val > max_value) {
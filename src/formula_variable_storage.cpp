@@ -1,4 +1,5 @@
 #include "formula_variable_storage.hpp"
+#include "wml_visitor.hpp"
 
 namespace game_logic
 {
@@ -56,6 +57,16 @@ void formula_variable_storage::write(wml::node_ptr node) const
 	}
 }
 
+void formula_variable_storage::write(wml::visitor& v) const
+{
+	std::string val;
+	for(std::map<std::string,int>::const_iterator i = strings_to_values_.begin(); i != strings_to_values_.end(); ++i) {
+		val.clear();
+		values_[i->second].serialize_to_string(val);
+		v.attr(i->first, val);
+	}
+}
+
 void formula_variable_storage::add(const std::string& key, const variant& value)
 {
 	std::map<std::string,int>::const_iterator i = strings_to_values_.find(key);
@@ -19,6 +19,9 @@ public:
 
 	void read(wml::const_node_ptr node);
 	void write(wml::node_ptr node) const;
+
+	//gives the variables as attributes of the current element.
+	void write(wml::visitor& v) const;
 	void add(const std::string& key, const variant& value);
 	void add(const formula_variable_storage& value);
 
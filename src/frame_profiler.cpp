@@ -0,0 +1,271 @@
+#include <stdio.h>
+
+#include <algorithm>
+#include <map>
+
+#include "filesystem.hpp"
+#include "font.hpp"
+#include "foreach.hpp"
+#include "formatter.hpp"
+#include "frame_profiler.hpp"
+#include "metrics.hpp"
+#include "raster.hpp"
+#include "thread.hpp"
+#include "unit_test.hpp"
+
+namespace frame_profiler {
+
+namespace {
+
+//zones go into the ring in the order they end. Each slot carries the
+//position it was last written for, plus one, so a reader can tell
+//whether it still holds the zone it wants. A writer claims a position
+//with an atomic add and never waits; if the ring wraps, the oldest
+//zones are lost.
+const unsigned int RingSize = 1 << 15; //must be a power of two.
+
+struct slot {
+	volatile unsigned int sequence;
+	zone_record rec;
+};
+
+slot ring[RingSize];
+volatile unsigned int next_zone = 0;
+
+//frames are only started by the main loop, so need no atomics: the
+//reader is on the same thread.
+const unsigned int FrameRingSize = 256; //must be a power of two.
+
+struct frame_start {
+	int64_t time;
+	unsigned int first_zone;
+};
+
+frame_start frames[FrameRingSize];
+unsigned int nframes = 0;
+
+//threads are numbered from 1, leaving 0 for the frames themselves in
+//the trace.
+volatile int nthreads = 1;
+__thread int thread_index = -1;
+__thread int thread_depth = 0;
+
+void push(const zone_record& rec)
+{
+	const unsigned int pos = __sync_fetch_and_add(&next_zone, 1);
+	slot& s = ring[pos&(RingSize-1)];
+	s.sequence = 0;
+	__sync_synchronize();
+	s.rec = rec;
+	__sync_synchronize();
+	s.sequence = pos + 1;
+}
+
+bool read(unsigned int pos, zone_record& rec)
+{
+	const slot& s = ring[pos&(RingSize-1)];
+	if(s.sequence != pos + 1) {
+		return false;
+	}
+
+	__sync_synchronize();
+	rec = s.rec;
+	__sync_synchronize();
+	return s.sequence == pos + 1;
+}
+
+void write_event(std::string& out, const char* name, int64_t start, int64_t end, int thread)
+{
+	if(out.empty() == false) {
+		out += ",\n";
+	}
+
+	out += formatter() << "{\"name\":\"" << name << "\",\"ph\":\"X\",\"ts\":" << start << ",\"dur\":" << (end - start) << ",\"pid\":1,\"tid\":" << thread << "}";
+}
+
+}
+
+void begin_frame()
+{
+	frame_start& f = frames[nframes&(FrameRingSize-1)];
+	f.time = metrics::get_time_micros();
+	f.first_zone = next_zone;
+	++nframes;
+}
+
+zone::zone(const char* name) : name_(name), start_(metrics::get_time_micros())
+{
+	++thread_depth;
+}
+
+zone::~zone()
+{
+	if(thread_index == -1) {
+		thread_index = __sync_fetch_and_add(&nthreads, 1);
+	}
+
+	--thread_depth;
+	const zone_record rec = { name_, start_, metrics::get_time_micros(), thread_index, thread_depth };
+	push(rec);
+}
+
+void get_frames(std::vector<frame_record>& result, int max_frames)
+{
+	result.clear();
+
+	//the last frame started is still going, so isn't complete.
+	unsigned int begin = nframes > max_frames + 1 ? nframes - max_frames - 1 : 0;
+	if(nframes - begin > FrameRingSize) {
+		begin = nframes - FrameRingSize;
+	}
+
+	for(unsigned int n = begin; n + 1 < nframes; ++n) {
+		const frame_start& start = frames[n&(FrameRingSize-1)];
+		const frame_start& end = frames[(n+1)&(FrameRingSize-1)];
+
+		result.push_back(frame_record());
+		frame_record& f = result.back();
+		f.start = start.time;
+		f.end = end.time;
+
+		unsigned int pos = start.first_zone;
+		if(next_zone - pos > RingSize) {
+			pos = next_zone - RingSize;
+		}
+
+		for(; static_cast<int>(end.first_zone - pos) > 0; ++pos) {
+			zone_record rec;
+			if(read(pos, rec)) {
+				f.zones.push_back(rec);
+			}
+		}
+	}
+}
+
+void write_trace(std::string& out)
+{
+	std::vector<frame_record> frames;
+	get_frames(frames, FrameRingSize);
+
+	std::string events;
+	foreach(const frame_record& f, frames) {
+		write_event(events, "frame", f.start, f.end, 0);
+		foreach(const zone_record& z, f.zones) {
+			write_event(events, z.name, z.start, z.end, z.thread);
+		}
+	}
+
+	out += "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+	out += events;
+	out += "\n]}\n";
+}
+
+void write_trace_file(const std::string& fname)
+{
+	std::string out;
+	write_trace(out);
+	sys::write_file(fname, out);
+}
+
+void draw_overlay()
+{
+	const int GraphFrames = 120;
+	const int FrameBudgetMicros = 16667;
+	const int PixelsPerMs = 3;
+	const int GraphHeight = 50*PixelsPerMs;
+
+	std::vector<frame_record> frames;
+	get_frames(frames, GraphFrames);
+	if(frames.empty()) {
+		return;
+	}
+
+	const int x = graphics::screen_width() - GraphFrames*2 - 10;
+	const int y = 10;
+	graphics::draw_rect(rect(x, y, GraphFrames*2, GraphHeight), graphics::color(0, 0, 0, 160));
+
+	//a bar for each frame, red if it missed the budget for 60 fps.
+	for(int n = 0; n != frames.size(); ++n) {
+		const int64_t micros = frames[n].end - frames[n].start;
+		const int height = std::min<int64_t>(GraphHeight, micros*PixelsPerMs/1000);
+		const graphics::color c = micros > FrameBudgetMicros ? graphics::color(255, 0, 0, 255) : graphics::color(0, 255, 0, 255);
+		graphics::draw_rect(rect(x + (GraphFrames - frames.size() + n)*2, y + GraphHeight - height, 2, height), c);
+	}
+
+	graphics::draw_rect(rect(x, y + GraphHeight - FrameBudgetMicros*PixelsPerMs/1000, GraphFrames*2, 1), graphics::color(255, 255, 0, 255));
+
+	//the time each zone took in the last frame, adding up zones which ran
+	//more than once, in the order they first ended.
+	const frame_record& last = frames.back();
+	std::vector<const char*> names;
+	std::map<const char*, int64_t> totals;
+	std::map<const char*, int> counts;
+	std::map<const char*, int> depths;
+	foreach(const zone_record& z, last.zones) {
+		if(totals.count(z.name) == 0) {
+			names.push_back(z.name);
+			depths[z.name] = z.depth;
+		}
+
+		totals[z.name] += z.end - z.start;
+		++counts[z.name];
+	}
+
+	char buf[128];
+	sprintf(buf, "frame %.1fms", (last.end - last.start)/1000.0);
+	int ypos = y + GraphHeight + 4;
+	font::draw_text(buf, graphics::color_white(), 12, x, ypos);
+	foreach(const char* name, names) {
+		ypos += 14;
+		if(counts[name] > 1) {
+			sprintf(buf, "%s %.1fms (x%d)", name, totals[name]/1000.0, counts[name]);
+		} else {
+			sprintf(buf, "%s %.1fms", name, totals[name]/1000.0);
+		}
+
+		font::draw_text(buf, graphics::color_white(), 12, x + 8 + depths[name]*8, ypos);
+	}
+}
+
+}
+
+UNIT_TEST(frame_profiler) {
+	frame_profiler::begin_frame();
+	{
+		const frame_profiler::zone outer("test_outer");
+		const frame_profiler::zone inner("test_inner");
+	}
+	frame_profiler::begin_frame();
+
+	std::vector<frame_profiler::frame_record> frames;
+	frame_profiler::get_frames(frames, 1);
+	CHECK_EQ(frames.size(), 1);
+	CHECK_EQ(frames.front().zones.size(), 2);
+	CHECK_EQ(std::string(frames.front().zones[0].name), "test_inner");
+	CHECK_EQ(frames.front().zones[0].depth, 1);
+	CHECK_EQ(std::string(frames.front().zones[1].name), "test_outer");
+	CHECK_EQ(frames.front().zones[1].depth, 0);
+	CHECK_LE(frames.front().start, frames.front().zones[1].start);
+	CHECK_LE(frames.front().zones[1].end, frames.front().end);
+
+	//a frame with more zones than the ring holds keeps the newest.
+	for(int n = 0; n != 40000; ++n) {
+		const frame_profiler::zone z("test_flood");
+	}
+	frame_profiler::begin_frame();
+	frame_profiler::get_frames(frames, 1);
+	CHECK_EQ(frames.size(), 1);
+	CHECK_GE(frames.front().zones.size(), 30000);
+	CHECK_LE(frames.front().zones.size(), 40000);
+
+	std::string trace;
+	frame_profiler::write_trace(trace);
+	CHECK(trace.find("\"name\":\"test_flood\"") != std::string::npos, "zone missing from the trace");
+}
+
+BENCHMARK(frame_profiler_zone)
+{
+	BENCHMARK_LOOP {
+		const frame_profiler::zone z("benchmark");
+	}
+}
@@ -0,0 +1,66 @@
+#ifndef FRAME_PROFILER_HPP_INCLUDED
+#define FRAME_PROFILER_HPP_INCLUDED
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+//times the parts of each frame the client draws, to find the frames which
+//take too long and what they spent their time on. Example usage:
+//
+//const frame_profiler::zone z("draw_map");
+//
+//A zone is recorded when it ends, into a ring which holds the zones of
+//the last few hundred frames, overwriting the oldest. Any thread may
+//record zones; recording one takes no locks.
+namespace frame_profiler {
+
+//starts a new frame. Called once a frame by the main loop.
+void begin_frame();
+
+class zone
+{
+public:
+	//the name is kept, not copied, so should be a string literal.
+	explicit zone(const char* name);
+	~zone();
+private:
+	zone(const zone&);
+	void operator=(const zone&);
+
+	const char* name_;
+	int64_t start_;
+};
+
+//times are in microseconds, as given by metrics::get_time_micros().
+struct zone_record {
+	const char* name;
+	int64_t start, end;
+	int thread;
+
+	//how many zones this one is inside, on its thread.
+	int depth;
+};
+
+struct frame_record {
+	int64_t start, end;
+	std::vector<zone_record> zones;
+};
+
+//gets up to the given number of the most recent complete frames, oldest
+//first. Zones which have already been overwritten are left out.
+void get_frames(std::vector<frame_record>& frames, int max_frames);
+
+//writes the recorded frames in the Chrome trace event format, which
+//chrome://tracing and Perfetto can load.
+void write_trace(std::string& out);
+void write_trace_file(const std::string& fname);
+
+//draws the times of recent frames, and where the time of the last one
+//went, in the top right corner of the screen.
+void draw_overlay();
+
+}
+
+#endif
@@ -1,24 +1,33 @@
 #include <algorithm>
 #include <string>
 
+#include <stdlib.h>
+#include <time.h>
+
 #include "ai_player.hpp"
 #include "asserts.hpp"
 #include "card.hpp"
+#include "filesystem.hpp"
 #include "foreach.hpp"
 #include "formatter.hpp"
 #include "formula_callable.hpp"
 #include "game.hpp"
 #include "game_formula_functions.hpp"
 #include "game_utils.hpp"
+#include "logging.hpp"
 #include "pathfind.hpp"
+#include "random.hpp"
 #include "resource.hpp"
 #include "string_utils.hpp"
 #include "terrain.hpp"
+#include "unit_test.hpp"
 #include "unit_utils.hpp"
 #include "wml_node.hpp"
 #include "wml_parser.hpp"
 #include "wml_utils.hpp"
+#include "wml_visitor.hpp"
 #include "wml_writer.hpp"
+#include "xml_parser.hpp"
 #include "xml_writer.hpp"
 
 namespace {
@@ -48,9 +57,23 @@ std::string xml_str(const TiXmlElement& el, const char* s)
 
 	return attr;
 }
+
+unsigned int new_game_seed()
+{
+	static unsigned int ngames = 0;
+	return static_cast<unsigned int>(time(NULL)) + ngames++;
+}
+
+std::string print_xml(const TiXmlElement& el)
+{
+	TiXmlPrinter printer;
+	printer.SetStreamPrinting();
+	el.Accept(&printer);
+	return printer.Str();
+}
 }
 
-game_context::game_context(game* g) : old_game_(current_game)
+game_context::game_context(game* g) : old_game_(current_game), old_rng_state_(rng::set_state(g ? &g->rng_seed_ : NULL))
 {
 	current_game = g;
 }
@@ -58,11 +81,13 @@ game_context::game_context(game* g) : old_game_(current_game)
 game_context::~game_context()
 {
 	current_game = old_game_;
+	rng::set_state(old_rng_state_);
 }
 
 void game_context::set(game* g)
 {
 	current_game = g;
+	rng::set_state(g ? &g->rng_seed_ : NULL);
 }
 
 game* game::current()
@@ -71,33 +96,60 @@ game* game::current()
 }
 
 game::game()
-  : started_(false), width_(0), height_(0), state_(STATE_SETUP), player_turn_(-1), player_casting_(-1), spell_casting_passes_(0), done_main_phase_(false)
+  : started_(false), width_(0), height_(0), state_(STATE_SETUP), player_turn_(-1), player_casting_(-1), spell_casting_passes_(0), done_main_phase_(false),
+    rng_seed_(new_game_seed()), next_unit_key_(1)
 {
+	command_log_ = formatter() << "<replay seed=\"" << rng_seed_ << "\"/>\n";
 }
 
 game::game(wml::const_node_ptr node)
-  : started_(wml::get_bool(node, "started")),
-    width_(wml::get_int(node, "width")),
-    height_(wml::get_int(node, "height")),
-	state_(STATE_SETUP),
-	player_turn_(wml::get_int(node, "player_turn", -1)),
-	player_casting_(wml::get_int(node, "player_casting", -1)),
-	spell_casting_passes_(0), done_main_phase_(false)
+  : started_(false), width_(0), height_(0),
+	state_(STATE_SETUP), player_turn_(-1), player_casting_(-1),
+	spell_casting_passes_(0), done_main_phase_(false),
+	rng_seed_(new_game_seed()), next_unit_key_(1)
+{
+	update_from_snapshot(node);
+}
+
+void game::update_from_snapshot(wml::const_node_ptr node)
 {
-	std::cerr << "GAME: " << wml::output(node) << "\n";
-	std::vector<std::string> v = util::split(node->attr("tiles"));
-	for(int n = 0; n != v.size(); ++n) {
-		const int x = n%width_;
-		const int y = n/width_;
-		tiles_.push_back(tile(x, y, v[n]));
+	LOG_DEBUG("game: " << wml::output(node));
+	started_ = wml::get_bool(node, "started");
+	width_ = wml::get_int(node, "width");
+	height_ = wml::get_int(node, "height");
+	player_turn_ = wml::get_int(node, "player_turn", -1);
+	player_casting_ = wml::get_int(node, "player_casting", -1);
+
+	//the map rarely changes, so the tiles are only looked at one by one
+	//if they've changed at all.
+	const std::string& tiles = node->attr("tiles");
+	if(tiles != snapshot_tiles_ || width_*height_ != tiles_.size()) {
+		const std::vector<std::string> v = util::split(tiles);
+		const std::vector<std::string> prev = util::split(snapshot_tiles_);
+		if(v.size() != prev.size() || v.size() != tiles_.size()) {
+			tiles_.clear();
+			for(int n = 0; n != v.size(); ++n) {
+				tiles_.push_back(tile(n%width_, n/width_, v[n]));
+			}
+		} else {
+			for(int n = 0; n != v.size(); ++n) {
+				if(v[n] != prev[n]) {
+					tiles_[n] = tile(n%width_, n/width_, v[n]);
+				}
+			}
+		}
+
+		snapshot_tiles_ = tiles;
 	}
 
 	ASSERT_EQ(width_*height_, tiles_.size());
 
+	cities_.clear();
 	FOREACH_WML_CHILD(city_node, node, "city") {
 		cities_.push_back(city_ptr(new city(city_node)));
 	}
 
+	players_.clear();
 	FOREACH_WML_CHILD(player_node, node, "player") {
 		players_.push_back(player());
 		players_.back().name = player_node->attr("name");
@@ -119,23 +171,50 @@ game::game(wml::const_node_ptr node)
 		}
 	}
 
+	neutral_towers_.clear();
 	FOREACH_WML_CHILD(neutral_node, node, "neutral") {
 		neutral_towers_.insert(hex::location(wml::get_int(neutral_node, "x"), wml::get_int(neutral_node, "y")));
 	}
 
+	//building a unit compiles its event handlers, so units are only built
+	//again if they've changed.
+	std::map<int, unit_ptr> old_units;
+	foreach(const unit_ptr& u, units_) {
+		old_units[u->key()] = u;
+	}
+
+	units_.clear();
 	FOREACH_WML_CHILD(unit_node, node, "unit") {
-		units_.push_back(unit_ptr(new unit(unit_node)));
+		//the unit is compared as it is now, rather than with the last
+		//snapshot, since it may have been changed locally since then.
+		const int key = wml::get_int(unit_node, "key", -1);
+		std::map<int, unit_ptr>::const_iterator old = old_units.find(key);
+		if(key != -1 && old != old_units.end() && wml::equal(old->second->write(), unit_node)) {
+			units_.push_back(old->second);
+		} else {
+			units_.push_back(unit_ptr(new unit(unit_node)));
+		}
+
+		//keys given out from here on mustn't clash with the snapshot's.
+		next_unit_key_ = std::max(next_unit_key_, units_.back()->key() + 1);
 	}
 }
 
 wml::node_ptr game::write() const
 {
-	wml::node_ptr res(new wml::node("game"));
-	res->set_attr("started", started_ ? "yes" : "no");
-	res->set_attr("width", formatter() << width_);
-	res->set_attr("height", formatter() << height_);
-	res->set_attr("player_turn", formatter() << player_turn_);
-	res->set_attr("player_casting", formatter() << player_casting_);
+	wml::node_builder builder;
+	write(builder);
+	return builder.result();
+}
+
+void game::write(wml::visitor& v) const
+{
+	v.begin_element("game");
+	v.attr("started", started_ ? "yes" : "no");
+	v.attr("width", width_);
+	v.attr("height", height_);
+	v.attr("player_turn", player_turn_);
+	v.attr("player_casting", player_casting_);
 	std::string tiles;
 	for(int n = 0; n != tiles_.size(); ++n) {
 		if(n != 0) {
@@ -145,28 +224,28 @@ wml::node_ptr game::write() const
 		tiles_[n].write(tiles);
 	}
 
-	res->set_attr("tiles", tiles);
+	v.attr("tiles", tiles);
 
 	foreach(city_ptr c, cities_) {
-		res->add_child(c->write());
+		c->write(v);
 	}
 
 	foreach(const hex::location& loc, neutral_towers_) {
-		res->add_child(hex::write_location("neutral", loc));
+		hex::write_location(v, "neutral", loc);
 	}
 
 	foreach(unit_ptr u, units_) {
-		res->add_child(u->write());
+		u->write(v);
 	}
 
 	int nplayer = 0;
+	std::string spells_str;
 	foreach(const player& p, players_) {
-		wml::node_ptr player_node(new wml::node("player"));
-		player_node->set_attr("name", p.name);
-		player_node->set_attr("unit_limit", formatter() << get_player_unit_limit_slots_used(nplayer) << "/" << get_player_unit_limit(nplayer));
-
+		v.begin_element("player");
+		v.attr("name", p.name);
+		v.attr("unit_limit", formatter() << get_player_unit_limit_slots_used(nplayer) << "/" << get_player_unit_limit(nplayer));
 
-		std::ostringstream stream;
+		spells_str.clear();
 		foreach(const held_card& c, p.spells) {
 			bool usable = player_casting_ == nplayer && c.embargo == 0;
 			if(usable) {
@@ -174,34 +253,47 @@ wml::node_ptr game::write() const
 				const bool playable = c.card->is_card_playable(NULL, nplayer, targets, possible_targets);
 				usable = playable || !possible_targets.empty();
 			}
-			stream << c.card->id() << " " << c.embargo << " " << (usable ? "1" : "0") << ",";
+
+			char embargo[16];
+			snprintf(embargo, sizeof(embargo), " %d ", c.embargo);
+			spells_str += c.card->id();
+			spells_str += embargo;
+			spells_str += usable ? "1," : "0,";
 		}
 
-		std::string spells_str = stream.str();
 		if(spells_str.empty() == false) {
 			//cut off the last comma
 			spells_str.resize(spells_str.size()-1);
 		}
 
-		player_node->set_attr("spells", spells_str);
+		v.attr("spells", spells_str);
 
 		if(!p.resources.empty()) {
-			player_node->set_attr("resources", util::join_ints(&p.resources[0], p.resources.size()));
-			player_node->set_attr("resource_gain", util::join_ints(&p.resource_gain[0], p.resource_gain.size()));
+			v.attr("resources", util::join_ints(&p.resources[0], p.resources.size()));
+			v.attr("resource_gain", util::join_ints(&p.resource_gain[0], p.resource_gain.size()));
 		}
 
 		for(std::map<hex::location, char>::const_iterator i = p.towers.begin();
 		    i != p.towers.end(); ++i) {
-			wml::node_ptr node = hex::write_location("tower", i->first);
-			node->set_attr("resource", formatter() << i->second);
-			player_node->add_child(node);
+			v.begin_element("tower");
+			hex::write_location_attr(v, i->first);
+			v.attr("resource", std::string(1, i->second));
+			v.end_element();
 		}
 
-		res->add_child(player_node);
+		v.end_element();
 		++nplayer;
 	}
 
-	return res;
+	v.end_element();
+}
+
+void game::queue_state()
+{
+	//written straight into the message rather than going through a tree.
+	outgoing_messages_.push_back(message());
+	wml::xml_visitor v(outgoing_messages_.back().contents);
+	write(v);
 }
 
 namespace {
@@ -222,36 +314,41 @@ std::string write_steps(const hex::route& rt)
 	return s.str();
 }
 
-void write_route_map(const hex::route_map& m, wml::node_ptr result) {
+void write_route_map(const hex::route_map& m, wml::visitor& v) {
 	for(std::map<hex::location, hex::route>::const_iterator i = m.begin();
 	    i != m.end(); ++i) {
-		wml::node_ptr node = hex::write_location("route", i->first);
-
-		node->set_attr("steps", write_steps(i->second));
-
-		result->add_child(node);
+		v.begin_element("route");
+		hex::write_location_attr(v, i->first);
+		v.attr("steps", write_steps(i->second));
+		v.end_element();
 	}
 }
 }
 
 void game::handle_message(int nplayer, const TiXmlElement& msg)
+{
+	log_command(formatter() << "<message player=\"" << nplayer << "\">" << print_xml(msg) << "</message>");
+	handle_message_internal(nplayer, msg);
+}
+
+void game::handle_message_internal(int nplayer, const TiXmlElement& msg)
 {
 	const std::string type = msg.Value();
 	if(type == "commands") {
 		for(const TiXmlElement* t = msg.FirstChildElement(); t != NULL; t = t->NextSiblingElement()) {
-			handle_message(nplayer, *t);
+			handle_message_internal(nplayer, *t);
 		}
 	} else if(type == "setup") {
 		setup_game();
-		queue_message(wml::output_xml(write()));
+		state_ = STATE_PLAYING;
+		player_casting_ = player_turn_ = 0;
+		queue_state();
 
 		EXPECT_GE(players_.size(), 1);
 		queue_message(formatter() << "<new_turn player=\"" << players_.front().name << "\"></new_turn>\n");
-		state_ = STATE_PLAYING;
-		player_casting_ = player_turn_ = 0;
 	} else if(type == "spells") {
 		//no-op.
-		queue_message(wml::output_xml(write()));
+		queue_state();
 	} else if(type == "select_unit") {
 		const hex::location loc(parse_loc_from_xml(msg));
 		unit_ptr u = get_unit_at(loc);
@@ -260,9 +357,13 @@ void game::handle_message(int nplayer, const TiXmlElement& msg)
 				hex::route_map routes;
 				hex::find_possible_moves(u->loc(), u->move(), unit_movement_cost_calculator(this, u), routes);
 
-				wml::node_ptr node(hex::write_location("select_unit_move", loc));
-				write_route_map(routes, node);
-				queue_message(wml::output_xml(node), nplayer);
+				std::string msg;
+				wml::xml_visitor v(msg);
+				v.begin_element("select_unit_move");
+				hex::write_location_attr(v, loc);
+				write_route_map(routes, v);
+				v.end_element();
+				queue_message(msg, nplayer);
 			}
 		}
 
@@ -288,7 +389,7 @@ void game::handle_message(int nplayer, const TiXmlElement& msg)
 		anim_node->set_attr("steps", write_steps(routes[to_loc]));
 		anim_node->add_child(hex::write_location("from", from_loc));
 		anim_node->add_child(hex::write_location("to", to_loc));
-		queue_message(wml::output_xml(anim_node));
+		queue_message(wml::output_xml(anim_node, wml::XML_COMPACT));
 
 		u->set_loc(to_loc);
 		u->set_moved();
@@ -335,7 +436,7 @@ void game::handle_message(int nplayer, const TiXmlElement& msg)
 			if(playable_abilities.empty()) {
 				end_turn(u->side(), false);
 			} else {
-				queue_message(wml::output_xml(write()));
+				queue_state();
 	
 				if(query_abilities != NULL) {
 					std::ostringstream s;
@@ -382,7 +483,7 @@ void game::end_turn(int nplayer, bool skipping)
 	//make sure any units die that are meant to.
 	do_state_based_actions();
 
-	std::cerr << "SPELLS: " << spell_casting_passes_ << " / " << players_.size() << "\n";
+	LOG_DEBUG("spells: " << spell_casting_passes_ << " / " << players_.size());
 
 	if(spell_casting_passes_ >= players_.size()) {
 		spell_casting_passes_ = 0;
@@ -436,7 +537,7 @@ void game::end_turn(int nplayer, bool skipping)
 				if(resources[m] < 0) {
 					resources[m] = 0;
 				}
-				std::cerr << "PLAYER " << n << " RESOURCE " << m << ": " << resources[m] << "\n";
+				LOG_DEBUG_FIELDS(logging::fields().player(n), "resource " << m << ": " << resources[m]);
 			}
 		}
 
@@ -454,23 +555,23 @@ void game::end_turn(int nplayer, bool skipping)
 		spell_casting_passes_ = 0;
 	}
 	
-	queue_message(wml::output_xml(write()));
+	queue_state();
 	queue_message(formatter() << "<new_turn player=\"" << players_[player_casting_].name << "\"></new_turn>\n");
 
 	foreach(boost::shared_ptr<ai_player> ai, ai_) {
-		std::vector<wml::node_ptr> nodes = ai->play();
+		std::vector<wml::const_node_ptr> nodes = ai->play();
 
 		while(nodes.empty() == false) {
-			foreach(wml::node_ptr node, nodes) {
-				std::string msg(wml::output_xml(node));
-				std::cerr << "AI MESSAGE: " << msg << "\n";
+			foreach(wml::const_node_ptr node, nodes) {
+				std::string msg(wml::output_xml(node, wml::XML_COMPACT));
+				LOG_DEBUG("ai message: " << msg);
 
 				TiXmlDocument xml_doc;
 				xml_doc.Parse(msg.c_str());
 
 				TiXmlElement* doc = xml_doc.RootElement();
 
-				handle_message(ai->player_id(), *doc);
+				handle_message_internal(ai->player_id(), *doc);
 			}
 
 			nodes = ai->play();
@@ -508,10 +609,10 @@ bool game::play_card(int nplayer, const TiXmlElement& msg, int speed)
 		targets.push_back(loc);
 	}
 
-	std::cerr << "CHECKING CARD PLAYABILITY...\n";
+	LOG_DEBUG_FIELDS(logging::fields().player(nplayer), "checking card playability");
 
 	if(!card->is_card_playable(caster.get(), nplayer, targets, possible_targets)) {
-		std::cerr << "NOT PLAYABLE..\n";
+		LOG_DEBUG_FIELDS(logging::fields().player(nplayer), "card not playable");
 		std::ostringstream msg;
 		msg << "<illegal_cast legal_targets=\"";
 		for(int n = 0; n != possible_targets.size(); ++n) {
@@ -528,7 +629,7 @@ bool game::play_card(int nplayer, const TiXmlElement& msg, int speed)
 		return false;
 	}
 
-	std::cerr << "PLAYABLE..\n";
+	LOG_DEBUG_FIELDS(logging::fields().player(nplayer), "card playable");
 
 	if(caster) {
 		if(card->taps_caster()) {
@@ -537,7 +638,7 @@ bool game::play_card(int nplayer, const TiXmlElement& msg, int speed)
 	} else {
 		foreach(held_card& spell, p.spells) {
 			if(spell.card->id() == type) {
-				spell.embargo = 1 + rand()%3;
+				spell.embargo = 1 + rng::generate()%3;
 			}
 		}
 	}
@@ -554,7 +655,7 @@ bool game::play_card(int nplayer, const TiXmlElement& msg, int speed)
 	resolve_card(nplayer, card, msg);
 	do_state_based_actions();
 
-	queue_message(wml::output_xml(write()));
+	queue_state();
 	return true;
 }
 
@@ -626,7 +727,7 @@ void game::resolve_card(int nplayer, const_card_ptr card, const TiXmlElement& ms
 	const variant context_holder(callable_context);
 	card->resolve_card(callable_context);
 
-	std::cerr << "RESOLVING CARD...\n";
+	LOG_DEBUG_FIELDS(logging::fields().player(nplayer), "card resolved");
 
 	for(const TiXmlElement* monster = msg.FirstChildElement("monster"); monster != NULL; monster = monster->NextSiblingElement("monster")) {
 		hex::location loc(parse_loc_from_xml(*monster));
@@ -746,6 +847,82 @@ void game::capture_tower(const hex::location& loc, unit_ptr u)
 	}
 }
 
+void game::set_command_log_file(const std::string& fname)
+{
+	command_log_file_.reset(fopen(fname.c_str(), "ab"), fclose);
+	if(!command_log_file_) {
+		LOG_ERROR("could not open command log " << fname);
+		return;
+	}
+
+	fwrite(command_log_.c_str(), 1, command_log_.size(), command_log_file_.get());
+	fflush(command_log_file_.get());
+}
+
+void game::log_command(const std::string& entry)
+{
+	command_log_ += entry;
+	command_log_ += "\n";
+
+	if(command_log_file_) {
+		fwrite(entry.c_str(), 1, entry.size(), command_log_file_.get());
+		fputc('\n', command_log_file_.get());
+	}
+}
+
+void game::flush_command_log()
+{
+	if(command_log_file_) {
+		fflush(command_log_file_.get());
+	}
+}
+
+boost::intrusive_ptr<game> game::replay(const std::string& log)
+{
+	boost::intrusive_ptr<game> g(new game);
+	const game_context context(g.get());
+
+	foreach(const std::string& line, util::split(log, '\n')) {
+		TiXmlDocument doc;
+		doc.Parse(line.c_str());
+		if(doc.Error() || doc.RootElement() == NULL) {
+			//most likely the last entry, cut off when the game went down.
+			LOG_WARN("ignoring bad replay entry: " << line);
+			continue;
+		}
+
+		const TiXmlElement& el = *doc.RootElement();
+		const std::string type = el.ValueStr();
+		if(type == "replay") {
+			g->rng_seed_ = strtoul(xml_str(el, "seed").c_str(), NULL, 10);
+			g->command_log_ = line + "\n";
+		} else if(type == "add_player" || type == "add_ai_player") {
+			wml::node_ptr info_node(new wml::node("player_info"));
+			info_node->set_attr("spells", xml_str(el, "spells"));
+			info_node->set_attr("resource_gain", xml_str(el, "resource_gain"));
+
+			//the player only had the spells in the deck they joined with,
+			//not every card.
+			player_info info(info_node);
+			info.set_collection(info.deck());
+			if(type == "add_player") {
+				g->add_player(xml_str(el, "name"), info);
+			} else {
+				g->add_ai_player(xml_str(el, "name"), info);
+			}
+		} else if(type == "message" && el.FirstChildElement() != NULL) {
+			try {
+				g->handle_message(xml_int(el, "player"), *el.FirstChildElement());
+			} catch(assert_fail_exception&) {
+			}
+		}
+
+		g->outgoing_messages_.clear();
+	}
+
+	return g;
+}
+
 void game::swap_outgoing_messages(std::vector<message>& msg)
 {
 	outgoing_messages_.swap(msg);
@@ -765,7 +942,7 @@ void game::send_error(const std::string& msg, int nplayer)
 {
 	wml::node_ptr node(new wml::node("error"));
 	node->set_attr("message", msg);
-	queue_message(wml::output_xml(node), nplayer);
+	queue_message(wml::output_xml(node, wml::XML_COMPACT), nplayer);
 }
 
 bool game::add_city(city_ptr new_city)
@@ -788,14 +965,14 @@ void game::setup_game()
 
 			static const char* TerrainTypes[] = { "grassland" };
 
-			const char* type = TerrainTypes[rand()%(sizeof(TerrainTypes)/sizeof(*TerrainTypes))];
+			const char* type = TerrainTypes[rng::generate()%(sizeof(TerrainTypes)/sizeof(*TerrainTypes))];
 
 			if(loc == hex::location(2, 8) || loc == hex::location(12, 8)) {
 				//pass.
-			} else if(rand()%24 == 0) {
+			} else if(rng::generate()%24 == 0) {
 				type = "tower";
 				neutral_towers_.insert(loc);
-			} else if(rand()%16 == 0) {
+			} else if(rng::generate()%16 == 0) {
 				type = "rock";
 			}
 			tiles_.push_back(tile(x, y, type));
@@ -846,8 +1023,24 @@ tile* game::get_tile(int x, int y)
 	return &tiles_[y*width_ + x];
 }
 
+namespace {
+std::string write_add_player(const char* type, const std::string& name, const player_info& pl)
+{
+	TiXmlElement el(type);
+	el.SetAttribute("name", name);
+	el.SetAttribute("spells", util::join(pl.deck()));
+	if(!pl.resources().empty()) {
+		el.SetAttribute("resource_gain", util::join_ints(&pl.resources()[0], pl.resources().size()));
+	}
+
+	return print_xml(el);
+}
+}
+
 void game::add_player(const std::string& name, const player_info& pl)
 {
+	log_command(write_add_player("add_player", name, pl));
+
 	players_.push_back(player());
 	players_.back().name = name;
 
@@ -862,6 +1055,8 @@ void game::add_player(const std::string& name, const player_info& pl)
 
 void game::add_ai_player(const std::string& name, const player_info& pl)
 {
+	log_command(write_add_player("add_ai_player", name, pl));
+
 	players_.push_back(player());
 	players_.back().name = name;
 	ai_.push_back(boost::shared_ptr<ai_player>(ai_player::create(*this, players_.size()-1)));
@@ -968,7 +1163,7 @@ bool game::do_state_based_actions()
 	foreach(unit_ptr& u, units_) {
 		if(u->damage_taken() >= u->life()) {
 			const wml::const_node_ptr death_anim_node(hex::write_location("death_anim", u->loc()));
-			queue_message(wml::output_xml(death_anim_node));
+			queue_message(wml::output_xml(death_anim_node, wml::XML_COMPACT));
 
 			actions = true;
 			u.reset();
@@ -1097,3 +1292,166 @@ int get_player_unit_limit(int side)
 	const game::player& p = game::current()->players()[side];
 	return p.towers.size() + 2;
 }
+
+UTILITY(replay_game)
+{
+	if(args.empty()) {
+		std::cerr << "usage: replay_game <command log> [expected final state]\n";
+		return;
+	}
+
+	boost::intrusive_ptr<game> g = game::replay(sys::read_file(args[0]));
+	const game_context context(g.get());
+	const std::string state = wml::output_xml(g->write());
+	if(args.size() < 2) {
+		std::cout << state;
+		return;
+	}
+
+	if(state == sys::read_file(args[1])) {
+		std::cerr << "REPLAY OF " << args[0] << " MATCHES\n";
+	} else {
+		std::cerr << "REPLAY OF " << args[0] << " DIFFERS FROM " << args[1] << "\n";
+		std::cout << state;
+	}
+}
+
+namespace {
+//a game between two players which has just been set up.
+boost::intrusive_ptr<game> create_test_game()
+{
+	boost::intrusive_ptr<game> g(new game);
+	const game_context context(g.get());
+	const player_info info;
+	g->add_player("a", info);
+	g->add_player("b", info);
+	g->handle_message(0, TiXmlElement("setup"));
+	return g;
+}
+}
+
+UNIT_TEST(game_write_visitor) {
+	boost::intrusive_ptr<game> g = create_test_game();
+	const game_context context(g.get());
+
+	std::string direct;
+	wml::xml_visitor v(direct);
+	g->write(v);
+
+	CHECK_EQ(wml::output_xml(wml::parse_xml(direct)), wml::output_xml(g->write()));
+}
+
+UNIT_TEST(game_update_from_snapshot) {
+	boost::intrusive_ptr<game> g = create_test_game();
+	const game_context context(g.get());
+	CHECK(g->units().size() >= 2, "the test game needs units");
+
+	boost::intrusive_ptr<game> client(new game(g->write()));
+	const std::vector<unit_ptr> before = client->units();
+
+	//one unit changes, one goes away, and a tile changes.
+	g->units()[0]->take_damage(1);
+	const int removed_key = g->units().back()->key();
+	g->units().pop_back();
+
+	tile* t = g->get_tile(1, 1);
+	t->set_terrain(t->terrain()->id() == "sea" ? "grassland" : "sea");
+
+	client->update_from_snapshot(g->write());
+	CHECK_EQ(wml::output_xml(client->write()), wml::output_xml(g->write()));
+	CHECK_EQ(client->units().size(), before.size() - 1);
+	CHECK(client->units()[0] != before[0], "a changed unit was kept");
+	CHECK_EQ(client->units()[0]->damage_taken(), 1);
+	CHECK_EQ(client->get_tile(1, 1)->terrain()->id(), t->terrain()->id());
+	for(int n = 1; n != client->units().size(); ++n) {
+		CHECK(client->units()[n] == before[n], "an unchanged unit was built again");
+		CHECK_NE(client->units()[n]->key(), removed_key);
+	}
+
+	//a unit changed on the client is built again from a snapshot, even
+	//one the same as the last.
+	const wml::const_node_ptr snapshot = g->write();
+	const unit_ptr changed = client->units()[0];
+	changed->set_moved(!changed->has_moved());
+	client->update_from_snapshot(snapshot);
+	CHECK(client->units()[0] != changed, "a unit changed on the client was kept");
+	CHECK_EQ(client->units()[0]->has_moved(), g->units()[0]->has_moved());
+
+	const unit_ptr rebuilt = client->units()[0];
+	client->update_from_snapshot(snapshot);
+	CHECK(client->units()[0] == rebuilt, "an unchanged unit was built again");
+
+	//keys the client gives out don't clash with any in the snapshot.
+	int max_key = 0;
+	foreach(const unit_ptr& u, g->units()) {
+		max_key = std::max(max_key, u->key());
+	}
+
+	CHECK_GT(client->allocate_unit_key(), max_key);
+}
+
+UNIT_TEST(game_replay) {
+	boost::intrusive_ptr<game> g = create_test_game();
+	boost::intrusive_ptr<game> replayed = game::replay(g->command_log());
+	const game_context context(replayed.get());
+	CHECK_EQ(wml::output_xml(replayed->write()), wml::output_xml(g->write()));
+}
+
+BENCHMARK(game_update_from_snapshot)
+{
+	boost::intrusive_ptr<game> g = create_test_game();
+	const game_context context(g.get());
+
+	const wml::const_node_ptr node = g->write();
+	boost::intrusive_ptr<game> client(new game(node));
+	BENCHMARK_LOOP {
+		client->update_from_snapshot(node);
+	}
+}
+
+BENCHMARK(game_from_snapshot)
+{
+	boost::intrusive_ptr<game> g = create_test_game();
+	const game_context context(g.get());
+
+	const wml::const_node_ptr node = g->write();
+	BENCHMARK_LOOP {
+		boost::intrusive_ptr<game> client(new game(node));
+	}
+}
+
+BENCHMARK(game_write_xml)
+{
+	boost::intrusive_ptr<game> g = create_test_game();
+	const game_context context(g.get());
+
+	const wml::const_node_ptr node = g->write();
+	std::string buf;
+	BENCHMARK_LOOP {
+		buf.clear();
+		wml::write_xml(node, buf, wml::XML_COMPACT);
+	}
+}
+
+BENCHMARK(game_write)
+{
+	boost::intrusive_ptr<game> g = create_test_game();
+	const game_context context(g.get());
+
+	BENCHMARK_LOOP {
+		g->write();
+	}
+}
+
+BENCHMARK(game_write_direct)
+{
+	boost::intrusive_ptr<game> g = create_test_game();
+	const game_context context(g.get());
+
+	std::string buf;
+	BENCHMARK_LOOP {
+		buf.clear();
+		wml::xml_visitor v(buf);
+		g->write(v);
+	}
+}
@@ -3,6 +3,8 @@
 
 #include <set>
 
+#include <stdio.h>
+
 #include "ai_player.hpp"
 #include "card.hpp"
 #include "city.hpp"
@@ -22,9 +24,29 @@ public:
 
 	game();
 	explicit game(wml::const_node_ptr node);
+
+	//brings the game into line with a snapshot of it, as written by
+	//write(). Units are matched up by key, and a unit which would write
+	//the same as its part of the snapshot is kept rather than built
+	//again, so anything held on to for it stays good.
+	void update_from_snapshot(wml::const_node_ptr node);
+
 	wml::node_ptr write() const;
+	void write(wml::visitor& v) const;
 	void handle_message(int nplayer, const TiXmlElement& msg);
 
+	//every player added and every message handed to handle_message() is
+	//appended to the command log, one element per line, after a header
+	//holding the game's initial rng seed. Replaying the log through
+	//replay() rebuilds an identical game.
+	const std::string& command_log() const { return command_log_; }
+	void set_command_log_file(const std::string& fname);
+
+	//entries are buffered on their way to the file, which is flushed by
+	//calling this, or when the game is destroyed.
+	void flush_command_log();
+	static boost::intrusive_ptr<game> replay(const std::string& log);
+
 	struct message {
 		std::vector<int> recipients;
 		std::string contents;
@@ -78,9 +100,19 @@ public:
 	std::set<hex::location> tower_locs() const;
 
 	void execute_command(variant v, class client_play_game* client);
+
+	int allocate_unit_key() { return next_unit_key_++; }
 private:
+	friend class game_context;
+
 	variant get_value(const std::string& key) const;
 
+	void handle_message_internal(int nplayer, const TiXmlElement& msg);
+	void log_command(const std::string& entry);
+
+	//queues the whole state of the game to go to every player.
+	void queue_state();
+
 	bool play_card(int nplayer, const TiXmlElement& msg, int speed=-1);
 	void resolve_card(int nplayer, const_card_ptr card, const TiXmlElement& msg);
 
@@ -97,6 +129,10 @@ private:
 	std::vector<player> players_;
 
 	std::vector<unit_ptr> units_;
+
+	//what the last snapshot read had for the tiles, to tell which have
+	//changed in the next one.
+	std::string snapshot_tiles_;
 	
 	void draw_hand(int nplayer, int ncards=5);
 	std::vector<message> outgoing_messages_;
@@ -116,10 +152,18 @@ private:
 	void assign_tower_owners();
 
 	std::vector<boost::shared_ptr<ai_player> > ai_;
+
+	//the game's own rng state, made current by game_context.
+	unsigned int rng_seed_;
+	int next_unit_key_;
+
+	std::string command_log_;
+	boost::shared_ptr<FILE> command_log_file_;
 };
 
 class game_context {
 	game* old_game_;
+	unsigned int* old_rng_state_;
 public:
 	explicit game_context(game* g);
 	void set(game* g);
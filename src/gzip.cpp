@@ -0,0 +1,103 @@
+#include <string.h>
+
+#include "asserts.hpp"
+#include "gzip.hpp"
+#include "unit_test.hpp"
+
+namespace gzip
+{
+
+namespace {
+//adding 16 to zlib's window size selects the gzip format rather than
+//raw zlib.
+const int GzipWindowBits = 15 + 16;
+const int MemLevel = 8;
+}
+
+compressor::compressor(int level)
+{
+	memset(&stream_, 0, sizeof(stream_));
+	const int res = deflateInit2(&stream_, level, Z_DEFLATED, GzipWindowBits, MemLevel, Z_DEFAULT_STRATEGY);
+	ASSERT_EQ(res, Z_OK);
+}
+
+compressor::~compressor()
+{
+	deflateEnd(&stream_);
+}
+
+void compressor::compress(const char* data, size_t len, std::string& out)
+{
+	deflateReset(&stream_);
+
+	const size_t start = out.size();
+	out.resize(start + deflateBound(&stream_, len));
+
+	stream_.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+	stream_.avail_in = len;
+	stream_.next_out = reinterpret_cast<Bytef*>(&out[start]);
+	stream_.avail_out = out.size() - start;
+
+	//deflateBound() guarantees there is room for all of it in one go.
+	const int res = deflate(&stream_, Z_FINISH);
+	ASSERT_EQ(res, Z_STREAM_END);
+
+	out.resize(out.size() - stream_.avail_out);
+}
+
+bool is_compressed(const char* data, size_t len)
+{
+	return len >= 2 && static_cast<unsigned char>(data[0]) == 0x1f && static_cast<unsigned char>(data[1]) == 0x8b;
+}
+
+bool decompress(const char* data, size_t len, std::string& out)
+{
+	z_stream stream;
+	memset(&stream, 0, sizeof(stream));
+	if(inflateInit2(&stream, GzipWindowBits) != Z_OK) {
+		return false;
+	}
+
+	stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+	stream.avail_in = len;
+
+	int res = Z_OK;
+	char buf[16384];
+	while(res == Z_OK) {
+		stream.next_out = reinterpret_cast<Bytef*>(buf);
+		stream.avail_out = sizeof(buf);
+		res = inflate(&stream, Z_NO_FLUSH);
+		if(res == Z_OK || res == Z_STREAM_END) {
+			out.append(buf, sizeof(buf) - stream.avail_out);
+		}
+	}
+
+	inflateEnd(&stream);
+	return res == Z_STREAM_END;
+}
+
+}
+
+UNIT_TEST(gzip_round_trip) {
+	std::string msg;
+	for(int n = 0; n != 1000; ++n) {
+		msg += "<unit x=\"1\" y=\"2\" name=\"Wizard\"/>";
+	}
+
+	gzip::compressor compressor;
+	for(int n = 0; n != 3; ++n) {
+		std::string compressed;
+		compressor.compress(msg.data(), msg.size(), compressed);
+		CHECK(gzip::is_compressed(compressed.data(), compressed.size()), "compressed data not recognized");
+		CHECK(compressed.size() < msg.size()/10, "poor compression: " << compressed.size());
+
+		std::string decompressed;
+		CHECK(gzip::decompress(compressed.data(), compressed.size(), decompressed), "could not decompress");
+		CHECK_EQ(decompressed, msg);
+	}
+
+	CHECK(!gzip::is_compressed(msg.data(), msg.size()), "plain message taken for gzip");
+
+	std::string out;
+	CHECK(!gzip::decompress(msg.data(), msg.size(), out), "decompressed garbage");
+}
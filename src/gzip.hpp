@@ -0,0 +1,41 @@
+#ifndef GZIP_HPP_INCLUDED
+#define GZIP_HPP_INCLUDED
+
+#include <stddef.h>
+
+#include <string>
+
+#include <zlib.h>
+
+namespace gzip
+{
+
+//compresses buffers into the gzip format. Setting up zlib's state costs
+//far more than compressing a typical message, so a compressor keeps its
+//state and resets it between buffers rather than starting afresh.
+class compressor
+{
+public:
+	explicit compressor(int level=Z_DEFAULT_COMPRESSION);
+	~compressor();
+
+	//appends the compressed form of the data to out.
+	void compress(const char* data, size_t len, std::string& out);
+private:
+	compressor(const compressor&);
+	void operator=(const compressor&);
+
+	z_stream stream_;
+};
+
+//true if the data begins with the gzip magic number. Messages are XML,
+//which can't, so this tells compressed messages apart from plain ones.
+bool is_compressed(const char* data, size_t len);
+
+//appends the decompressed data to out; returns false if the data is not
+//valid gzip.
+bool decompress(const char* data, size_t len, std::string& out);
+
+}
+
+#endif
@@ -0,0 +1,379 @@
+#include <stdlib.h>
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <boost/array.hpp>
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include "ai_player.hpp"
+#include "client_network.hpp"
+#include "foreach.hpp"
+#include "formatter.hpp"
+#include "game.hpp"
+#include "gzip.hpp"
+#include "metrics.hpp"
+#include "movement_type.hpp"
+#include "terrain.hpp"
+#include "wml_node.hpp"
+#include "wml_parser.hpp"
+#include "xml_parser.hpp"
+#include "xml_writer.hpp"
+
+//Opens many simulated player connections against a server and plays
+//games between them using the AI, then reports how the server held up.
+//
+//Players talk to the server the way the web client does: every request
+//opens a connection, sends any pending commands followed by close_ajax,
+//and reads the single message the server replies with. Half the players
+//create games; the other half join them and start them straight away.
+//Everything runs on one thread with asynchronous sockets, so the number
+//of players is limited by file descriptors rather than threads.
+
+namespace {
+
+using boost::asio::ip::tcp;
+
+class latency_samples
+{
+public:
+	void add(int64_t micros) { samples_.push_back(micros); }
+	int size() const { return samples_.size(); }
+
+	//returns the given percentile in milliseconds.
+	double percentile(double p) {
+		if(samples_.empty()) {
+			return 0.0;
+		}
+
+		std::sort(samples_.begin(), samples_.end());
+		const int index = std::min<int>(samples_.size() - 1, int(samples_.size()*p));
+		return samples_[index]/1000.0;
+	}
+private:
+	std::vector<int64_t> samples_;
+};
+
+struct load_stats {
+	load_stats() : messages_received(0), commands_sent(0), errors(0),
+	               games_created(0), games_joined(0), bytes_received(0)
+	{}
+
+	int messages_received, commands_sent, errors;
+	int games_created, games_joined;
+
+	//bytes read off the wire, so with compression on this counts
+	//compressed bytes.
+	int64_t bytes_received;
+
+	//time from sending commands until the reply arrives.
+	latency_samples command_latency;
+
+	//time taken by polls which returned a message, rather than
+	//timing out with a heartbeat.
+	latency_samples delivery_latency;
+};
+
+class player_session
+{
+public:
+	player_session(boost::asio::io_service& io_service, const tcp::endpoint& endpoint,
+	               load_stats& stats, const std::string& nick, bool host, bool compress)
+	  : io_service_(io_service), endpoint_(endpoint), timer_(io_service),
+	    stats_(stats), nick_(nick), host_(host), compress_(compress), joined_(false),
+	    player_id_(-1), poll_started_(0), commands_in_poll_(false)
+	{
+		if(host_) {
+			pending_commands_ = "<create_game/>";
+		}
+	}
+
+	void start(int delay_ms)
+	{
+		timer_.expires_from_now(boost::posix_time::milliseconds(delay_ms));
+		timer_.async_wait(boost::bind(&player_session::start_poll, this));
+	}
+
+private:
+	void start_poll()
+	{
+		//a joiner waits until there is a game for it to join, so that
+		//each game gets exactly one joiner.
+		if(!host_ && !joined_ && stats_.games_joined < stats_.games_created) {
+			pending_commands_ = "<join_game/><setup/>";
+			joined_ = true;
+			++stats_.games_joined;
+		}
+
+		outgoing_.clear();
+		network::frame_message("<login name=\"" + nick_ + (compress_ ? "\" compress=\"gzip\"/>" : "\"/>"), outgoing_);
+		commands_in_poll_ = pending_commands_.empty() == false;
+		if(commands_in_poll_) {
+			network::frame_message("<commands>" + pending_commands_ + "</commands>", outgoing_);
+			pending_commands_.clear();
+			++stats_.commands_sent;
+		}
+
+		network::frame_message("<close_ajax/>", outgoing_);
+
+		incoming_.clear();
+		poll_started_ = metrics::get_time_micros();
+		socket_.reset(new tcp::socket(io_service_));
+		socket_->async_connect(endpoint_, boost::bind(&player_session::handle_connect, this, _1));
+	}
+
+	void handle_connect(const boost::system::error_code& e)
+	{
+		if(e) {
+			handle_error();
+			return;
+		}
+
+		boost::asio::async_write(*socket_, boost::asio::buffer(outgoing_), boost::bind(&player_session::handle_write, this, _1));
+	}
+
+	void handle_write(const boost::system::error_code& e)
+	{
+		if(e) {
+			handle_error();
+			return;
+		}
+
+		start_read();
+	}
+
+	void start_read()
+	{
+		socket_->async_read_some(boost::asio::buffer(read_buf_), boost::bind(&player_session::handle_read, this, _1, _2));
+	}
+
+	void handle_read(const boost::system::error_code& e, size_t nbytes)
+	{
+		incoming_.insert(incoming_.end(), read_buf_.begin(), read_buf_.begin() + nbytes);
+		stats_.bytes_received += nbytes;
+		if(!e) {
+			start_read();
+			return;
+		}
+
+		//the server closes the connection once it has sent its reply,
+		//which isn't terminated.
+		socket_.reset();
+		if(e != boost::asio::error::eof || incoming_.empty()) {
+			handle_error();
+			return;
+		}
+
+		std::vector<std::string> messages;
+		std::string msg;
+		if(gzip::is_compressed(&incoming_[0], incoming_.size())) {
+			if(!gzip::decompress(&incoming_[0], incoming_.size(), msg)) {
+				handle_error();
+				return;
+			}
+
+			incoming_.assign(msg.begin(), msg.end());
+		}
+
+		while(network::extract_message(incoming_, msg)) {
+			messages.push_back(msg);
+		}
+
+		if(incoming_.empty() == false) {
+			messages.push_back(std::string(incoming_.begin(), incoming_.end()));
+		}
+
+		bool got_reply = false;
+		foreach(const std::string& m, messages) {
+			got_reply = handle_message(m) || got_reply;
+		}
+
+		const int64_t elapsed = metrics::get_time_micros() - poll_started_;
+		if(commands_in_poll_) {
+			stats_.command_latency.add(elapsed);
+		} else if(got_reply) {
+			stats_.delivery_latency.add(elapsed);
+		}
+
+		start_poll();
+	}
+
+	void handle_error()
+	{
+		socket_.reset();
+		++stats_.errors;
+		timer_.expires_from_now(boost::posix_time::seconds(1));
+		timer_.async_wait(boost::bind(&player_session::start_poll, this));
+	}
+
+	//returns false for a heartbeat, which the server sends when it had
+	//nothing to tell us.
+	bool handle_message(const std::string& msg)
+	{
+		if(msg.empty() || msg[0] != '<') {
+			return false;
+		}
+
+		//a reply cut off or garbled on the way counts as an error, but the
+		//run carries on rather than losing everything measured so far.
+		wml::const_node_ptr node;
+		try {
+			node = wml::parse_xml(msg);
+		} catch(wml::parse_error& e) {
+			++stats_.errors;
+			return false;
+		}
+
+		if(node->name() == "heartbeat") {
+			//if we've gone quiet on our own turn, something the AI tried
+			//was rejected, so give the turn up rather than stalling.
+			if(game_ && game_->player_casting() == player_id_ && pending_commands_.empty()) {
+				pending_commands_ = "<end_turn skip=\"yes\"/>";
+			}
+
+			return false;
+		}
+
+		++stats_.messages_received;
+
+		//every player keeps its own copy of its game, so the right one
+		//has to be current while it is touched.
+		game_context context(game_.get());
+		if(node->name() == "game_created") {
+			++stats_.games_created;
+		} else if(node->name() == "game") {
+			if(game_) {
+				game_->update_from_snapshot(node);
+			} else {
+				game_.reset(new game(node));
+				context.set(game_.get());
+			}
+			player_id_ = -1;
+			for(int n = 0; n != game_->players().size(); ++n) {
+				if(game_->players()[n].name == nick_) {
+					player_id_ = n;
+					break;
+				}
+			}
+		} else if(node->name() == "new_turn" && node->attr("player").str() == nick_) {
+			play_turn();
+		}
+
+		return true;
+	}
+
+	void play_turn()
+	{
+		if(!game_ || player_id_ < 0) {
+			return;
+		}
+
+		boost::scoped_ptr<ai_player> ai(ai_player::create(*game_, player_id_, false));
+		const std::vector<wml::const_node_ptr> nodes = ai->play();
+		foreach(wml::const_node_ptr node, nodes) {
+			pending_commands_ += wml::output_xml(node, wml::XML_COMPACT);
+		}
+	}
+
+	boost::asio::io_service& io_service_;
+	tcp::endpoint endpoint_;
+	boost::asio::deadline_timer timer_;
+	load_stats& stats_;
+
+	std::string nick_;
+	bool host_, compress_, joined_;
+
+	boost::intrusive_ptr<game> game_;
+	int player_id_;
+
+	boost::shared_ptr<tcp::socket> socket_;
+	std::vector<char> outgoing_, incoming_;
+	boost::array<char, 4096> read_buf_;
+	std::string pending_commands_;
+	int64_t poll_started_;
+	bool commands_in_poll_;
+};
+
+void usage()
+{
+	std::cerr << "usage: load_generator [--host <host>] [--port <port>] [--players <n>] [--duration <seconds>] [--ramp <seconds>] [--compress]\n";
+}
+
+}
+
+int main(int argc, char** argv)
+{
+	std::string host = "localhost", port = "17000";
+	int nplayers = 100, duration = 60, ramp = 10;
+	bool compress = false;
+	for(int n = 1; n < argc; ++n) {
+		const std::string arg(argv[n]);
+		if(arg == "--compress") {
+			compress = true;
+			continue;
+		}
+
+		if(n + 1 == argc) {
+			usage();
+			return -1;
+		}
+
+		const std::string value(argv[++n]);
+		if(arg == "--host") {
+			host = value;
+		} else if(arg == "--port") {
+			port = value;
+		} else if(arg == "--players") {
+			nplayers = atoi(value.c_str());
+		} else if(arg == "--duration") {
+			duration = atoi(value.c_str());
+		} else if(arg == "--ramp") {
+			ramp = atoi(value.c_str());
+		} else {
+			usage();
+			return -1;
+		}
+	}
+
+	terrain::init(wml::parse_wml_from_file("data/terrain.xml"));
+	movement_type::init(wml::parse_wml_from_file("data/move.xml"));
+
+	boost::asio::io_service io_service;
+	tcp::resolver resolver(io_service);
+	const tcp::endpoint endpoint = *resolver.resolve(tcp::resolver::query(host, port));
+
+	load_stats stats;
+	std::vector<boost::shared_ptr<player_session> > sessions;
+	for(int n = 0; n != nplayers; ++n) {
+		//hosts all start in the first half of the ramp, so that there
+		//are games waiting by the time the joiners arrive.
+		const bool is_host = n%2 == 0;
+		const int delay_ms = (ramp*1000*n)/std::max(1, nplayers);
+		sessions.push_back(boost::shared_ptr<player_session>(new player_session(io_service, endpoint, stats, formatter() << "load" << n, is_host, compress)));
+		sessions.back()->start(is_host ? delay_ms/2 : delay_ms);
+	}
+
+	boost::asio::deadline_timer end_timer(io_service);
+	end_timer.expires_from_now(boost::posix_time::seconds(duration));
+	end_timer.async_wait(boost::bind(&boost::asio::io_service::stop, &io_service));
+
+	const int64_t start_time = metrics::get_time_micros();
+	io_service.run();
+	const double elapsed = (metrics::get_time_micros() - start_time)/1000000.0;
+
+	std::cout << "players: " << nplayers << "\n"
+	          << "games created: " << stats.games_created << " joined: " << stats.games_joined << "\n"
+	          << "messages received: " << stats.messages_received << " (" << (stats.messages_received/elapsed) << "/s)\n"
+	          << "bytes received: " << stats.bytes_received << " (" << (stats.bytes_received/elapsed) << "/s)\n"
+	          << "commands sent: " << stats.commands_sent << " (" << (stats.commands_sent/elapsed) << "/s)\n"
+	          << "command latency: p50 " << stats.command_latency.percentile(0.5) << "ms p99 " << stats.command_latency.percentile(0.99) << "ms (" << stats.command_latency.size() << " samples)\n"
+	          << "delivery latency: p50 " << stats.delivery_latency.percentile(0.5) << "ms p99 " << stats.delivery_latency.percentile(0.99) << "ms (" << stats.delivery_latency.size() << " samples)\n"
+	          << "errors: " << stats.errors << "\n";
+
+	return 0;
+}
@@ -0,0 +1,301 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <boost/scoped_ptr.hpp>
+
+#include "formatter.hpp"
+#include "logging.hpp"
+#include "thread.hpp"
+#include "unit_test.hpp"
+
+namespace logging {
+
+LEVEL current_level = LEVEL_INFO;
+
+namespace {
+int records_per_second = 200;
+
+struct record {
+	LEVEL level;
+	const char* file;
+	int line;
+	time_t time;
+	fields f;
+	std::string message;
+	int suppressed;
+};
+
+//the ring is a bounded multi-producer queue: each slot carries a sequence
+//number which tells producers whether it is free to claim and tells the
+//writer thread whether it has been filled. Producers claim a slot with a
+//compare-and-swap on enqueue_pos and never block; only the writer
+//thread advances dequeue_pos.
+const unsigned int RingSize = 4096; //must be a power of two.
+
+struct slot {
+	volatile unsigned int sequence;
+	record rec;
+};
+
+slot* ring = NULL;
+volatile unsigned int enqueue_pos = 0;
+unsigned int dequeue_pos = 0;
+
+volatile int ndropped = 0;
+volatile bool running = false;
+volatile bool exiting = false;
+
+threading::mutex* wake_mutex = NULL;
+threading::condition* wake_cond = NULL;
+boost::scoped_ptr<threading::thread> writer;
+
+bool push(record& r)
+{
+	unsigned int pos = enqueue_pos;
+	for(;;) {
+		slot& s = ring[pos&(RingSize-1)];
+		const int diff = static_cast<int>(s.sequence - pos);
+		if(diff == 0) {
+			if(__sync_bool_compare_and_swap(&enqueue_pos, pos, pos+1)) {
+				std::swap(s.rec, r);
+				__sync_synchronize();
+				s.sequence = pos + 1;
+				return true;
+			}
+
+			pos = enqueue_pos;
+		} else if(diff < 0) {
+			//the writer hasn't emptied this slot yet: the ring is full.
+			return false;
+		} else {
+			pos = enqueue_pos;
+		}
+	}
+}
+
+bool pop(record& r)
+{
+	slot& s = ring[dequeue_pos&(RingSize-1)];
+	if(static_cast<int>(s.sequence - (dequeue_pos + 1)) < 0) {
+		return false;
+	}
+
+	__sync_synchronize();
+	std::swap(r, s.rec);
+	__sync_synchronize();
+	s.sequence = dequeue_pos + RingSize;
+	++dequeue_pos;
+	return true;
+}
+
+const char* LevelNames[] = { "DEBUG", "INFO", "WARN", "ERROR", "NONE" };
+
+void format_record(const record& r, std::string& out)
+{
+	struct tm tm_buf;
+	char time_buf[32];
+	strftime(time_buf, sizeof(time_buf), "%Y-%m-%d %H:%M:%S", localtime_r(&r.time, &tm_buf));
+
+	const char* file = strrchr(r.file, '/');
+	file = file ? file + 1 : r.file;
+
+	out += time_buf;
+	out += " ";
+	out += LevelNames[r.level];
+	out += " ";
+	out += file;
+	out += ":";
+	out += formatter() << r.line;
+	r.f.write(out);
+	out += ": ";
+	out += r.message;
+	if(r.suppressed) {
+		out += formatter() << " (" << r.suppressed << " similar records suppressed)";
+	}
+	out += "\n";
+}
+
+void write_out(const std::string& out)
+{
+	fwrite(out.c_str(), 1, out.size(), stderr);
+	fflush(stderr);
+}
+
+void writer_thread()
+{
+	int reported_dropped = 0;
+	std::string out;
+	for(;;) {
+		//read the flag before draining, so the last pass picks up
+		//everything pushed before the manager started shutting down.
+		const bool finish = exiting;
+
+		record r;
+		while(pop(r)) {
+			format_record(r, out);
+		}
+
+		const int dropped = ndropped;
+		if(dropped != reported_dropped) {
+			out += formatter() << "LOG RING FULL: DROPPED " << (dropped - reported_dropped) << " RECORDS\n";
+			reported_dropped = dropped;
+		}
+
+		if(!out.empty()) {
+			write_out(out);
+			out.clear();
+		}
+
+		if(finish) {
+			return;
+		}
+
+		threading::lock lck(*wake_mutex);
+		if(!exiting) {
+			wake_cond->wait_timeout(*wake_mutex, 10);
+		}
+	}
+}
+}
+
+void set_level(LEVEL level)
+{
+	current_level = level;
+}
+
+bool set_level(const std::string& level)
+{
+	for(int n = LEVEL_DEBUG; n <= LEVEL_NONE; ++n) {
+		if(strcasecmp(level.c_str(), LevelNames[n]) == 0) {
+			set_level(static_cast<LEVEL>(n));
+			return true;
+		}
+	}
+
+	return false;
+}
+
+int rate_limit()
+{
+	return records_per_second;
+}
+
+void set_rate_limit(int n)
+{
+	records_per_second = n;
+}
+
+void fields::write(std::string& out) const
+{
+	if(game_ >= 0) {
+		out += formatter() << " game=" << game_;
+	}
+
+	if(player_ >= 0) {
+		out += formatter() << " player=" << player_;
+	}
+
+	if(!nick_.empty()) {
+		out += " nick=" + nick_;
+	}
+
+	if(!type_.empty()) {
+		out += " type=" + type_;
+	}
+}
+
+bool rate_limiter::allow()
+{
+	const time_t now = time(NULL);
+	if(now != second_) {
+		second_ = now;
+		count_ = 0;
+	}
+
+	if(__sync_add_and_fetch(&count_, 1) <= records_per_second) {
+		return true;
+	}
+
+	__sync_fetch_and_add(&suppressed_, 1);
+	return false;
+}
+
+int rate_limiter::take_suppressed()
+{
+	return __sync_fetch_and_and(&suppressed_, 0);
+}
+
+void write(LEVEL level, const char* file, int line, const fields& f, const std::string& msg, int suppressed)
+{
+	record r;
+	r.level = level;
+	r.file = file;
+	r.line = line;
+	r.time = time(NULL);
+	r.f = f;
+	r.message = msg;
+	r.suppressed = suppressed;
+
+	if(!running) {
+		std::string out;
+		format_record(r, out);
+		write_out(out);
+		return;
+	}
+
+	if(!push(r)) {
+		__sync_fetch_and_add(&ndropped, 1);
+	}
+}
+
+int dropped_records()
+{
+	return ndropped;
+}
+
+manager::manager()
+{
+	ring = new slot[RingSize];
+	for(unsigned int n = 0; n != RingSize; ++n) {
+		ring[n].sequence = n;
+	}
+
+	enqueue_pos = dequeue_pos = 0;
+	exiting = false;
+	wake_mutex = new threading::mutex;
+	wake_cond = new threading::condition;
+	writer.reset(new threading::thread(writer_thread));
+	running = true;
+}
+
+manager::~manager()
+{
+	running = false;
+	{
+		threading::lock lck(*wake_mutex);
+		exiting = true;
+	}
+
+	wake_cond->notify_one();
+	writer.reset();
+
+	delete wake_cond;
+	delete wake_mutex;
+	delete [] ring;
+	wake_cond = NULL;
+	wake_mutex = NULL;
+	ring = NULL;
+}
+
+}
+
+UNIT_TEST(log_macro_is_one_statement) {
+	//an else following a log statement belongs to the if before it.
+	bool took_else = false;
+	if(false)
+		LOG_DEBUG("not logged");
+	else
+		took_else = true;
+
+	CHECK(took_else, "the else was taken by the log macro");
+}
@@ -0,0 +1,110 @@
+#ifndef LOGGING_HPP_INCLUDED
+#define LOGGING_HPP_INCLUDED
+
+#include <time.h>
+
+#include <sstream>
+#include <string>
+
+//leveled logging which is cheap enough to leave in hot paths. Example usage:
+//LOG_INFO("player joined: " << nick);
+//LOG_DEBUG_FIELDS(logging::fields().game(id).nick(nick).type(name), "message: " << msg);
+//
+//The message is only formatted if its level is enabled. Levels below
+//LOG_MIN_LEVEL are compiled out altogether; the rest can be switched
+//on and off at runtime with logging::set_level().
+//
+//While a logging::manager is alive formatted records are pushed onto a
+//lock-free ring buffer and written out by a background thread, so the
+//caller never waits on stderr. If the buffer is full the record is
+//dropped and counted rather than blocking. Without a manager records
+//are written straight to stderr.
+//
+//Each call site is rate limited; once a site has logged
+//logging::rate_limit() records in a second, further records from it
+//are suppressed until the next second, and the number suppressed is
+//reported with the next record that gets through.
+namespace logging {
+
+enum LEVEL { LEVEL_DEBUG, LEVEL_INFO, LEVEL_WARN, LEVEL_ERROR, LEVEL_NONE };
+
+extern LEVEL current_level;
+
+inline bool enabled(LEVEL level) { return level >= current_level; }
+void set_level(LEVEL level);
+
+//parses "debug", "info", "warn", "error" or "none".
+bool set_level(const std::string& level);
+
+int rate_limit();
+void set_rate_limit(int records_per_second);
+
+//structured fields attached to a record, so log output can be filtered
+//by game, player or message type.
+class fields
+{
+public:
+	fields() : game_(-1), player_(-1)
+	{}
+
+	fields& game(int id) { game_ = id; return *this; }
+	fields& player(int nplayer) { player_ = nplayer; return *this; }
+	fields& nick(const std::string& nick) { nick_ = nick; return *this; }
+	fields& type(const std::string& type) { type_ = type; return *this; }
+
+	void write(std::string& out) const;
+private:
+	int game_, player_;
+	std::string nick_, type_;
+};
+
+class rate_limiter
+{
+public:
+	rate_limiter() : second_(0), count_(0), suppressed_(0)
+	{}
+
+	//approximate when several threads log from the same site at once,
+	//which only costs a little precision in the limit.
+	bool allow();
+	int take_suppressed();
+private:
+	volatile time_t second_;
+	volatile int count_, suppressed_;
+};
+
+void write(LEVEL level, const char* file, int line, const fields& f, const std::string& msg, int suppressed);
+
+//number of records thrown away because the ring buffer was full.
+int dropped_records();
+
+//starts the background writer. Records still queued when the manager
+//is destroyed are written out before it returns; it should outlive any
+//other threads that log.
+struct manager
+{
+	manager();
+	~manager();
+};
+
+}
+
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL logging::LEVEL_DEBUG
+#endif
+
+//wrapped in do/while so it's a single statement, and an else after it
+//can't be taken by the if inside.
+#define LOG_WITH_FIELDS(level, f, msg) do { if((level) >= LOG_MIN_LEVEL && logging::enabled(level)) { static logging::rate_limiter log_rate_limiter_; if(log_rate_limiter_.allow()) { std::ostringstream log_stream_; log_stream_ << msg; logging::write((level), __FILE__, __LINE__, (f), log_stream_.str(), log_rate_limiter_.take_suppressed()); } } } while(0)
+
+#define LOG_DEBUG_FIELDS(f, msg) LOG_WITH_FIELDS(logging::LEVEL_DEBUG, f, msg)
+#define LOG_INFO_FIELDS(f, msg) LOG_WITH_FIELDS(logging::LEVEL_INFO, f, msg)
+#define LOG_WARN_FIELDS(f, msg) LOG_WITH_FIELDS(logging::LEVEL_WARN, f, msg)
+#define LOG_ERROR_FIELDS(f, msg) LOG_WITH_FIELDS(logging::LEVEL_ERROR, f, msg)
+
+#define LOG_DEBUG(msg) LOG_DEBUG_FIELDS(logging::fields(), msg)
+#define LOG_INFO(msg) LOG_INFO_FIELDS(logging::fields(), msg)
+#define LOG_WARN(msg) LOG_WARN_FIELDS(logging::fields(), msg)
+#define LOG_ERROR(msg) LOG_ERROR_FIELDS(logging::fields(), msg)
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef LRU_CACHE_HPP_INCLUDED
+#define LRU_CACHE_HPP_INCLUDED
+
+#include <stddef.h>
+
+#include <list>
+#include <utility>
+
+#include <boost/functional/hash.hpp>
+#include <boost/unordered_map.hpp>
+
+//a hash map which holds at most a fixed number of entries. Making room
+//for a new entry drops the one used longest ago.
+template<typename Key, typename Value, typename Hash=boost::hash<Key> >
+class lru_cache
+{
+public:
+	explicit lru_cache(size_t capacity) : capacity_(capacity)
+	{}
+
+	//returns NULL if the key isn't in the cache. An entry which is found
+	//becomes the most recently used one. The pointer is good until the
+	//entry is dropped.
+	Value* get(const Key& k) {
+		typename map_type::iterator i = map_.find(k);
+		if(i == map_.end()) {
+			return NULL;
+		}
+
+		entries_.splice(entries_.begin(), entries_, i->second);
+		return &i->second->second;
+	}
+
+	Value& put(const Key& k, const Value& v) {
+		typename map_type::iterator i = map_.find(k);
+		if(i != map_.end()) {
+			entries_.splice(entries_.begin(), entries_, i->second);
+			i->second->second = v;
+			return i->second->second;
+		}
+
+		if(map_.size() >= capacity_ && !entries_.empty()) {
+			map_.erase(entries_.back().first);
+			entries_.pop_back();
+		}
+
+		entries_.push_front(std::make_pair(k, v));
+		map_[k] = entries_.begin();
+		return entries_.front().second;
+	}
+
+	size_t size() const { return map_.size(); }
+	size_t capacity() const { return capacity_; }
+
+	void clear() {
+		map_.clear();
+		entries_.clear();
+	}
+
+private:
+	//the most recently used entry is at the front.
+	typedef std::list<std::pair<Key, Value> > list_type;
+	typedef boost::unordered_map<Key, typename list_type::iterator, Hash> map_type;
+
+	size_t capacity_;
+	list_type entries_;
+	map_type map_;
+};
+
+#endif
@@ -0,0 +1,377 @@
+#include <algorithm>
+
+#include "foreach.hpp"
+#include "game.hpp"
+#include "hex_geometry.hpp"
+#include "map_layer.hpp"
+#include "preferences.hpp"
+#include "raster.hpp"
+#include "terrain.hpp"
+#include "texture.hpp"
+#include "tile.hpp"
+#include "unit_test.hpp"
+
+namespace {
+
+map_layer::image_placement get_texture_placement(const std::string& image)
+{
+	const graphics::texture t = graphics::texture::get(image);
+
+	map_layer::image_placement result;
+	result.texture = t;
+	result.u = t.translate_coord_x(0.0);
+	result.v = t.translate_coord_y(0.0);
+	result.scale_u = t.width() ? (t.translate_coord_x(1.0) - result.u)/t.width() : 0.0;
+	result.scale_v = t.height() ? (t.translate_coord_y(1.0) - result.v)/t.height() : 0.0;
+	return result;
+}
+
+//keeps the texture coordinates just inside the area, so that the edge of
+//the next image on the texture doesn't show.
+const GLfloat TileEpsilon = 0.01;
+
+}
+
+map_layer::map_layer()
+  : resolver_(get_texture_placement), width_(0), height_(0)
+{}
+
+map_layer::map_layer(image_resolver resolver)
+  : resolver_(resolver), width_(0), height_(0)
+{}
+
+int map_layer::update(const game& g)
+{
+	const int width = g.started() ? g.width() : 0;
+	const int height = g.started() ? g.height() : 0;
+	if(width != width_ || height != height_) {
+		width_ = width;
+		height_ = height;
+
+		//a terrain of NULL is never current, so every tile gets built.
+		const tile_state unbuilt = { NULL, -1 };
+		tiles_.assign(width*height, unbuilt);
+		slot_images_.assign(tiles_.size()*3, -1);
+		vertex_.assign(slot_images_.size()*VerticesPerQuad*2, 0);
+		uv_.assign(slot_images_.size()*VerticesPerQuad*2, 0.0);
+		ground_batches_.clear();
+		overlay_batches_.clear();
+	}
+
+	//the first player with the tower owns it, as in game::tower_owner().
+	tower_owners_.assign(tiles_.size(), -1);
+	for(int n = g.players().size() - 1; n >= 0; --n) {
+		for(std::map<hex::location, char>::const_iterator i = g.players()[n].towers.begin();
+		    i != g.players()[n].towers.end(); ++i) {
+			if(i->first.x() >= 0 && i->first.x() < width_ &&
+			   i->first.y() >= 0 && i->first.y() < height_) {
+				tower_owners_[i->first.y()*width_ + i->first.x()] = n;
+			}
+		}
+	}
+
+	int rebuilt = 0;
+	for(int y = 0; y != height_; ++y) {
+		for(int x = 0; x != width_; ++x) {
+			const int index = y*width_ + x;
+			const tile* t = g.get_tile(x, y);
+			const tile_state state = { t->terrain().get(), tower_owners_[index] };
+			if(state.terrain_type == tiles_[index].terrain_type &&
+			   state.tower_owner == tiles_[index].tower_owner) {
+				continue;
+			}
+
+			tiles_[index] = state;
+			++rebuilt;
+
+			rect tower_area;
+			switch(state.tower_owner) {
+			case 0: tower_area = rect(46, 7, 31, 20); break;
+			case 1: tower_area = rect(78, 7, 31, 20); break;
+			}
+
+			const hex::location loc(x, y);
+			set_slot(ground_slot(index), loc, t->texture(), t->texture_area());
+			set_slot(tower_slot(index), loc, "terrain/towers.png", tower_area);
+			set_slot(overlay_slot(index), loc, t->overlay_texture(), t->overlay_texture_area());
+		}
+	}
+
+	if(rebuilt) {
+		build_batches(0, tiles_.size()*2, ground_batches_);
+		build_batches(tiles_.size()*2, tiles_.size()*3, overlay_batches_);
+	}
+
+	return rebuilt;
+}
+
+void map_layer::get_ground_draws(const std::vector<hex::location>& highlighted, std::vector<draw_call>& calls) const
+{
+	std::vector<int> slots;
+	foreach(const hex::location& loc, highlighted) {
+		if(loc.x() >= 0 && loc.x() < width_ && loc.y() >= 0 && loc.y() < height_) {
+			slots.push_back(ground_slot(loc.y()*width_ + loc.x()));
+			slots.push_back(tower_slot(loc.y()*width_ + loc.x()));
+		}
+	}
+
+	get_draws(ground_batches_, slots, calls);
+}
+
+void map_layer::get_overlay_draws(const std::vector<hex::location>& highlighted, std::vector<draw_call>& calls) const
+{
+	std::vector<int> slots;
+	foreach(const hex::location& loc, highlighted) {
+		if(loc.x() >= 0 && loc.x() < width_ && loc.y() >= 0 && loc.y() < height_) {
+			slots.push_back(overlay_slot(loc.y()*width_ + loc.x()));
+		}
+	}
+
+	get_draws(overlay_batches_, slots, calls);
+}
+
+void map_layer::get_draws(const std::vector<batch>& batches, const std::vector<int>& highlighted_slots, std::vector<draw_call>& calls) const
+{
+	std::vector<int> slots(highlighted_slots);
+	std::sort(slots.begin(), slots.end());
+	slots.erase(std::unique(slots.begin(), slots.end()), slots.end());
+
+	calls.clear();
+	std::vector<int>::const_iterator highlight = slots.begin();
+	foreach(const batch& b, batches) {
+		//a batch is split after each highlighted quad in it, and the quad
+		//drawn again before the rest of the batch.
+		int begin = b.begin;
+		for(; highlight != slots.end() && (*highlight + 1)*VerticesPerQuad <= b.end; ++highlight) {
+			const int end = (*highlight + 1)*VerticesPerQuad;
+			if(slot_images_[*highlight] == -1 || end <= begin) {
+				continue;
+			}
+
+			const draw_call normal = { b.image, begin, end, false };
+			const draw_call highlighted = { slot_images_[*highlight], end - VerticesPerQuad, end, true };
+			calls.push_back(normal);
+			calls.push_back(highlighted);
+			begin = end;
+		}
+
+		if(begin != b.end) {
+			const draw_call normal = { b.image, begin, b.end, false };
+			calls.push_back(normal);
+		}
+	}
+}
+
+void map_layer::draw(const std::vector<draw_call>& calls, GLfloat highlight_alpha) const
+{
+	//anything queued was meant to be drawn before the map.
+	graphics::flush_blit_texture();
+
+	foreach(const draw_call& call, calls) {
+		if(call.highlight) {
+			glBlendFunc(GL_SRC_ALPHA, GL_ONE);
+			glColor4f(1.0, 1.0, 1.0, highlight_alpha);
+			draw_range(call.image, call.begin, call.end);
+			glColor4f(1.0, 1.0, 1.0, 1.0);
+			glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		} else {
+			draw_range(call.image, call.begin, call.end);
+		}
+	}
+}
+
+void map_layer::set_slot(int slot, const hex::location& loc, const std::string& image, const rect& area)
+{
+	GLshort* v = &vertex_[slot*VerticesPerQuad*2];
+	GLfloat* uv = &uv_[slot*VerticesPerQuad*2];
+
+	//an empty quad has all its corners in one place, so drawing it as
+	//part of a batch draws nothing.
+	if(image.empty() || area.w() == 0) {
+		slot_images_[slot] = -1;
+		std::fill(v, v + VerticesPerQuad*2, 0);
+		std::fill(uv, uv + VerticesPerQuad*2, 0.0);
+		return;
+	}
+
+	const int index = image_index(image);
+	slot_images_[slot] = index;
+
+	const GLshort x1 = (tile_pixel_x(loc) + HexWidth/2 - area.w())&preferences::xypos_draw_mask;
+	const GLshort y1 = (tile_pixel_y(loc) + HexHeight - area.h()*2)&preferences::xypos_draw_mask;
+	const GLshort x2 = x1 + area.w()*2;
+	const GLshort y2 = y1 + area.h()*2;
+
+	const image_placement& p = images_[index];
+	const GLfloat u1 = p.u + area.x()*p.scale_u;
+	const GLfloat u2 = p.u + (area.x() + area.w() - TileEpsilon)*p.scale_u;
+	const GLfloat v1 = p.v + area.y()*p.scale_v;
+	const GLfloat v2 = p.v + (area.y() + area.h() - TileEpsilon)*p.scale_v;
+
+	//two triangles, with the corners in the order blit_texture() draws
+	//them as a strip.
+	const GLshort vx[] = { x1, x2, x1, x2, x1, x2 };
+	const GLshort vy[] = { y1, y1, y2, y1, y2, y2 };
+	const GLfloat tu[] = { u1, u2, u1, u2, u1, u2 };
+	const GLfloat tv[] = { v1, v1, v2, v1, v2, v2 };
+	for(int n = 0; n != VerticesPerQuad; ++n) {
+		*v++ = vx[n];
+		*v++ = vy[n];
+		*uv++ = tu[n];
+		*uv++ = tv[n];
+	}
+}
+
+void map_layer::build_batches(int begin_slot, int end_slot, std::vector<batch>& batches) const
+{
+	batches.clear();
+	for(int slot = begin_slot; slot != end_slot; ++slot) {
+		if(slot_images_[slot] == -1) {
+			continue;
+		}
+
+		//empty quads between two that share a texture are left in the
+		//batch, since they draw nothing.
+		const int image = slot_images_[slot];
+		if(batches.empty() || images_[batches.back().image].get_id() != images_[image].get_id()) {
+			const batch b = { image, slot*VerticesPerQuad, 0 };
+			batches.push_back(b);
+		}
+
+		batches.back().end = (slot + 1)*VerticesPerQuad;
+	}
+}
+
+void map_layer::draw_range(int image, int begin, int end) const
+{
+	graphics::texture::set_current_texture(images_[image].get_id());
+	glVertexPointer(2, GL_SHORT, 0, &vertex_[begin*2]);
+	glTexCoordPointer(2, GL_FLOAT, 0, &uv_[begin*2]);
+	glDrawArrays(GL_TRIANGLES, 0, end - begin);
+}
+
+int map_layer::image_index(const std::string& image)
+{
+	//a map only uses a few images, so this is short.
+	for(int n = 0; n != image_names_.size(); ++n) {
+		if(image_names_[n] == image) {
+			return n;
+		}
+	}
+
+	image_names_.push_back(image);
+	images_.push_back(resolver_(image));
+	return images_.size() - 1;
+}
+
+namespace {
+
+//puts each image on a texture of its own, without any graphics.
+map_layer::image_placement headless_placement(const std::string& image)
+{
+	static std::vector<std::string> images;
+	const int index = std::find(images.begin(), images.end(), image) - images.begin();
+	if(index == images.size()) {
+		images.push_back(image);
+	}
+
+	map_layer::image_placement result;
+	result.id = index + 1;
+	result.scale_u = result.scale_v = 1.0/512;
+	return result;
+}
+
+//puts every image on the same texture, as the texture atlas does.
+map_layer::image_placement headless_atlas_placement(const std::string& image)
+{
+	map_layer::image_placement result;
+	result.id = 1;
+	result.scale_u = result.scale_v = 1.0/1024;
+	return result;
+}
+
+boost::intrusive_ptr<game> create_test_game()
+{
+	boost::intrusive_ptr<game> g(new game);
+	const game_context context(g.get());
+	const player_info info;
+	g->add_player("a", info);
+	g->add_player("b", info);
+	g->handle_message(0, TiXmlElement("setup"));
+	return g;
+}
+
+}
+
+UNIT_TEST(map_layer) {
+	boost::intrusive_ptr<game> g = create_test_game();
+	const game_context context(g.get());
+
+	map_layer layer(headless_atlas_placement);
+	CHECK_EQ(layer.update(*g), g->width()*g->height());
+	CHECK_EQ(layer.num_vertices(), g->width()*g->height()*3*6);
+
+	//with everything on one texture, the ground and the overlays are a
+	//draw each.
+	CHECK_LE(layer.num_batches(), 2);
+
+	CHECK_EQ(layer.update(*g), 0);
+
+	std::vector<map_layer::draw_call> calls;
+	layer.get_ground_draws(std::vector<hex::location>(), calls);
+	CHECK_EQ(calls.size(), 1);
+
+	//a highlighted tile is drawn again straight after its terrain, before
+	//the tiles after it, which may cover it.
+	const int terrain_end = (1*g->width() + 1)*2*6 + 6;
+	layer.get_ground_draws(std::vector<hex::location>(1, hex::location(1, 1)), calls);
+	CHECK_GE(calls.size(), 3);
+	CHECK(!calls[0].highlight, "the ground before the tile is highlighted");
+	CHECK_EQ(calls[0].begin, 0);
+	CHECK_EQ(calls[0].end, terrain_end);
+	CHECK(calls[1].highlight, "the tile isn't highlighted");
+	CHECK_EQ(calls[1].begin, terrain_end - 6);
+	CHECK_EQ(calls[1].end, terrain_end);
+	CHECK(!calls[2].highlight, "the tower is highlighted before it's drawn");
+	CHECK_EQ(calls[2].begin, terrain_end);
+	CHECK(!calls.back().highlight, "the ground after the tile is missing");
+
+	tile* t = g->get_tile(1, 1);
+	t->set_terrain(t->terrain()->id() == "sea" ? "grassland" : "sea");
+	CHECK_EQ(layer.update(*g), 1);
+	CHECK_EQ(layer.update(*g), 0);
+
+	//a new copy of the same board doesn't need anything rebuilt.
+	boost::intrusive_ptr<game> copy(new game(g->write()));
+	CHECK_EQ(layer.update(*copy), 0);
+
+	map_layer separate(headless_placement);
+	separate.update(*g);
+	CHECK_GE(separate.num_batches(), layer.num_batches());
+}
+
+BENCHMARK(map_layer_build)
+{
+	boost::intrusive_ptr<game> g = create_test_game();
+	const game_context context(g.get());
+
+	test::set_benchmark_items(g->width()*g->height(), "tiles");
+	BENCHMARK_LOOP {
+		map_layer layer(headless_placement);
+		layer.update(*g);
+	}
+}
+
+//the cost of each frame when nothing on the board has changed.
+BENCHMARK(map_layer_update)
+{
+	boost::intrusive_ptr<game> g = create_test_game();
+	const game_context context(g.get());
+
+	map_layer layer(headless_placement);
+	layer.update(*g);
+	test::set_benchmark_items(g->width()*g->height(), "tiles");
+	BENCHMARK_LOOP {
+		layer.update(*g);
+	}
+}
@@ -0,0 +1,123 @@
+#ifndef MAP_LAYER_HPP_INCLUDED
+#define MAP_LAYER_HPP_INCLUDED
+
+#include <string>
+#include <vector>
+
+#include <boost/function.hpp>
+
+#include <GL/gl.h>
+
+#include "geometry.hpp"
+#include "texture.hpp"
+#include "tile_logic.hpp"
+
+class game;
+class terrain;
+
+//the terrain, tower flags and terrain overlays of the map, kept between
+//frames as vertex and texture coordinate arrays which are drawn with a
+//handful of calls. Each tile has a fixed place in the arrays, so when the
+//board changes only the tiles which changed are rebuilt.
+class map_layer
+{
+public:
+	//where an image is on the texture it's part of: the texture
+	//coordinates of pixel (x, y) are (u + x*scale_u, v + y*scale_v).
+	struct image_placement {
+		image_placement() : id(0), u(0.0), v(0.0), scale_u(0.0), scale_v(0.0)
+		{}
+
+		//the texture is held rather than its GL id, since the id changes
+		//when the video mode is set, and may be reused once the texture
+		//is freed.
+		GLuint get_id() const { return texture.valid() ? texture.get_id() : id; }
+
+		graphics::texture texture;
+
+		//the id to draw with when there is no texture, such as when the
+		//geometry is built without graphics.
+		GLuint id;
+		GLfloat u, v, scale_u, scale_v;
+	};
+
+	typedef boost::function<image_placement(const std::string&)> image_resolver;
+
+	//looks images up with texture::get().
+	map_layer();
+
+	//for building the geometry without any graphics, to measure it.
+	explicit map_layer(image_resolver resolver);
+
+	//brings the arrays into line with the game, returning the number of
+	//tiles that had to be rebuilt.
+	int update(const game& g);
+
+	//a run of vertices drawn with one call, either normally or again over
+	//what's already drawn with additive blending to highlight it.
+	struct draw_call {
+		int image;
+		int begin, end;
+		bool highlight;
+	};
+
+	//the calls to draw the terrain and towers of every tile, or the
+	//overlays of every tile. Each highlighted tile is drawn again straight
+	//after its own quads, so tiles drawn later still cover it, as they
+	//would if every tile were drawn on its own.
+	void get_ground_draws(const std::vector<hex::location>& highlighted, std::vector<draw_call>& calls) const;
+	void get_overlay_draws(const std::vector<hex::location>& highlighted, std::vector<draw_call>& calls) const;
+
+	void draw(const std::vector<draw_call>& calls, GLfloat highlight_alpha) const;
+
+	int num_vertices() const { return vertex_.size()/2; }
+	int num_batches() const { return ground_batches_.size() + overlay_batches_.size(); }
+
+private:
+	//each tile has two quads in the ground part of the arrays, for the
+	//terrain and tower flag, followed by one in the overlay part.
+	enum { VerticesPerQuad = 6 };
+
+	int ground_slot(int index) const { return index*2; }
+	int tower_slot(int index) const { return index*2 + 1; }
+	int overlay_slot(int index) const { return tiles_.size()*2 + index; }
+
+	//runs of vertices which use the same texture, in drawing order. The
+	//image is that of the first quad in the run.
+	struct batch {
+		int image;
+		int begin, end;
+	};
+
+	void set_slot(int slot, const hex::location& loc, const std::string& image, const rect& area);
+	void get_draws(const std::vector<batch>& batches, const std::vector<int>& highlighted_slots, std::vector<draw_call>& calls) const;
+	void draw_range(int image, int begin, int end) const;
+
+	int image_index(const std::string& image);
+
+	image_resolver resolver_;
+	std::vector<std::string> image_names_;
+	std::vector<image_placement> images_;
+
+	struct tile_state {
+		const terrain* terrain_type;
+		int tower_owner;
+	};
+
+	int width_, height_;
+	std::vector<tile_state> tiles_;
+
+	//the image index each quad is drawn with, or -1 if it's empty.
+	std::vector<int> slot_images_;
+	std::vector<GLshort> vertex_;
+	std::vector<GLfloat> uv_;
+
+	std::vector<batch> ground_batches_, overlay_batches_;
+	void build_batches(int begin_slot, int end_slot, std::vector<batch>& batches) const;
+
+	//who owns the tower on each tile, worked out once per update rather
+	//than asking the game about every tile.
+	std::vector<int> tower_owners_;
+};
+
+#endif
@@ -0,0 +1,75 @@
+#include <utility>
+
+#include "matchmaking_queue.hpp"
+#include "unit_test.hpp"
+
+void matchmaking_queue::add(int game_id, const std::string& pool, int seats)
+{
+	if(seats == 0 || index_.count(game_id)) {
+		return;
+	}
+
+	entry e;
+	e.game_id = game_id;
+	e.seats = seats;
+
+	position pos;
+	pos.pool = pools_.insert(std::make_pair(pool, entry_list())).first;
+	pos.entry = pos.pool->second.insert(pos.pool->second.end(), e);
+	index_[game_id] = pos;
+}
+
+void matchmaking_queue::remove(int game_id)
+{
+	std::map<int, position>::iterator i = index_.find(game_id);
+	if(i == index_.end()) {
+		return;
+	}
+
+	entry_list& pool = i->second.pool->second;
+	pool.erase(i->second.entry);
+	if(pool.empty()) {
+		pools_.erase(i->second.pool);
+	}
+
+	index_.erase(i);
+}
+
+int matchmaking_queue::take_seat(const std::string& pool)
+{
+	pool_map::iterator p = pools_.find(pool);
+	if(p == pools_.end()) {
+		return -1;
+	}
+
+	entry& e = p->second.front();
+	const int game_id = e.game_id;
+	if(e.seats > 0 && --e.seats == 0) {
+		remove(game_id);
+	}
+
+	return game_id;
+}
+
+UNIT_TEST(matchmaking_queue) {
+	matchmaking_queue queue;
+	queue.add(1, "", 1);
+	queue.add(2, "", -1);
+	queue.add(3, "ranked", 2);
+	queue.add(4, "", 0);
+	CHECK_EQ(queue.size(), 3);
+
+	//games fill in the order they were added, and only from their pool.
+	CHECK_EQ(queue.take_seat(""), 1);
+	CHECK_EQ(queue.take_seat(""), 2);
+	CHECK_EQ(queue.take_seat(""), 2);
+	CHECK_EQ(queue.take_seat("ranked"), 3);
+	CHECK_EQ(queue.take_seat("ranked"), 3);
+	CHECK_EQ(queue.take_seat("ranked"), -1);
+	CHECK_EQ(queue.take_seat("casual"), -1);
+
+	queue.remove(2);
+	queue.remove(2);
+	CHECK_EQ(queue.take_seat(""), -1);
+	CHECK_EQ(queue.size(), 0);
+}
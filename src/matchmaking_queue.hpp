@@ -0,0 +1,50 @@
+#ifndef MATCHMAKING_QUEUE_HPP_INCLUDED
+#define MATCHMAKING_QUEUE_HPP_INCLUDED
+
+#include <list>
+#include <map>
+#include <string>
+
+//the games which players can still join, by id. Games are kept in pools,
+//which let players be matched only with games of the kind they asked
+//for, and within a pool the game which has been waiting longest is
+//filled first. Everything is constant time apart from looking up ids
+//and pool names, however many games are waiting.
+class matchmaking_queue
+{
+public:
+	//adds a game with room for seats more players, or for any number if
+	//seats is negative. A game with no seats is never added.
+	void add(int game_id, const std::string& pool, int seats);
+
+	//takes a game out of the queue, such as when it starts. Does
+	//nothing if the game isn't in it.
+	void remove(int game_id);
+
+	//takes a seat in the oldest game in the pool, returning its id, or
+	//-1 if the pool has no games. A game leaves the queue once its last
+	//seat is taken.
+	int take_seat(const std::string& pool);
+
+	size_t size() const { return index_.size(); }
+private:
+	struct entry {
+		int game_id;
+		int seats;
+	};
+
+	typedef std::list<entry> entry_list;
+	typedef std::map<std::string, entry_list> pool_map;
+
+	struct position {
+		pool_map::iterator pool;
+		entry_list::iterator entry;
+	};
+
+	//pools are removed once they're empty, so players can't use up
+	//memory by asking for pools which don't exist.
+	pool_map pools_;
+	std::map<int, position> index_;
+};
+
+#endif
@@ -0,0 +1,369 @@
+#include <string.h>
+#include <time.h>
+
+#include <algorithm>
+#include <vector>
+
+#include <boost/bind.hpp>
+
+#include "formatter.hpp"
+#include "metrics.hpp"
+#include "thread.hpp"
+#include "unit_test.hpp"
+
+namespace metrics {
+
+namespace {
+
+//upper bounds of the histogram buckets in microseconds, with the same
+//bounds in seconds for output. Anything above the last bound goes into
+//an overflow bucket.
+const int64_t BucketBounds[] = { 10, 25, 50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000, 1000000, 2500000, 5000000, 10000000 };
+const char* BucketLabels[] = { "0.00001", "0.000025", "0.00005", "0.0001", "0.00025", "0.0005", "0.001", "0.0025", "0.005", "0.01", "0.025", "0.05", "0.1", "0.25", "0.5", "1", "2.5", "5", "10" };
+const int NumBounds = sizeof(BucketBounds)/sizeof(*BucketBounds);
+
+//a histogram takes a slot for each bucket, one for the overflow bucket
+//and one for the sum of everything recorded.
+const int HistogramSlots = NumBounds + 2;
+
+//slot 0 is never reported; metrics registered once all the slots are
+//taken write to it.
+const int MaxSlots = 4096;
+
+const int MaxFamilyMembers = 64;
+
+struct metric_info {
+	std::string name, label_name, label_value, help;
+	bool is_histogram;
+	int index;
+};
+
+bool operator<(const metric_info& a, const metric_info& b)
+{
+	return a.name < b.name;
+}
+
+struct thread_block {
+	int64_t values[MaxSlots];
+	thread_block* next;
+};
+
+//blocks are kept for the life of the process, so counts made by threads
+//which have since exited are not lost.
+thread_block* blocks = NULL;
+__thread thread_block* local_block = NULL;
+
+int nslots = 1;
+
+threading::mutex& get_mutex()
+{
+	static threading::mutex* m = new threading::mutex;
+	return *m;
+}
+
+//guards the members of histogram families. It is separate from the
+//registry mutex since creating a member registers a new histogram.
+threading::mutex& get_family_mutex()
+{
+	static threading::mutex* m = new threading::mutex;
+	return *m;
+}
+
+std::vector<metric_info>& get_registry()
+{
+	static std::vector<metric_info> registry;
+	return registry;
+}
+
+int register_metric(const std::string& name, const std::string& label_name, const std::string& label_value, const std::string& help, bool is_histogram)
+{
+	threading::lock lck(get_mutex());
+	const int size = is_histogram ? HistogramSlots : 1;
+	if(nslots + size > MaxSlots) {
+		return 0;
+	}
+
+	metric_info info;
+	info.name = name;
+	info.label_name = label_name;
+	info.label_value = label_value;
+	info.help = help;
+	info.is_histogram = is_histogram;
+	info.index = nslots;
+	get_registry().push_back(info);
+
+	nslots += size;
+	return info.index;
+}
+
+thread_block* create_local_block()
+{
+	thread_block* block = new thread_block;
+	memset(block->values, 0, sizeof(block->values));
+
+	threading::lock lck(get_mutex());
+	block->next = blocks;
+	blocks = block;
+	return block;
+}
+
+int64_t* local_values()
+{
+	if(!local_block) {
+		local_block = create_local_block();
+	}
+
+	return local_block->values;
+}
+
+int64_t sum_slot(int index)
+{
+	threading::lock lck(get_mutex());
+	int64_t result = 0;
+	for(const thread_block* block = blocks; block != NULL; block = block->next) {
+		result += block->values[index];
+	}
+
+	return result;
+}
+
+void write_escaped(std::string& out, const std::string& s)
+{
+	for(std::string::const_iterator i = s.begin(); i != s.end(); ++i) {
+		if(*i == '\\' || *i == '"') {
+			out += '\\';
+			out += *i;
+		} else if(*i == '\n') {
+			out += "\\n";
+		} else {
+			out += *i;
+		}
+	}
+}
+
+void write_labels(std::string& out, const metric_info& info, const char* le=NULL)
+{
+	if(info.label_name.empty() && !le) {
+		return;
+	}
+
+	out += "{";
+	if(!info.label_name.empty()) {
+		out += info.label_name + "=\"";
+		write_escaped(out, info.label_value);
+		out += "\"";
+		if(le) {
+			out += ",";
+		}
+	}
+
+	if(le) {
+		out += "le=\"";
+		out += le;
+		out += "\"";
+	}
+
+	out += "}";
+}
+
+void write_header(std::string& out, const std::string& name, const std::string& help, const char* type)
+{
+	out += "# HELP " + name + " " + help + "\n";
+	out += "# TYPE " + name + " " + type + "\n";
+}
+
+}
+
+int64_t get_time_micros()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return int64_t(ts.tv_sec)*1000000 + ts.tv_nsec/1000;
+}
+
+counter::counter(const std::string& name, const std::string& help)
+  : index_(register_metric(name, "", "", help, false))
+{}
+
+counter::counter(const std::string& name, const std::string& label_name, const std::string& label_value, const std::string& help)
+  : index_(register_metric(name, label_name, label_value, help, false))
+{}
+
+void counter::add(int64_t n)
+{
+	local_values()[index_] += n;
+}
+
+int64_t counter::value() const
+{
+	return sum_slot(index_);
+}
+
+histogram::histogram(const std::string& name, const std::string& help)
+  : index_(register_metric(name, "", "", help, true))
+{}
+
+histogram::histogram(const std::string& name, const std::string& label_name, const std::string& label_value, const std::string& help)
+  : index_(register_metric(name, label_name, label_value, help, true))
+{}
+
+void histogram::record(int64_t micros)
+{
+	if(index_ == 0) {
+		return;
+	}
+
+	const int bucket = std::lower_bound(BucketBounds, BucketBounds + NumBounds, micros) - BucketBounds;
+	int64_t* values = local_values() + index_;
+	++values[bucket];
+	values[NumBounds+1] += micros;
+}
+
+int64_t histogram::count() const
+{
+	int64_t result = 0;
+	for(int n = 0; n <= NumBounds; ++n) {
+		result += sum_slot(index_ + n);
+	}
+
+	return result;
+}
+
+histogram_family::histogram_family(const std::string& name, const std::string& label_name, const std::string& help)
+  : name_(name), label_name_(label_name), help_(help)
+{}
+
+histogram_family::~histogram_family()
+{
+	for(std::map<std::string, histogram*>::iterator i = members_.begin(); i != members_.end(); ++i) {
+		delete i->second;
+	}
+}
+
+histogram& histogram_family::get(const std::string& label_value)
+{
+	threading::lock lck(get_family_mutex());
+	histogram*& h = members_[label_value];
+	if(!h) {
+		if(members_.size() > MaxFamilyMembers && label_value != "other") {
+			members_.erase(label_value);
+			histogram*& other = members_["other"];
+			if(!other) {
+				other = new histogram(name_, label_name_, "other", help_);
+			}
+
+			return *other;
+		}
+
+		h = new histogram(name_, label_name_, label_value, help_);
+	}
+
+	return *h;
+}
+
+void write_stats(std::string& out)
+{
+	std::vector<metric_info> registry;
+	std::vector<int64_t> totals;
+	{
+		threading::lock lck(get_mutex());
+		registry = get_registry();
+		totals.resize(nslots);
+		for(const thread_block* block = blocks; block != NULL; block = block->next) {
+			for(int n = 0; n != nslots; ++n) {
+				totals[n] += block->values[n];
+			}
+		}
+	}
+
+	//group the members of a family together so they share a header.
+	std::stable_sort(registry.begin(), registry.end());
+
+	for(int n = 0; n != registry.size(); ++n) {
+		const metric_info& info = registry[n];
+		const bool first_of_name = n == 0 || registry[n-1].name != info.name;
+		if(!info.is_histogram) {
+			if(first_of_name) {
+				write_header(out, info.name, info.help, "counter");
+			}
+
+			out += info.name;
+			write_labels(out, info);
+			out += formatter() << " " << totals[info.index] << "\n";
+			continue;
+		}
+
+		if(first_of_name) {
+			write_header(out, info.name, info.help, "histogram");
+		}
+
+		int64_t cumulative = 0;
+		for(int bucket = 0; bucket <= NumBounds; ++bucket) {
+			cumulative += totals[info.index + bucket];
+			out += info.name + "_bucket";
+			write_labels(out, info, bucket == NumBounds ? "+Inf" : BucketLabels[bucket]);
+			out += formatter() << " " << cumulative << "\n";
+		}
+
+		out += info.name + "_sum";
+		write_labels(out, info);
+		out += formatter() << " " << (totals[info.index + NumBounds + 1]/1000000.0) << "\n";
+
+		out += info.name + "_count";
+		write_labels(out, info);
+		out += formatter() << " " << cumulative << "\n";
+	}
+}
+
+void write_gauge_header(std::string& out, const std::string& name, const std::string& help)
+{
+	write_header(out, name, help, "gauge");
+}
+
+void write_gauge(std::string& out, const std::string& name, int64_t value)
+{
+	out += formatter() << name << " " << value << "\n";
+}
+
+void write_gauge(std::string& out, const std::string& name, const std::string& label_name, const std::string& label_value, int64_t value)
+{
+	out += name + "{" + label_name + "=\"";
+	write_escaped(out, label_value);
+	out += formatter() << "\"} " << value << "\n";
+}
+
+}
+
+namespace {
+void add_to_counter(metrics::counter* c, int n)
+{
+	for(int i = 0; i != n; ++i) {
+		c->add();
+	}
+}
+}
+
+UNIT_TEST(metrics_aggregate_threads) {
+	metrics::counter c("test_counter_total", "Counter used by unit tests.");
+	{
+		threading::thread t1(boost::bind(add_to_counter, &c, 1000));
+		threading::thread t2(boost::bind(add_to_counter, &c, 500));
+		add_to_counter(&c, 10);
+	}
+
+	CHECK_EQ(c.value(), 1510);
+
+	metrics::histogram_family family("test_latency_seconds", "type", "Histogram used by unit tests.");
+	family.get("a").record(5);
+	family.get("a").record(20000000);
+	family.get("b").record(1000);
+	CHECK_EQ(family.get("a").count(), 2);
+	CHECK_EQ(family.get("b").count(), 1);
+
+	std::string stats;
+	metrics::write_stats(stats);
+	CHECK(stats.find("test_counter_total 1510\n") != std::string::npos, stats);
+	CHECK(stats.find("test_latency_seconds_bucket{type=\"a\",le=\"0.00001\"} 1\n") != std::string::npos, stats);
+	CHECK(stats.find("test_latency_seconds_bucket{type=\"a\",le=\"+Inf\"} 2\n") != std::string::npos, stats);
+	CHECK(stats.find("test_latency_seconds_count{type=\"b\"} 1\n") != std::string::npos, stats);
+}
@@ -0,0 +1,104 @@
+#ifndef METRICS_HPP_INCLUDED
+#define METRICS_HPP_INCLUDED
+
+#include <stdint.h>
+
+#include <map>
+#include <string>
+
+//counters and latency histograms which are cheap enough to leave on in
+//production. Example usage:
+//
+//namespace {
+//metrics::counter bytes_sent("wizard_bytes_sent_total", "Bytes written to clients.");
+//metrics::histogram_family message_time("wizard_handle_message_seconds", "type", "Time spent handling a message.");
+//}
+//
+//bytes_sent.add(nbytes);
+//const metrics::timer t(message_time.get(name));
+//
+//Every thread which updates a metric gets its own block of values, so an
+//update is a plain add with no locking or atomic operations. The blocks
+//are only summed when the metrics are read with write_stats(). On
+//platforms without atomic 64-bit loads a reading thread may see a value
+//which is slightly off, which is fine for monitoring.
+namespace metrics {
+
+int64_t get_time_micros();
+
+class counter
+{
+public:
+	counter(const std::string& name, const std::string& help);
+	counter(const std::string& name, const std::string& label_name, const std::string& label_value, const std::string& help);
+
+	void add(int64_t n=1);
+
+	//the total across all threads.
+	int64_t value() const;
+private:
+	int index_;
+};
+
+//records durations, in microseconds, into a fixed set of buckets which
+//run from 10us to 10s.
+class histogram
+{
+public:
+	histogram(const std::string& name, const std::string& help);
+	histogram(const std::string& name, const std::string& label_name, const std::string& label_value, const std::string& help);
+
+	void record(int64_t micros);
+
+	int64_t count() const;
+private:
+	int index_;
+};
+
+//a set of histograms sharing a name, told apart by the value of a single
+//label, e.g. the type of message handled. Members are created the first
+//time a label value is seen; there is a limit on how many a family may
+//have, past which values are all recorded under "other".
+class histogram_family
+{
+public:
+	histogram_family(const std::string& name, const std::string& label_name, const std::string& help);
+	~histogram_family();
+
+	histogram& get(const std::string& label_value);
+private:
+	histogram_family(const histogram_family&);
+	void operator=(const histogram_family&);
+
+	std::string name_, label_name_, help_;
+	std::map<std::string, histogram*> members_;
+};
+
+//records the time from its construction to its destruction.
+class timer
+{
+public:
+	explicit timer(histogram& h) : histogram_(h), start_(get_time_micros())
+	{}
+
+	~timer() { histogram_.record(get_time_micros() - start_); }
+private:
+	timer(const timer&);
+	void operator=(const timer&);
+
+	histogram& histogram_;
+	int64_t start_;
+};
+
+//writes every metric in the Prometheus text format.
+void write_stats(std::string& out);
+
+//helpers for writing values which are sampled at read time, such as
+//queue depths, in the same format.
+void write_gauge_header(std::string& out, const std::string& name, const std::string& help);
+void write_gauge(std::string& out, const std::string& name, int64_t value);
+void write_gauge(std::string& out, const std::string& name, const std::string& label_name, const std::string& label_value, int64_t value);
+
+}
+
+#endif
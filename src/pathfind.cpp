@@ -4,6 +4,7 @@
 #include <set>
 
 #include "boost/shared_ptr.hpp"
+#include "metrics.hpp"
 #include "pathfind.hpp"
 
 #include "SDL.h"
@@ -57,9 +58,16 @@ struct partial_result_comparer : public std::binary_function<const_partial_resul
 
 }
 
+namespace {
+metrics::histogram find_path_time("wizard_find_path_seconds", "Time spent in find_path.");
+metrics::histogram find_possible_moves_time("wizard_find_possible_moves_seconds", "Time spent in find_possible_moves.");
+}
+
 int find_path(const location& src, const location& dst, const path_cost_calculator& calc, 
               std::vector<location>* result, int max_cost, bool adjacent_only, bool find_partial_result)
 {
+	const metrics::timer timer(find_path_time);
+
 	//sanity check to make sure the destination is reachable from
 	//an adjacent hex
 	if(!adjacent_only) {
@@ -198,6 +206,8 @@ void find_possible_moves_internal(int max_cost, const path_cost_calculator& calc
 
 void find_possible_moves(const hex::location& loc, int max_cost, const path_cost_calculator& calc, route_map& routes)
 {
+	const metrics::timer timer(find_possible_moves_time);
+
 	max_cost *= 10;
 
 	route& r = routes[loc];
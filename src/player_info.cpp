@@ -2,10 +2,13 @@
 #include <string.h>
 
 #include "card.hpp"
+#include "document_cache.hpp"
 #include "filesystem.hpp"
+#include "foreach.hpp"
 #include "formatter.hpp"
 #include "player_info.hpp"
 #include "string_utils.hpp"
+#include "unit_test.hpp"
 #include "wml_node.hpp"
 #include "wml_utils.hpp"
 #include "xml_parser.hpp"
@@ -16,7 +19,7 @@ bool is_dummy_card(const std::string& card) {
 
 player_info::player_info()
 {
-	read(wml::parse_xml(sys::read_file("deck.xml")));
+	read(document_cache::get_xml("deck.xml"));
 	collection_ = card::get_all_cards();
 	collection_.erase(std::remove_if(collection_.begin(), collection_.end(), is_dummy_card), collection_.end());
 }
@@ -43,10 +46,29 @@ bool player_info::add_to_deck(const std::string& id)
 
 bool player_info::remove_from_deck(const std::string& id)
 {
-	deck_.erase(std::remove(deck_.begin(), deck_.end(), id), deck_.end());
+	const std::vector<std::string>::iterator i = std::remove(deck_.begin(), deck_.end(), id);
+	if(i == deck_.end()) {
+		return false;
+	}
+
+	deck_.erase(i, deck_.end());
 	return true;
 }
 
+bool player_info::modify_deck(const std::string& remove, const std::string& add)
+{
+	const std::vector<std::string> old_deck = deck_;
+	foreach(const std::string& s, util::split(remove, ',')) {
+		remove_from_deck(s);
+	}
+
+	foreach(const std::string& s, util::split(add, ',')) {
+		add_to_deck(s);
+	}
+
+	return deck_ != old_deck;
+}
+
 bool player_info::modify_resources(char resource, int delta)
 {
 	const int index = resource::resource_index(resource);
@@ -89,3 +111,17 @@ wml::node_ptr player_info::write() const
 
 	return node;
 }
+
+UNIT_TEST(player_info_modify_deck) {
+	player_info info;
+	CHECK(info.deck().empty() == false, "the default deck is empty");
+	const std::string card = info.deck().front();
+
+	//adding a card already in the deck, or removing one which isn't,
+	//leaves it as it was.
+	CHECK(!info.modify_deck("", card), "adding a card twice changed the deck");
+	CHECK(!info.modify_deck("no_such_card", ""), "removing a missing card changed the deck");
+
+	CHECK(info.modify_deck(card, ""), "removing a card didn't change the deck");
+	CHECK(info.modify_deck("", card), "adding a card back didn't change the deck");
+}
@@ -21,10 +21,15 @@ public:
 	const std::vector<int>& resources() const { return resources_; }
 	const std::vector<std::string>& deck() const { return deck_; }
 	const std::vector<std::string>& collection() const { return collection_; }
+	void set_collection(const std::vector<std::string>& v) { collection_ = v; }
 
 	bool add_to_deck(const std::string& id);
 	bool remove_from_deck(const std::string& id);
 
+	//takes comma-separated lists of spells to remove and then add.
+	//Returns whether the deck changed.
+	bool modify_deck(const std::string& remove, const std::string& add);
+
 	bool modify_resources(char resource, int delta);
 
 	void read(wml::const_node_ptr node);
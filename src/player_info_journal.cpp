@@ -0,0 +1,338 @@
+#include <stdio.h>
+#include <unistd.h>
+
+#include <boost/bind.hpp>
+
+#include "filesystem.hpp"
+#include "foreach.hpp"
+#include "formatter.hpp"
+#include "logging.hpp"
+#include "player_info_journal.hpp"
+#include "string_utils.hpp"
+#include "tinyxml.h"
+#include "unit_test.hpp"
+#include "wml_node.hpp"
+#include "wml_utils.hpp"
+#include "xml_parser.hpp"
+#include "xml_writer.hpp"
+
+namespace {
+//once this many mutations have been journaled since the last snapshot
+//we ask the owner to compact.
+const int CompactionThreshold = 1000;
+
+player_info_ptr get_or_create_player(player_info_journal::player_map& players, const std::string& id)
+{
+	player_info_ptr& p = players[id];
+	if(!p) {
+		p.reset(new player_info);
+		p->set_id(id);
+	}
+
+	return p;
+}
+
+std::string xml_str(const TiXmlElement& el, const char* s)
+{
+	const char* attr = el.Attribute(s);
+	if(!attr) {
+		return "";
+	}
+
+	return attr;
+}
+
+//applies a single journal line to players. Returns false if the line
+//could not be understood, which happens for an entry that was cut off
+//part way through being written.
+bool replay_entry(player_info_journal::player_map& players, const std::string& line)
+{
+	TiXmlDocument doc;
+	doc.Parse(line.c_str());
+	if(doc.Error() || doc.RootElement() == NULL) {
+		return false;
+	}
+
+	const TiXmlElement& el = *doc.RootElement();
+	const std::string name = el.ValueStr();
+	const std::string id = xml_str(el, "id");
+	if(id.empty()) {
+		return false;
+	}
+
+	if(name == "modify_resources") {
+		const std::string resource = xml_str(el, "resource");
+		int delta = 0;
+		el.QueryIntAttribute("delta", &delta);
+		if(resource.size() != 1) {
+			return false;
+		}
+
+		get_or_create_player(players, id)->modify_resources(resource[0], delta);
+	} else if(name == "modify_deck") {
+		get_or_create_player(players, id)->modify_deck(xml_str(el, "remove"), xml_str(el, "add"));
+	} else {
+		return false;
+	}
+
+	return true;
+}
+
+std::string journal_header(int generation)
+{
+	return formatter() << "<journal generation=\"" << generation << "\"/>\n";
+}
+}
+
+player_info_journal::player_info_journal(const std::string& snapshot_path, const std::string& journal_path)
+  : snapshot_path_(snapshot_path), journal_path_(journal_path),
+    journal_file_(NULL), generation_(0), entries_since_snapshot_(0),
+    nqueued_(0), nwritten_(0), exiting_(false)
+{
+	thread_.reset(new threading::thread(boost::bind(&player_info_journal::write_thread, this)));
+}
+
+player_info_journal::~player_info_journal()
+{
+	{
+		threading::lock lck(mutex_);
+		exiting_ = true;
+	}
+
+	queue_cond_.notify_one();
+	thread_.reset();
+
+	if(journal_file_) {
+		fclose(journal_file_);
+	}
+}
+
+void player_info_journal::load(player_map& players)
+{
+	const std::string data = sys::read_file(snapshot_path_);
+	if(data.empty() == false) {
+		wml::const_node_ptr node = wml::parse_xml(data);
+		generation_ = wml::get_int(node, "generation");
+		FOREACH_WML_CHILD(player_info_node, node, "player_info") {
+			player_info_ptr p(new player_info(player_info_node));
+			players[p->id()] = p;
+		}
+	}
+
+	//the journal only applies on top of the snapshot it was started
+	//alongside. If we went down after writing a new snapshot but before
+	//starting a new journal, the old journal's entries are already part
+	//of the snapshot and must not be applied twice.
+	const std::vector<std::string> lines = util::split(sys::read_file(journal_path_), '\n');
+	if(lines.empty() == false && lines.front() + "\n" == journal_header(generation_)) {
+		int nreplayed = 0;
+		for(int n = 1; n < lines.size(); ++n) {
+			if(replay_entry(players, lines[n])) {
+				++nreplayed;
+			} else {
+				LOG_WARN("ignoring bad journal entry: " << lines[n]);
+			}
+		}
+
+		LOG_INFO("replayed " << nreplayed << " journal entries");
+	}
+
+	//start from a clean snapshot, so any damaged tail in the old journal
+	//never has new entries appended after it.
+	compact(players);
+}
+
+void player_info_journal::record_modify_resources(const std::string& id, char resource, int delta)
+{
+	TiXmlElement el("modify_resources");
+	el.SetAttribute("id", id);
+	el.SetAttribute("resource", std::string(1, resource));
+	el.SetAttribute("delta", delta);
+
+	std::string line;
+	line << el;
+	line += "\n";
+	push_entry(entry::APPEND, line, generation_);
+}
+
+void player_info_journal::record_modify_deck(const std::string& id, const std::string& remove, const std::string& add)
+{
+	if(remove.empty() && add.empty()) {
+		return;
+	}
+
+	TiXmlElement el("modify_deck");
+	el.SetAttribute("id", id);
+	el.SetAttribute("remove", remove);
+	el.SetAttribute("add", add);
+
+	std::string line;
+	line << el;
+	line += "\n";
+	push_entry(entry::APPEND, line, generation_);
+}
+
+bool player_info_journal::needs_compaction() const
+{
+	return entries_since_snapshot_ >= CompactionThreshold;
+}
+
+void player_info_journal::compact(const player_map& players)
+{
+	++generation_;
+
+	wml::node_ptr node(new wml::node("server"));
+	node->set_attr("generation", formatter() << generation_);
+	for(player_map::const_iterator i = players.begin(); i != players.end(); ++i) {
+		if(i->second) {
+			node->add_child(i->second->write());
+		}
+	}
+
+	push_entry(entry::SNAPSHOT, wml::output_xml(node), generation_);
+	entries_since_snapshot_ = 0;
+}
+
+void player_info_journal::flush()
+{
+	threading::lock lck(mutex_);
+	const int target = nqueued_;
+	while(nwritten_ < target) {
+		written_cond_.wait(mutex_);
+	}
+}
+
+void player_info_journal::push_entry(entry::TYPE type, const std::string& data, int generation)
+{
+	{
+		threading::lock lck(mutex_);
+		queue_.push_back(entry());
+		queue_.back().type = type;
+		queue_.back().data = data;
+		queue_.back().generation = generation;
+		++nqueued_;
+	}
+
+	if(type == entry::APPEND) {
+		++entries_since_snapshot_;
+	}
+
+	queue_cond_.notify_one();
+}
+
+void player_info_journal::write_thread()
+{
+	for(;;) {
+		std::vector<entry> entries;
+		{
+			threading::lock lck(mutex_);
+			while(queue_.empty() && !exiting_) {
+				queue_cond_.wait(mutex_);
+			}
+
+			if(queue_.empty()) {
+				return;
+			}
+
+			entries.swap(queue_);
+		}
+
+		//group everything that was queued while we were busy into a
+		//single write. Entries which came before a snapshot are already
+		//reflected in it, so they are dropped rather than written, unless
+		//the snapshot couldn't be written, when they go in the journal it
+		//would have replaced.
+		std::string buf;
+		foreach(const entry& e, entries) {
+			if(e.type == entry::SNAPSHOT) {
+				if(write_snapshot(e)) {
+					buf.clear();
+				}
+			} else {
+				buf += e.data;
+			}
+		}
+
+		append_to_journal(buf);
+
+		{
+			threading::lock lck(mutex_);
+			nwritten_ += entries.size();
+		}
+
+		written_cond_.notify_all();
+	}
+}
+
+bool player_info_journal::write_snapshot(const entry& e)
+{
+	const std::string tmp_path = snapshot_path_ + ".tmp";
+	FILE* file = fopen(tmp_path.c_str(), "wb");
+	if(!file) {
+		LOG_ERROR("could not write snapshot " << tmp_path);
+		return false;
+	}
+
+	fwrite(e.data.c_str(), 1, e.data.size(), file);
+	fflush(file);
+	fsync(fileno(file));
+	fclose(file);
+
+	sys::move_file(tmp_path, snapshot_path_);
+
+	if(journal_file_) {
+		fclose(journal_file_);
+	}
+
+	journal_file_ = fopen(journal_path_.c_str(), "wb");
+	if(!journal_file_) {
+		LOG_ERROR("could not open journal " << journal_path_);
+		return true;
+	}
+
+	append_to_journal(journal_header(e.generation));
+	return true;
+}
+
+void player_info_journal::append_to_journal(const std::string& data)
+{
+	if(data.empty()) {
+		return;
+	}
+
+	if(!journal_file_) {
+		journal_file_ = fopen(journal_path_.c_str(), "ab");
+		if(!journal_file_) {
+			LOG_ERROR("could not open journal " << journal_path_);
+			return;
+		}
+	}
+
+	fwrite(data.c_str(), 1, data.size(), journal_file_);
+	fflush(journal_file_);
+	fsync(fileno(journal_file_));
+}
+
+UNIT_TEST(player_info_journal_failed_snapshot) {
+	const std::string journal_path = "player_info_journal_test.tmp";
+	remove(journal_path.c_str());
+
+	//the snapshot can't be written, so what was recorded before it, much
+	//of which the writer gets in the same pass as the snapshot, stays in
+	//the journal.
+	const int Count = 1000;
+	{
+		player_info_journal journal("no_such_directory/snapshot.xml", journal_path);
+		for(int n = 0; n != Count; ++n) {
+			journal.record_modify_resources("a", 'a', 1);
+		}
+
+		journal.compact(player_info_journal::player_map());
+		journal.record_modify_resources("a", 'a', 1);
+		journal.flush();
+	}
+
+	const std::vector<std::string> lines = util::split(sys::read_file(journal_path), '\n');
+	remove(journal_path.c_str());
+	CHECK_EQ(lines.size(), Count + 1);
+}
@@ -0,0 +1,84 @@
+#ifndef PLAYER_INFO_JOURNAL_HPP_INCLUDED
+#define PLAYER_INFO_JOURNAL_HPP_INCLUDED
+
+#include <stdio.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <boost/scoped_ptr.hpp>
+
+#include "player_info.hpp"
+#include "thread.hpp"
+
+//Persists player_info records as a snapshot file plus an append-only
+//journal of the mutations made since that snapshot was taken.
+//
+//Recording a mutation only queues a line of text; a background thread
+//appends everything queued since its last pass in a single write and
+//sync, so the cost of persistence follows the rate of mutations rather
+//than the number of players, and the caller never waits on the disk.
+//Once enough entries have built up the owner calls compact(), which
+//hands a fresh snapshot to the writer thread and starts a new journal.
+class player_info_journal
+{
+public:
+	typedef std::map<std::string, player_info_ptr> player_map;
+
+	player_info_journal(const std::string& snapshot_path, const std::string& journal_path);
+	~player_info_journal();
+
+	//reads the snapshot into players and replays the journal over it.
+	//Any trailing entry which was only partially written is ignored.
+	void load(player_map& players);
+
+	void record_modify_resources(const std::string& id, char resource, int delta);
+	//only changes which took effect should be recorded, so that replaying
+	//the journal doesn't go through ones which did nothing.
+	void record_modify_deck(const std::string& id, const std::string& remove, const std::string& add);
+
+	bool needs_compaction() const;
+	void compact(const player_map& players);
+
+	//blocks until everything recorded so far has been written out.
+	void flush();
+
+private:
+	player_info_journal(const player_info_journal&);
+	void operator=(const player_info_journal&);
+
+	struct entry {
+		enum TYPE { APPEND, SNAPSHOT };
+		TYPE type;
+		std::string data;
+
+		//the snapshot generation the entry belongs to.
+		int generation;
+	};
+
+	void push_entry(entry::TYPE type, const std::string& data, int generation);
+	void write_thread();
+	//returns false, leaving the journal as it was, if the snapshot
+	//couldn't be written.
+	bool write_snapshot(const entry& e);
+	void append_to_journal(const std::string& data);
+
+	std::string snapshot_path_, journal_path_;
+	FILE* journal_file_;
+
+	//only touched by the owning thread; the writer thread learns the
+	//generation from the entries it is handed.
+	int generation_;
+	int entries_since_snapshot_;
+
+	threading::mutex mutex_;
+	threading::condition queue_cond_, written_cond_;
+	std::vector<entry> queue_;
+	int nqueued_, nwritten_;
+	bool exiting_;
+
+	boost::scoped_ptr<threading::thread> thread_;
+};
+
+#endif
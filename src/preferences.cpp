@@ -7,7 +7,9 @@ namespace preferences {
 	namespace {
 		bool no_sound_ = false;
 		bool show_debug_hitboxes_ = false;
+		bool show_frame_profile_ = false;
 		bool use_pretty_scaling_ = false;
+		int alpha_map_scale_ = 1;
 		bool fullscreen_ = false;
 		
 #if TARGET_OS_IPHONE || TARGET_IPHONE_SIMULATOR
@@ -57,6 +59,10 @@ namespace preferences {
 	bool show_debug_hitboxes() {
 		return show_debug_hitboxes_;
 	}
+
+	bool show_frame_profile() {
+		return show_frame_profile_;
+	}
 	
 	bool use_pretty_scaling() {
 		return use_pretty_scaling_;
@@ -66,6 +72,10 @@ namespace preferences {
 		use_pretty_scaling_ = value;
 	}
 	
+	int alpha_map_scale() {
+		return alpha_map_scale_;
+	}
+	
 	bool fullscreen() {
 		return fullscreen_;
 	}
@@ -136,6 +146,8 @@ namespace preferences {
 		std::string s(arg);
 		if(s == "--show_hitboxes") {
 			show_debug_hitboxes_ = true;
+		} else if(s == "--show_frame_profile") {
+			show_frame_profile_ = true;
 		} else if(s == "--scale") {
 			set_use_pretty_scaling(true);
 		} else if(s == "--nosound") {
@@ -146,6 +158,10 @@ namespace preferences {
 			set_widescreen();
 		} else if(s == "--potonly") {
 			force_no_npot_textures_ = true;
+		} else if(s == "--alpha_map_scale=2") {
+			alpha_map_scale_ = 2;
+		} else if(s == "--alpha_map_scale=4") {
+			alpha_map_scale_ = 4;
 		} else {
 			return false;
 		}
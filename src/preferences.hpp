@@ -7,8 +7,14 @@ namespace preferences {
 	bool no_sound();
 	const char* save_file_path();
 	bool show_debug_hitboxes();
+
+	//whether the client starts with the frame profiler's overlay showing.
+	bool show_frame_profile();
 	bool use_pretty_scaling();
 	void set_use_pretty_scaling(bool value);
+
+	//the factor alpha maps for hit testing are scaled down by: 1, 2 or 4.
+	int alpha_map_scale();
 	bool fullscreen();
 	void set_fullscreen(bool value);
 	
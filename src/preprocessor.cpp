@@ -1,64 +1,188 @@
+#include <stdio.h>
+#include <string.h>
+#include <utime.h>
+
 #include <algorithm>
 #include <iostream>
 #include <fstream>
 #include <sstream>
 #include <string>
+#include <utility>
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
 
+#include "concurrent_cache.hpp"
 #include "preprocessor.hpp"
 #include "filesystem.hpp"
-std::string preprocess(const std::string& input){
-	std::string output_string;
-
-	std::string::const_iterator i = input.begin();
-	
-	while(i != input.end()){
-		//std::cerr << "test";
-		if(*i == '@'){
-
-
-			// process pre-processing directive here. See what comes after the '@' and do something appropriate
-			static const std::string IncludeString = "@include";
-			if(input.end() - i > IncludeString.size() && std::equal(IncludeString.begin(), IncludeString.end(), i)) {
-					std::string filename_string;
-
-					i += IncludeString.size(); //skip past the directive - we've tested that it exists
-					
-					//test for an argument to @include - e.g. "filename.xml".  First the open quote:
-					std::string::const_iterator quote = std::find(i, input.end(), '"');
-					if(quote == input.end()) {
-						std::cerr << "we didn't find a opening quote. Syntax error." << std::endl;
-					}
-					if(std::count_if(i, quote, isspace) != quote - i) {
-					// # of whitespaces != number of intervening chars => something else was present.  Syntax Error. 
-						std::cerr << "# of whitespaces != number of intervening chars." << std::endl;
-					}
-					i = quote + 1; //we've found a quote, advance past it
-					//now the closing quote, and use it to find what's inbetween:
-					std::string::const_iterator endQuote = std::find(i, input.end(), '"');
-					if(endQuote == input.end()) {
-						std::cerr << "we didn't find a closing quote. Syntax error." << std::endl;
-					}
-					
-					
-					filename_string = std::string(i, endQuote);
-					
-					i = endQuote + 1;
-					
-															
-					output_string += preprocess(sys::read_file(filename_string));
-			}
-		} else {
-			//nothing special to process, just copy the chars across
-			output_string.push_back(*i);
+#include "foreach.hpp"
+#include "unit_test.hpp"
+
+namespace {
+
+typedef std::vector<std::pair<std::string, time_t> > dependency_list;
+
+//an included file, already expanded.
+struct include_entry {
+	std::string text;
+
+	//every file the text was built from, including the file itself, with
+	//the modification time it had when it was read. The entry is only
+	//good for as long as none of them change, so changing a file only
+	//invalidates the entries which depend on it.
+	dependency_list dependencies;
+};
+
+typedef boost::shared_ptr<const include_entry> const_include_entry_ptr;
+
+concurrent_cache<std::string, const_include_entry_ptr>& include_cache()
+{
+	static concurrent_cache<std::string, const_include_entry_ptr>* cache = new concurrent_cache<std::string, const_include_entry_ptr>;
+	return *cache;
+}
+
+bool up_to_date(const include_entry& entry)
+{
+	foreach(const dependency_list::value_type& dep, entry.dependencies) {
+		if(sys::file_mod_time(dep.first) != dep.second) {
+			return false;
 		}
-		++i;
 	}
 
-	return output_string;
+	return true;
+}
+
+void expand(const std::string& input, std::string& output, std::vector<std::string>& stack, dependency_list* dependencies);
+
+//appends the expanded contents of the file. The files in the stack are
+//the ones currently being expanded, which it would be a cycle to include.
+void include_file(const std::string& fname, std::string& output, std::vector<std::string>& stack, dependency_list* dependencies)
+{
+	if(std::find(stack.begin(), stack.end(), fname) != stack.end()) {
+		std::cerr << "include cycle: '" << fname << "' includes itself." << std::endl;
+		return;
+	}
+
+	const_include_entry_ptr entry = include_cache().get(fname);
+	if(!entry || !up_to_date(*entry)) {
+		boost::shared_ptr<include_entry> new_entry(new include_entry);
+
+		//take the time before reading, so a change made while we're
+		//reading is caught next time.
+		const time_t mod_time = sys::file_mod_time(fname);
+		stack.push_back(fname);
+		expand(sys::read_file(fname), new_entry->text, stack, &new_entry->dependencies);
+		stack.pop_back();
+		new_entry->dependencies.push_back(std::make_pair(fname, mod_time));
+
+		include_cache().put(fname, new_entry);
+		entry = new_entry;
+	}
+
+	output += entry->text;
+	if(dependencies) {
+		dependencies->insert(dependencies->end(), entry->dependencies.begin(), entry->dependencies.end());
+	}
 }
 
+void expand(const std::string& input, std::string& output, std::vector<std::string>& stack, dependency_list* dependencies)
+{
+	static const char IncludeString[] = "@include";
+	static const size_t IncludeLength = sizeof(IncludeString) - 1;
+
+	output.reserve(output.size() + input.size());
 
+	const char* i = input.data();
+	const char* end = i + input.size();
+
+	//everything up to the next '@' is copied across as it is.
+	const char* at;
+	while((at = static_cast<const char*>(memchr(i, '@', end - i))) != NULL) {
+		output.append(i, at);
+
+		if(end - at <= IncludeLength || memcmp(at, IncludeString, IncludeLength) != 0) {
+			//not a directive we know, so it's just text.
+			output += '@';
+			i = at + 1;
+			continue;
+		}
 
+		//the argument to @include is a quoted filename, with nothing but
+		//whitespace before it.
+		const char* quote = std::find(at + IncludeLength, end, '"');
+		if(quote == end) {
+			std::cerr << "we didn't find a opening quote. Syntax error." << std::endl;
+			return;
+		}
+
+		if(std::count_if(at + IncludeLength, quote, isspace) != quote - (at + IncludeLength)) {
+			std::cerr << "# of whitespaces != number of intervening chars." << std::endl;
+		}
+
+		const char* end_quote = std::find(quote + 1, end, '"');
+		if(end_quote == end) {
+			std::cerr << "we didn't find a closing quote. Syntax error." << std::endl;
+			return;
+		}
+
+		include_file(std::string(quote + 1, end_quote), output, stack, dependencies);
+		i = end_quote + 1;
+	}
+
+	output.append(i, end);
+}
+
+}
+
+std::string preprocess(const std::string& input)
+{
+	std::string output;
+	std::vector<std::string> stack;
+	expand(input, output, stack, NULL);
+	return output;
+}
+
+std::string preprocess_file(const std::string& fname)
+{
+	std::string output;
+	std::vector<std::string> stack(1, fname);
+	expand(sys::read_file(fname), output, stack, NULL);
+	return output;
+}
+
+UNIT_TEST(preprocessor) {
+	sys::write_file("preprocessor_test_a.xml", "<a>@include \"preprocessor_test_b.xml\"</a>");
+	sys::write_file("preprocessor_test_b.xml", "<b x=\"me@host\"/>");
+	sys::write_file("preprocessor_test_c.xml", "<c>@include \"preprocessor_test_c.xml\"</c>");
+
+	CHECK_EQ(preprocess_file("preprocessor_test_a.xml"), "<a><b x=\"me@host\"/></a>");
+	CHECK_EQ(preprocess("@include \"preprocessor_test_a.xml\"@include \"preprocessor_test_b.xml\""), "<a><b x=\"me@host\"/></a><b x=\"me@host\"/>");
+
+	//a file which includes itself has the inner include dropped, rather
+	//than recursing forever.
+	CHECK_EQ(preprocess_file("preprocessor_test_c.xml"), "<c></c>");
+
+	//changing a file which was included, even indirectly, is seen next
+	//time. The modification time only has a resolution of seconds, so set
+	//it rather than waiting for it to change.
+	sys::write_file("preprocessor_test_b.xml", "<b2/>");
+	struct utimbuf times;
+	times.actime = times.modtime = sys::file_mod_time("preprocessor_test_b.xml") + 10;
+	utime("preprocessor_test_b.xml", &times);
+	CHECK_EQ(preprocess("@include \"preprocessor_test_a.xml\""), "<a><b2/></a>");
+
+	remove("preprocessor_test_a.xml");
+	remove("preprocessor_test_b.xml");
+	remove("preprocessor_test_c.xml");
+}
+
+BENCHMARK(preprocess)
+{
+	const std::string doc = sys::read_file("data/cards.xml");
+	BENCHMARK_LOOP {
+		preprocess(doc);
+	}
+}
 
 #ifdef BUILD_PREPROCESSOR_TOOL
 
@@ -1,7 +1,17 @@
 #ifndef PREPROCESSOR_HPP_INCLUDED
 #define PREPROCESSOR_HPP_INCLUDED
 
+#include <string>
+
+//expands @include "filename" directives. Included files are expanded
+//once and cached until they, or anything they include, change. A file
+//which includes itself, directly or not, has the include which would
+//recurse dropped.
 std::string preprocess(const std::string& input);
 
+//like preprocess(), for the contents of a file, which is taken to be
+//part of any cycle of includes which leads back to it.
+std::string preprocess_file(const std::string& fname);
+
 
 #endif
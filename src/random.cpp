@@ -4,21 +4,28 @@
 
 namespace rng {
 
-static unsigned int next = 1;
+static unsigned int global_state = 1;
+static unsigned int* next = &global_state;
 
 int generate() {
-	next = next * 1103515245 + 12345;
-	const int result = ((unsigned int)(next/65536) % 32768);
+	*next = *next * 1103515245 + 12345;
+	const int result = ((unsigned int)(*next/65536) % 32768);
 	return result;
 }
 
 void set_seed(unsigned int seed) {
 	std::cerr << "RANDOM SEED: " << seed << "\n";
-	next = seed;
+	*next = seed;
 }
 
 unsigned int get_seed() {
-	return next;
+	return *next;
+}
+
+unsigned int* set_state(unsigned int* state) {
+	unsigned int* old_state = next == &global_state ? NULL : next;
+	next = state ? state : &global_state;
+	return old_state;
 }
 
 }
@@ -6,6 +6,12 @@ namespace rng {
 int generate();
 void set_seed(unsigned int seed);
 unsigned int get_seed();
+
+//directs generate(), set_seed() and get_seed() at the given state rather
+//than the process-wide one, so e.g. each game can own its own sequence.
+//Passing NULL goes back to the process-wide state. Returns the state that
+//was previously in use.
+unsigned int* set_state(unsigned int* state);
 }
 
 #endif
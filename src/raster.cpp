@@ -319,7 +319,8 @@ void set_video_mode(int w, int h)
 	}
 
 namespace {
-const texture* blit_current_texture;
+//textures which are parts of the same atlas page are queued together.
+texture blit_current_texture;
 std::vector<GLfloat> blit_tcqueue;
 std::vector<GLshort> blit_vqueue;
 }
@@ -330,9 +331,9 @@ void queue_blit_texture(const texture& tex, int x, int y, int w, int h,
 	x &= preferences::xypos_draw_mask;
 	y &= preferences::xypos_draw_mask;
 
-	if(&tex != blit_current_texture) {
+	if(!blit_current_texture.valid() || tex.get_id() != blit_current_texture.get_id()) {
 		flush_blit_texture();
-		blit_current_texture = &tex;
+		blit_current_texture = tex;
 	}
 
 	x1 = tex.translate_coord_x(x1);
@@ -375,9 +376,9 @@ void queue_blit_texture(const texture& tex, int x, int y, int w, int h, int rota
 	x &= preferences::xypos_draw_mask;
 	y &= preferences::xypos_draw_mask;
 	
-	if(&tex != blit_current_texture) {
+	if(!blit_current_texture.valid() || tex.get_id() != blit_current_texture.get_id()) {
 		flush_blit_texture();
-		blit_current_texture = &tex;
+		blit_current_texture = tex;
 	}
 	
 	x1 = tex.translate_coord_x(x1);
@@ -423,16 +424,16 @@ void queue_blit_texture(const texture& tex, int x, int y, int w, int h, int rota
 	
 void flush_blit_texture()
 {
-	if(!blit_current_texture) {
+	if(!blit_current_texture.valid()) {
 		return;
 	}
 
-	blit_current_texture->set_as_current_texture();
+	blit_current_texture.set_as_current_texture();
 	glVertexPointer(2, GL_SHORT, 0, &blit_vqueue.front());
 	glTexCoordPointer(2, GL_FLOAT, 0, &blit_tcqueue.front());
 	glDrawArrays(GL_TRIANGLE_STRIP, 0, blit_tcqueue.size()/2);
 
-	blit_current_texture = NULL;
+	blit_current_texture = texture();
 	blit_tcqueue.clear();
 	blit_vqueue.clear();
 }
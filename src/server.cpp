@@ -2,12 +2,19 @@
 #include <iostream>
 #include <string>
 
+#include <string.h>
+#include <time.h>
+
 #include <boost/bind.hpp>
 #include <boost/shared_ptr.hpp>
 
 #include "asserts.hpp"
+#include "document_cache.hpp"
 #include "filesystem.hpp"
 #include "foreach.hpp"
+#include "formatter.hpp"
+#include "logging.hpp"
+#include "metrics.hpp"
 #include "server.hpp"
 #include "string_utils.hpp"
 #include "wml_utils.hpp"
@@ -16,6 +23,74 @@
 
 namespace
 {
+metrics::counter connections_accepted("wizard_connections_accepted_total", "listener", "game", "Connections accepted.");
+metrics::counter bytes_received("wizard_bytes_received_total", "listener", "game", "Bytes read from clients.");
+metrics::counter bytes_sent("wizard_bytes_sent_total", "listener", "game", "Bytes written to clients.");
+metrics::counter bytes_before_compression("wizard_bytes_before_compression_total", "Size of the messages which were compressed before sending.");
+metrics::counter bytes_after_compression("wizard_bytes_after_compression_total", "Size after compression of the messages which were compressed.");
+metrics::histogram_family message_time("wizard_handle_message_seconds", "type", "Time spent handling a message, by message type.");
+
+//the types of message the server and its games handle, sorted. Each
+//one's histogram is only looked up in the family once, so timing a
+//message takes no lock. Other types are all timed as "other".
+const char* const MessageTypes[] = { "close_ajax", "commands", "create_game", "end_turn", "enter_lobby", "join_game", "login", "modify_deck", "modify_resources", "move", "play", "select_unit", "setup", "spells" };
+const int NumMessageTypes = sizeof(MessageTypes)/sizeof(*MessageTypes);
+
+bool str_less(const char* a, const char* b)
+{
+	return strcmp(a, b) < 0;
+}
+
+std::vector<metrics::histogram*> create_message_histograms()
+{
+	std::vector<metrics::histogram*> result;
+	for(int n = 0; n != NumMessageTypes; ++n) {
+		result.push_back(&message_time.get(MessageTypes[n]));
+	}
+
+	result.push_back(&message_time.get("other"));
+	return result;
+}
+
+metrics::histogram& message_histogram(const char* type)
+{
+	static const std::vector<metrics::histogram*> histograms = create_message_histograms();
+	const char* const* i = std::lower_bound(MessageTypes, MessageTypes + NumMessageTypes, type, str_less);
+	if(i == MessageTypes + NumMessageTypes || strcmp(*i, type) != 0) {
+		return *histograms.back();
+	}
+
+	return *histograms[i - MessageTypes];
+}
+
+//smaller messages, such as heartbeats, aren't worth compressing.
+const size_t CompressThreshold = 1024;
+
+const int LobbyUpdateIntervalMs = 250;
+
+//the timer wheel ticks ten times a second and goes round in a little
+//under two minutes; anything longer waits for extra trips round.
+const int TickMs = 100;
+const int TimerSlots = 1024;
+
+//a connection waiting for a message is sent a heartbeat after this long
+//if there's nothing for it.
+const int LongPollTimeoutMs = 10000;
+
+//connections which haven't sent anything for this long, and aren't
+//waiting for a message, are dropped.
+const int IdleTimeoutMs = 120000;
+
+//a player who takes longer than this to cast has their turn ended for
+//them.
+const int TurnTimeoutMs = 120000;
+
+const int JournalCompactionIntervalMs = 1000;
+
+//game command logs are written as messages come in, but only flushed to
+//disk this often, so a crash loses at most this much of a replay.
+const int CommandLogFlushIntervalMs = 1000;
+
 int xml_int(const TiXmlElement& el, const char* s)
 {
 	int res = 0;
@@ -36,25 +111,34 @@ std::string xml_str(const TiXmlElement& el, const char* s)
 
 using boost::asio::ip::tcp;
 
-server::game_info::game_info() : game_state(new game)
+server::game_info::game_info() : id(0), game_state(new game), started(false),
+  clock_turn(-1), clock_player(-1), turn_timer(0), missed_turns(0)
 {}
 
 server::server(boost::asio::io_service& io_service)
   : acceptor_(io_service, tcp::endpoint(tcp::v4(), 17000)),
-    timer_(io_service), nheartbeat_(0), scheduled_write_(0)
-{
-	std::string data = sys::read_file("./wizard-server-data.xml");
-	if(data.empty() == false) {
-		wml::const_node_ptr node = wml::parse_xml(data);
-		FOREACH_WML_CHILD(player_info_node, node, "player_info") {
-			player_info_ptr p(new player_info(player_info_node));
-			player_info_[p->id()] = p;
-		}
-	}
+    timer_(io_service),
+    timers_(TickMs, TimerSlots),
+    journal_("./wizard-server-data.xml", "./wizard-server-data.journal"),
+    lobby_version_(0), ngames_created_(0)
+{
+	journal_.load(player_info_);
 
 	start_accept();
 
-	heartbeat();
+	timer_.expires_from_now(boost::posix_time::milliseconds(TickMs));
+	timer_.async_wait(boost::bind(&server::tick, this));
+	timers_.schedule(JournalCompactionIntervalMs, boost::bind(&server::compact_journal, this));
+	timers_.schedule(CommandLogFlushIntervalMs, boost::bind(&server::flush_command_logs, this));
+}
+
+void server::flush_command_logs()
+{
+	for(std::map<int, game_info_ptr>::const_iterator i = games_.begin(); i != games_.end(); ++i) {
+		i->second->game_state->flush_command_log();
+	}
+
+	timers_.schedule(CommandLogFlushIntervalMs, boost::bind(&server::flush_command_logs, this));
 }
 
 void server::start_accept()
@@ -66,12 +150,14 @@ void server::start_accept()
 void server::handle_accept(socket_ptr socket, const boost::system::error_code& error)
 {
 	if(error) {
-		std::cerr << "ERROR IN ACCEPT\n";
+		LOG_ERROR("error in accept: " << error.message());
 		return;
 	}
 
-	std::cerr << "RECEIVED CONNECTION. Listening\n";
+	LOG_INFO("received connection");
+	connections_accepted.add();
 
+	watch_idle(socket);
 	start_receive(socket);
 
 	start_accept();
@@ -90,6 +176,8 @@ void server::handle_receive(socket_ptr socket, buffer_ptr buf, const boost::syst
 		return;
 	}
 
+	bytes_received.add(nbytes);
+	connections_[socket].last_activity = metrics::get_time_micros();
 	handle_incoming_data(socket, &(*buf)[0], &(*buf)[0] + nbytes);
 
 	start_receive(socket);
@@ -110,11 +198,11 @@ void server::handle_incoming_data(socket_ptr socket, const char* i1, const char*
 
 void server::handle_message(socket_ptr socket, const std::vector<char>& msg)
 {
-	std::cerr << "MSG: " << &msg[0] << "\n";
+	LOG_DEBUG_FIELDS(logging::fields().nick(connections_[socket].nick), "received: " << &msg[0]);
 	TiXmlDocument doc;
 	doc.Parse(&msg[0]);
 	if(doc.Error()) {
-		std::cerr << "INVALID XML RECEIVED\n";
+		LOG_WARN_FIELDS(logging::fields().nick(connections_[socket].nick), "invalid xml received");
 		return;
 	}
 	handle_message(socket, *doc.RootElement());
@@ -128,17 +216,23 @@ void server::handle_message(socket_ptr socket, const TiXmlElement& node)
 	}
 
 	socket_info& info = connections_[socket];
+	if(info.nick.empty() == false) {
+		clients_[info.nick].last_seen = metrics::get_time_micros();
+	}
 	if(info.ajax_connection) {
 		close_ajax(socket);
 	}
+
+	deliver_queued();
 }
 
 void server::handle_message_internal(socket_ptr socket, const TiXmlElement& node)
 {
 	const std::string name = node.Value();
-	std::cerr << "handle_message(" << name << ")\n";
+	const metrics::timer timer(message_histogram(node.Value()));
 
 	socket_info& info = connections_[socket];
+	LOG_DEBUG_FIELDS(logging::fields().nick(info.nick).type(name), "handle_message");
 	if(name == "close_ajax") {
 		close_ajax(socket);
 	} else if(name == "commands") {
@@ -147,15 +241,12 @@ void server::handle_message_internal(socket_ptr socket, const TiXmlElement& node
 		}
 	} else if(name == "login") {
 		info.nick = node.Attribute("name");
-	} else if(name == "enter_lobby") {
-		foreach(game_info_ptr& g, games_) {
-			if(std::count(g->clients.begin(), g->clients.end(), info.nick)) {
-				g->clients.erase(std::remove(g->clients.begin(), g->clients.end(), info.nick), g->clients.end());
-				g.reset();
-			}
+		if(xml_str(node, "compress") == "gzip") {
+			info.accepts_gzip = true;
 		}
-
-		games_.erase(std::remove(games_.begin(), games_.end(), game_info_ptr()), games_.end());
+	} else if(name == "enter_lobby") {
+		leave_game(info.nick);
+		lobby_clients_.insert(info.nick);
 
 		std::string msg;
 		create_lobby_msg(msg);
@@ -164,110 +255,175 @@ void server::handle_message_internal(socket_ptr socket, const TiXmlElement& node
 
 		player_info_ptr pl = get_player_info(info.nick);
 		wml::node_ptr player_data = pl->write();
-		queue_msg(info.nick, wml::output_xml(pl->write()));
+		queue_msg(info.nick, wml::output_xml(pl->write(), wml::XML_COMPACT));
 	} else if(name == "modify_resources") {
 		player_info_ptr pl = get_player_info(info.nick);
 
 		const char* resource = node.Attribute("resource");
 		if(!resource) {
-			std::cerr << "NO RESOURCE FOUND IN MODIFY_RESOURCS\n";
+			LOG_WARN_FIELDS(logging::fields().nick(info.nick).type(name), "no resource found in modify_resources");
 			return;
 		}
 
 		const int delta = xml_int(node, "delta");
 
-		pl->modify_resources(*resource, delta);
-		queue_msg(info.nick, wml::output_xml(pl->write()));
+		if(pl->modify_resources(*resource, delta)) {
+			journal_.record_modify_resources(info.nick, *resource, delta);
+		}
 
-		schedule_write();
+		queue_msg(info.nick, wml::output_xml(pl->write(), wml::XML_COMPACT));
 	} else if(name == "modify_deck") {
 		player_info_ptr pl = get_player_info(info.nick);
 
-		if(node.Attribute("remove")) {
-			const std::string value = xml_str(node, "remove");
-			foreach(const std::string& s, util::split(value, ',')) {
-				pl->remove_from_deck(s);
-			}
-		}
-
-		if(node.Attribute("add")) {
-			const std::string value = xml_str(node, "add");
-			foreach(const std::string& s, util::split(value, ',')) {
-				pl->add_to_deck(s);
-			}
+		const std::string remove = xml_str(node, "remove");
+		const std::string add = xml_str(node, "add");
+		if(pl->modify_deck(remove, add)) {
+			journal_.record_modify_deck(info.nick, remove, add);
 		}
 
-		queue_msg(info.nick, wml::output_xml(pl->write()));
-
-		schedule_write();
+		queue_msg(info.nick, wml::output_xml(pl->write(), wml::XML_COMPACT));
 	} else if(name == "create_game") {
+		leave_game(info.nick);
+		lobby_clients_.erase(info.nick);
+
 		game_info_ptr new_game(new game_info);
-		games_.push_back(new_game);
+		new_game->id = ++ngames_created_;
+		games_[new_game->id] = new_game;
+		new_game->game_state->set_command_log_file(formatter() << sys::get_dir("replays") << "/game-" << time(NULL) << "-" << new_game->id << ".xml");
+		LOG_INFO_FIELDS(logging::fields().game(new_game->id).nick(info.nick).type(name), "game created");
 		const game_context context(new_game->game_state.get());
 		new_game->clients.push_back(info.nick);
 		new_game->game_state->add_player(info.nick, *get_player_info(info.nick));
 		const int nbots = xml_int(node, "bots");
 		for(int n = 0; n != nbots; ++n) {
-			player_info info(wml::parse_xml(sys::read_file("deck.xml")));
+			player_info info(document_cache::get_xml("deck.xml"));
 			new_game->game_state->add_ai_player("bot", info);
 		}
 
+		//seats counts everyone in the game, including the host and any
+		//bots. Without it, anyone can join until the game starts.
+		const int seats = xml_int(node, "seats");
+		matchmaking_.add(new_game->id, xml_str(node, "pool"), seats > 0 ? std::max(0, seats - 1 - nbots) : -1);
+
 		client_info& cli_info = clients_[info.nick];
 		
 		cli_info.game = new_game;
 		cli_info.nplayer = 0;
 
-		send_lobby_msg();
+		lobby_changed(new_game->id);
 
 		queue_msg(info.nick, "<game_created/>");
 	} else if(name == "join_game") {
-		std::cerr << "join_game...\n";
-		client_info& cli_info = clients_[info.nick];
-		for(std::map<std::string, client_info>::iterator i = clients_.begin();
-		    i != clients_.end(); ++i) {
-			if(i->second.game && i->second.game->game_state->started() == false) {
-				const game_context context(i->second.game->game_state.get());
-				i->second.game->clients.push_back(info.nick);
-				i->second.game->game_state->add_player(info.nick, *get_player_info(info.nick));
-				cli_info.nplayer = i->second.game->clients.size() - 1;
-				cli_info.game = i->second.game;
-
-				std::string join_game;
-				join_game << node;
-				queue_msg(i->second.game->clients.front(), join_game);
-				std::cerr << "SENDING join_game TO " << i->second.game->clients.front() << "\n";
-				break;
-			}
+		leave_game(info.nick);
+		lobby_clients_.erase(info.nick);
+
+		const int game_id = matchmaking_.take_seat(xml_str(node, "pool"));
+		if(game_id == -1) {
+			LOG_INFO_FIELDS(logging::fields().nick(info.nick).type(name), "no game to join");
+			return;
 		}
+
+		game_info_ptr g = games_[game_id];
+		const game_context context(g->game_state.get());
+		g->clients.push_back(info.nick);
+		g->game_state->add_player(info.nick, *get_player_info(info.nick));
+
+		client_info& cli_info = clients_[info.nick];
+		cli_info.nplayer = g->clients.size() - 1;
+		cli_info.game = g;
+		lobby_changed(g->id);
+
+		std::string join_game;
+		join_game << node;
+		queue_msg(g->clients.front(), join_game);
+		LOG_INFO_FIELDS(logging::fields().game(g->id).nick(info.nick).type(name), "joined game hosted by " << g->clients.front());
 	} else {
 		if(info.nick.empty()) {
-			std::cerr << "USER WITH NO NICK SENT UNRECOGNIZED DATA\n";
+			LOG_WARN_FIELDS(logging::fields().type(name), "user with no nick sent unrecognized data");
 			return;
 		}
 
 		client_info& cli_info = clients_[info.nick];
 		if(cli_info.game) {
-			std::cerr << "GOT MESSAGE FROM " << cli_info.nplayer << ": " << node << "\n";
-			const game_context context(cli_info.game->game_state.get());
-			cli_info.game->game_state->handle_message(cli_info.nplayer, node);
-
-			std::vector<game::message> game_response;
-			cli_info.game->game_state->swap_outgoing_messages(game_response);
-			foreach(game::message& msg, game_response) {
-				if(msg.recipients.empty()) {
-					foreach(const std::string& nick, cli_info.game->clients) {
-						queue_msg(nick, msg.contents);
-					}
-				} else {
-					foreach(int player, msg.recipients) {
-						ASSERT_LT(player, cli_info.game->clients.size());
-						queue_msg(cli_info.game->clients[player], msg.contents);
-					}
+			LOG_DEBUG_FIELDS(logging::fields().game(cli_info.game->id).player(cli_info.nplayer).nick(info.nick).type(name), "game message: " << node);
+			cli_info.game->missed_turns = 0;
+			handle_game_message(cli_info.game, cli_info.nplayer, node);
+		}
+	}
+
+}
+
+void server::handle_game_message(const game_info_ptr& g, int nplayer, const TiXmlElement& node)
+{
+	const game_context context(g->game_state.get());
+	g->game_state->handle_message(nplayer, node);
+	if(g->game_state->started() && !g->started) {
+		g->started = true;
+		matchmaking_.remove(g->id);
+		lobby_changed(g->id);
+	}
+
+	std::vector<game::message> game_response;
+	g->game_state->swap_outgoing_messages(game_response);
+	foreach(game::message& msg, game_response) {
+		//players who have left keep their seats, but aren't sent
+		//anything more about the game.
+		if(msg.recipients.empty()) {
+			foreach(const std::string& nick, g->clients) {
+				if(clients_[nick].game == g) {
+					queue_msg(nick, msg.contents);
+				}
+			}
+		} else {
+			foreach(int player, msg.recipients) {
+				ASSERT_LT(player, g->clients.size());
+				if(clients_[g->clients[player]].game == g) {
+					queue_msg(g->clients[player], msg.contents);
 				}
 			}
 		}
 	}
 
+	update_turn_clock(g);
+}
+
+void server::update_turn_clock(const game_info_ptr& g)
+{
+	const game& state = *g->game_state;
+	if(!state.started() || (state.player_turn() == g->clock_turn && state.player_casting() == g->clock_player)) {
+		return;
+	}
+
+	g->clock_turn = state.player_turn();
+	g->clock_player = state.player_casting();
+	timers_.cancel(g->turn_timer);
+	g->turn_timer = 0;
+	if(g->missed_turns < std::max<int>(1, g->clients.size())) {
+		g->turn_timer = timers_.schedule(TurnTimeoutMs, boost::bind(&server::turn_expired, this, game_info_weak_ptr(g), g->clock_player));
+	}
+}
+
+void server::turn_expired(game_info_weak_ptr weak_game, int nplayer)
+{
+	game_info_ptr g = weak_game.lock();
+	if(!g) {
+		return;
+	}
+
+	g->turn_timer = 0;
+	if(g->game_state->player_casting() != nplayer) {
+		return;
+	}
+
+	LOG_INFO_FIELDS(logging::fields().game(g->id).player(nplayer), "turn timed out");
+	++g->missed_turns;
+
+	TiXmlElement end_turn("end_turn");
+	end_turn.SetAttribute("skip", "yes");
+	try {
+		handle_game_message(g, nplayer, end_turn);
+	} catch(assert_fail_exception&) {
+	}
 }
 
 void server::close_ajax(socket_ptr socket)
@@ -276,142 +432,322 @@ void server::close_ajax(socket_ptr socket)
 
 	client_info& cli_info = clients_[info.nick];
 
-	if(cli_info.msg_queue.empty() == false) {
+	if(cli_info.waiting == socket) {
+		return;
+	}
 
-		for(std::map<socket_ptr,std::string>::iterator s = waiting_connections_.begin();
-		    s != waiting_connections_.end(); ++s) {
-			if(s->second == info.nick && s->first != socket) {
-				send_msg(s->first, "<heartbeat/>");
-				s->first->close();
-				disconnect(s->first);
-				break;
-			}
-		}
+	//a client only has one connection waiting; an older one is let go
+	//with a heartbeat.
+	if(cli_info.waiting) {
+		socket_ptr old = cli_info.waiting;
+		send_msg(old, "<heartbeat/>");
+		old->close();
+		disconnect(old);
+	}
 
+	if(cli_info.msg_queue.empty() == false) {
 		send_msg(socket, cli_info.msg_queue.front());
 		cli_info.msg_queue.pop_front();
 		disconnect(socket);
 		socket->close();
 	} else {
 		waiting_connections_[socket] = info.nick;
+		cli_info.waiting = socket;
+		info.wait_timer = timers_.schedule(LongPollTimeoutMs, boost::bind(&server::wait_expired, this, socket));
 	}
 }
 
+void server::wait_expired(socket_ptr socket)
+{
+	connections_[socket].wait_timer = 0;
+	send_msg(socket, "<heartbeat/>");
+	disconnect(socket);
+	socket->close();
+}
+
 void server::queue_msg(const std::string& nick, const std::string& msg)
 {
-	clients_[nick].msg_queue.push_back(msg);
+	client_info& cli_info = clients_[nick];
+	cli_info.msg_queue.push_back(msg);
+	if(cli_info.waiting) {
+		deliveries_.insert(nick);
+	}
+}
+
+void server::deliver_queued()
+{
+	foreach(const std::string& nick, deliveries_) {
+		client_info& cli_info = clients_[nick];
+		if(cli_info.waiting && cli_info.msg_queue.empty() == false) {
+			socket_ptr socket = cli_info.waiting;
+			send_msg(socket, cli_info.msg_queue.front());
+			cli_info.msg_queue.pop_front();
+			disconnect(socket);
+			socket->close();
+		}
+	}
+
+	deliveries_.clear();
+}
+
+void server::watch_idle(socket_ptr socket)
+{
+	socket_info& info = connections_[socket];
+	info.last_activity = metrics::get_time_micros();
+	info.idle_timer = timers_.schedule(IdleTimeoutMs, boost::bind(&server::check_idle, this, socket));
+}
+
+void server::check_idle(socket_ptr socket)
+{
+	socket_info& info = connections_[socket];
+	info.idle_timer = 0;
+
+	//rather than moving the timer every time data arrives, see how long
+	//it's really been and wait for the rest.
+	const int idle_ms = (metrics::get_time_micros() - info.last_activity)/1000;
+	if(waiting_connections_.count(socket) || idle_ms < IdleTimeoutMs) {
+		const int remaining = waiting_connections_.count(socket) ? IdleTimeoutMs : IdleTimeoutMs - idle_ms;
+		info.idle_timer = timers_.schedule(remaining, boost::bind(&server::check_idle, this, socket));
+		return;
+	}
+
+	LOG_INFO_FIELDS(logging::fields().nick(info.nick), "dropping idle connection");
+	disconnect(socket);
+	socket->close();
+}
+
+void server::leave_game(const std::string& nick)
+{
+	client_info& cli_info = clients_[nick];
+	game_info_ptr g = cli_info.game;
+	if(!g) {
+		return;
+	}
+
+	cli_info.game.reset();
+
+	//players are numbered by where they sit, so the seat is kept and the
+	//game goes on for anyone still in it. Only the host can start a game,
+	//so one they leave before it starts goes away.
+	if(g->game_state->started() || g->clients.front() != nick) {
+		foreach(const std::string& other, g->clients) {
+			if(clients_[other].game == g) {
+				return;
+			}
+		}
+	}
+
+	foreach(const std::string& other, g->clients) {
+		if(clients_[other].game == g) {
+			clients_[other].game.reset();
+		}
+	}
+
+	g->game_state->flush_command_log();
+	timers_.cancel(g->turn_timer);
+	g->turn_timer = 0;
+	games_.erase(g->id);
+	matchmaking_.remove(g->id);
+	lobby_changed(g->id);
 }
 
 void server::send_msg(socket_ptr socket, const std::string& msg)
 {
 	const socket_info& info = connections_[socket];
-	std::string header;
+
+	std::string compressed;
+	const std::string* body = &msg;
+	if(info.accepts_gzip && msg.size() >= CompressThreshold) {
+		compressor_.compress(msg.data(), msg.size(), compressed);
+		bytes_before_compression.add(msg.size());
+		bytes_after_compression.add(compressed.size());
+		body = &compressed;
+	}
+
+	boost::shared_ptr<std::string> str_buf(new std::string);
 	if(info.ajax_connection) {
 		char buf[4096];
-		sprintf(buf, "HTTP/1.1 200 OK\nDate: Tue, 20 Sep 2011 21:00:00 GMT\nConnection: close\nServer: Wizard/1.0\nAccept-Ranges: bytes\nContent-Type: text/xml\nContent-Length: %d\nLast-Modified: Tue, 20 Sep 2011 10:00:00 GMT\n\n", msg.size());
-		header = buf;
+		sprintf(buf, "HTTP/1.1 200 OK\nDate: Tue, 20 Sep 2011 21:00:00 GMT\nConnection: close\nServer: Wizard/1.0\nAccept-Ranges: bytes\nContent-Type: text/xml\n%sContent-Length: %d\nLast-Modified: Tue, 20 Sep 2011 10:00:00 GMT\n\n", body == &compressed ? "Content-Encoding: gzip\n" : "", int(body->size()));
+		*str_buf = buf;
 	}
 
-	boost::shared_ptr<std::string> str_buf(new std::string(header.empty() ? msg : (header + msg)));
+	*str_buf += *body;
 	boost::asio::async_write(*socket, boost::asio::buffer(*str_buf),
 			                         boost::bind(&server::handle_send, this, socket, _1, _2, str_buf));
-	std::cerr << "SEND MSG: " << *str_buf << "\n";
+	LOG_DEBUG_FIELDS(logging::fields().nick(info.nick), "send: " << msg);
 }
 
 void server::handle_send(socket_ptr socket, const boost::system::error_code& e, size_t nbytes, boost::shared_ptr<std::string> buf)
 {
+	bytes_sent.add(nbytes);
 	if(e) {
 		disconnect(socket);
 	}
 }
 
-void server::disconnect(socket_ptr socket)
+void server::write_stats(std::string& out) const
 {
-	waiting_connections_.erase(socket);
-	connections_.erase(socket);
-}
-
-void server::heartbeat()
-{
-	const bool send_heartbeat = nheartbeat_++%10 == 0;
+	metrics::write_gauge_header(out, "wizard_connections", "Open connections to the game listener.");
+	metrics::write_gauge(out, "wizard_connections", connections_.size());
+	metrics::write_gauge_header(out, "wizard_waiting_connections", "Connections waiting for a message to send.");
+	metrics::write_gauge(out, "wizard_waiting_connections", waiting_connections_.size());
+	metrics::write_gauge_header(out, "wizard_timers", "Timers waiting to run, such as long polls and turn clocks.");
+	metrics::write_gauge(out, "wizard_timers", timers_.size());
+	metrics::write_gauge_header(out, "wizard_clients", "Clients known to the server.");
+	metrics::write_gauge(out, "wizard_clients", clients_.size());
+	metrics::write_gauge_header(out, "wizard_lobby_clients", "Clients in the lobby, who are sent changes to it.");
+	metrics::write_gauge(out, "wizard_lobby_clients", lobby_clients_.size());
+
+	int active_games = 0;
+	for(std::map<int, game_info_ptr>::const_iterator i = games_.begin(); i != games_.end(); ++i) {
+		if(i->second->game_state->started()) {
+			++active_games;
+		}
+	}
 
-	std::vector<socket_ptr> disconnect_sockets;
+	metrics::write_gauge_header(out, "wizard_games", "Games on the server, by state.");
+	metrics::write_gauge(out, "wizard_games", "state", "started", active_games);
+	metrics::write_gauge(out, "wizard_games", "state", "waiting", games_.size() - active_games);
+	metrics::write_gauge_header(out, "wizard_open_games", "Games with seats which players can be matched to.");
+	metrics::write_gauge(out, "wizard_open_games", matchmaking_.size());
+
+	//the stats page is open to anyone, so queues are summed rather than
+	//reported for each nick.
+	size_t queued = 0, max_queued = 0;
+	for(std::map<std::string, client_info>::const_iterator i = clients_.begin(); i != clients_.end(); ++i) {
+		queued += i->second.msg_queue.size();
+		max_queued = std::max(max_queued, i->second.msg_queue.size());
+	}
 
-	for(std::map<socket_ptr, std::string>::iterator i = waiting_connections_.begin(); i != waiting_connections_.end(); ++i) {
-		socket_ptr socket = i->first;
+	metrics::write_gauge_header(out, "wizard_queued_messages", "Messages queued for clients.");
+	metrics::write_gauge(out, "wizard_queued_messages", queued);
+	metrics::write_gauge_header(out, "wizard_max_client_queue_depth", "Messages queued for the client with the most.");
+	metrics::write_gauge(out, "wizard_max_client_queue_depth", max_queued);
+}
 
-		socket_info& info = connections_[socket];
-		client_info& cli_info = clients_[info.nick];
-		if(cli_info.msg_queue.empty() == false) {
-			send_msg(socket, cli_info.msg_queue.front());
-			cli_info.msg_queue.pop_front();
-			disconnect_sockets.push_back(socket);
-		} else if(send_heartbeat) {
-			send_msg(socket, "<heartbeat/>");
-			disconnect_sockets.push_back(socket);
+void server::disconnect(socket_ptr socket)
+{
+	std::map<socket_ptr, socket_info>::iterator i = connections_.find(socket);
+	if(i != connections_.end()) {
+		timers_.cancel(i->second.wait_timer);
+		timers_.cancel(i->second.idle_timer);
+
+		std::map<std::string, client_info>::iterator cli = clients_.find(i->second.nick);
+		if(cli != clients_.end() && cli->second.waiting == socket) {
+			cli->second.waiting.reset();
 		}
-	}
 
-	foreach(const socket_ptr& socket, disconnect_sockets) {
-		disconnect(socket);
-		socket->close();
+		connections_.erase(i);
 	}
 
-	if(nheartbeat_ >= scheduled_write_) {
-		//write out the game recorded data.
-		wml::node_ptr node(new wml::node("server"));
-		for(std::map<std::string, player_info_ptr>::const_iterator i = player_info_.begin(); i != player_info_.end(); ++i) {
-			if(i->second) {
-				node->add_child(i->second->write());
-			}
-		}
+	waiting_connections_.erase(socket);
+}
 
-		sys::write_file("/tmp/wizard-server.xml", wml::output_xml(node));
-		sys::move_file("/tmp/wizard-server.xml", "./wizard-server-data.xml");
+void server::tick()
+{
+	timers_.tick();
+	deliver_queued();
+
+	//keep to the schedule, however long the tick took.
+	timer_.expires_at(timer_.expires_at() + boost::posix_time::milliseconds(TickMs));
+	timer_.async_wait(boost::bind(&server::tick, this));
+}
+
+void server::compact_journal()
+{
+	if(journal_.needs_compaction()) {
+		journal_.compact(player_info_);
 	}
 
-	timer_.expires_from_now(boost::posix_time::seconds(1));
-	timer_.async_wait(boost::bind(&server::heartbeat, this));
+	timers_.schedule(JournalCompactionIntervalMs, boost::bind(&server::compact_journal, this));
 }
 
-void server::adopt_ajax_socket(socket_ptr socket, const std::string& nick, const std::vector<char>& msg)
+void server::adopt_ajax_socket(socket_ptr socket, const std::string& nick, const std::vector<char>& msg, bool accepts_gzip)
 {
 	socket_info& info = connections_[socket];
 	info.ajax_connection = true;
+	info.accepts_gzip = accepts_gzip;
 	info.nick = nick;
+	watch_idle(socket);
 	
 	handle_message(socket, msg);
 }
 
 void server::create_lobby_msg(std::string& msg)
 {
-	msg += "<lobby>";
-	foreach(game_info_ptr g, games_) {
-		msg += "<game started=\"";
-		msg += g->game_state->started() ? "yes" : "no";
-		msg += "\" clients=\"";
-		bool first_time = true;
-		foreach(const std::string& client, g->clients) {
-			if(!first_time) {
-				msg += ",";
-			} else {
-				first_time = false;
-			}
-			msg += client;
+	msg += formatter() << "<lobby version=\"" << lobby_version_ << "\">";
+	for(std::map<int, game_info_ptr>::const_iterator i = games_.begin(); i != games_.end(); ++i) {
+		write_lobby_game(msg, *i->second);
+	}
+	msg += "</lobby>";
+}
+
+void server::write_lobby_game(std::string& msg, const game_info& g)
+{
+	msg += formatter() << "<game id=\"" << g.id << "\" started=\"";
+	msg += g.game_state->started() ? "yes" : "no";
+	msg += "\" clients=\"";
+	bool first_time = true;
+	foreach(const std::string& client, g.clients) {
+		if(!first_time) {
+			msg += ",";
+		} else {
+			first_time = false;
 		}
+		msg += client;
+	}
+
+	msg += "\"/>";
+}
 
-		msg += "\"/>";
+void server::lobby_changed(int game_id)
+{
+	if(lobby_changes_.empty()) {
+		timers_.schedule(LobbyUpdateIntervalMs, boost::bind(&server::send_lobby_changes, this));
 	}
-	msg += "</lobby>";
+
+	lobby_changes_.insert(game_id);
 }
 
-void server::send_lobby_msg()
+void server::send_lobby_changes()
 {
-	std::string msg;
-	create_lobby_msg(msg);
-	for(std::map<std::string, client_info>::const_iterator i = clients_.begin();
-	    i != clients_.end(); ++i){
-		queue_msg(i->first, msg);
+	//a client not heard from for as long as a connection may stay idle
+	//has most likely closed the page, so it's taken out of the lobby,
+	//along with everything queued for it. If it comes back it enters the
+	//lobby again.
+	const int64_t now = metrics::get_time_micros();
+	for(std::set<std::string>::iterator i = lobby_clients_.begin(); i != lobby_clients_.end(); ) {
+		client_info& cli_info = clients_[*i];
+		if(!cli_info.waiting && now - cli_info.last_seen >= int64_t(IdleTimeoutMs)*1000) {
+			cli_info.msg_queue.clear();
+			lobby_clients_.erase(i++);
+		} else {
+			++i;
+		}
+	}
+
+	if(lobby_clients_.empty()) {
+		lobby_changes_.clear();
+		return;
+	}
+
+	//a game which is still around has been added or changed; the client
+	//replaces whatever it had with the same id.
+	std::string msg = formatter() << "<lobby_update version=\"" << ++lobby_version_ << "\">";
+	foreach(int game_id, lobby_changes_) {
+		std::map<int, game_info_ptr>::const_iterator i = games_.find(game_id);
+		if(i != games_.end()) {
+			write_lobby_game(msg, *i->second);
+		} else {
+			msg += formatter() << "<remove_game id=\"" << game_id << "\"/>";
+		}
+	}
+	msg += "</lobby_update>";
+
+	lobby_changes_.clear();
+
+	foreach(const std::string& nick, lobby_clients_) {
+		queue_msg(nick, msg);
 	}
 }
 
@@ -425,12 +761,3 @@ player_info_ptr server::get_player_info(const std::string& id)
 
 	return p;
 }
-
-void server::schedule_write()
-{
-	if(scheduled_write_) {
-		return;
-	}
-
-	scheduled_write_ = nheartbeat_ + 10;
-}
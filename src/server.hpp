@@ -2,15 +2,21 @@
 #define SERVER_HPP_INCLUDED
 
 #include "game.hpp"
+#include "gzip.hpp"
+#include "matchmaking_queue.hpp"
 #include "player_info.hpp"
+#include "player_info_journal.hpp"
+#include "timer_wheel.hpp"
 #include "tinyxml.h"
 
 #include <deque>
 #include <map>
+#include <set>
 #include <vector>
 
 #include <boost/array.hpp>
 #include <boost/asio.hpp>
+#include <boost/weak_ptr.hpp>
 
 typedef boost::shared_ptr<boost::asio::ip::tcp::socket> socket_ptr;
 typedef boost::shared_ptr<boost::array<char, 1024> > buffer_ptr;
@@ -22,7 +28,11 @@ public:
 	 
 	void run();
 
-	void adopt_ajax_socket(socket_ptr socket, const std::string& nick, const std::vector<char>& msg);
+	void adopt_ajax_socket(socket_ptr socket, const std::string& nick, const std::vector<char>& msg, bool accepts_gzip);
+
+	//appends gauges describing the server's current state, in the same
+	//format as metrics::write_stats().
+	void write_stats(std::string& out) const;
 private:
 	void start_accept();
 	void handle_accept(socket_ptr socket, const boost::system::error_code& error);
@@ -40,51 +50,134 @@ private:
 
 	void disconnect(socket_ptr socket);
 
-	void heartbeat();
+	//drives the timer wheel; runs every tick for as long as the server
+	//does.
+	void tick();
 
 	boost::asio::ip::tcp::acceptor acceptor_;
 
 	boost::asio::deadline_timer timer_;
 
+	//every timeout the server has, from long polls to turn clocks.
+	timer_wheel timers_;
+
 	struct game_info {
 		game_info();
+		int id;
 		boost::intrusive_ptr<game> game_state;
 		std::vector<std::string> clients;
+
+		//whether the lobby has been told the game started.
+		bool started;
+
+		//the turn and player the turn clock was started for, and the
+		//timer which will end their turn for them.
+		int clock_turn, clock_player;
+		timer_wheel::timer_id turn_timer;
+
+		//turns in a row which ran out of time. Once every player has
+		//let one go by, the game is taken to be abandoned and the clock
+		//is stopped.
+		int missed_turns;
 	};
 
 	typedef boost::shared_ptr<game_info> game_info_ptr;
+	typedef boost::weak_ptr<game_info> game_info_weak_ptr;
 
 	struct socket_info {
-		socket_info() : ajax_connection(false) {}
+		socket_info() : ajax_connection(false), accepts_gzip(false), last_activity(0), wait_timer(0), idle_timer(0) {}
 		std::vector<char> partial_message;
 		std::string nick;
 		bool ajax_connection;
+
+		//set if the client said it can take gzip compressed replies;
+		//in the Accept-Encoding header for ajax connections, or with
+		//compress="gzip" when logging in otherwise.
+		bool accepts_gzip;
+
+		//when data was last received, in microseconds, and the timer
+		//which disconnects the socket if it goes quiet.
+		int64_t last_activity;
+
+		timer_wheel::timer_id wait_timer, idle_timer;
 	};
 
 	struct client_info {
+		client_info() : nplayer(0), last_seen(0) {}
 		game_info_ptr game;
 		int nplayer;
 
+		//when a message last came from the client, in microseconds.
+		int64_t last_seen;
+
 		std::deque<std::string> msg_queue;
+
+		//the connection waiting for the next message to the client, if
+		//there is one.
+		socket_ptr waiting;
 	};
 
 	void queue_msg(const std::string& nick, const std::string& msg);
 
+	//sends the next queued message to each client which was queued a
+	//message while it had a connection waiting.
+	void deliver_queued();
+	std::set<std::string> deliveries_;
+
+	void watch_idle(socket_ptr socket);
+	void check_idle(socket_ptr socket);
+	void wait_expired(socket_ptr socket);
+
+	//hands a message to the game and sends what it says to its clients.
+	void handle_game_message(const game_info_ptr& g, int nplayer, const TiXmlElement& node);
+	void update_turn_clock(const game_info_ptr& g);
+	void turn_expired(game_info_weak_ptr g, int nplayer);
+
+	void compact_journal();
+	void flush_command_logs();
+
+	//takes the player out of the game they're in, if any. The game is
+	//taken off the lobby once nobody is left in it, or if its host leaves
+	//before it starts.
+	void leave_game(const std::string& nick);
+
+	//the whole lobby, for a client entering it.
 	void create_lobby_msg(std::string& str);
-	void send_lobby_msg();
+	void write_lobby_game(std::string& str, const game_info& g);
+
+	//records that the game has been added, changed or removed, for the
+	//next update sent to clients in the lobby.
+	void lobby_changed(int game_id);
+	void send_lobby_changes();
 
 	std::map<socket_ptr, std::string> waiting_connections_;
 
 	std::map<socket_ptr, socket_info> connections_;
 	std::map<std::string, client_info> clients_;
-	std::vector<game_info_ptr> games_;
+
+	//clients who are in the lobby rather than in a game, and so are sent
+	//changes to it.
+	std::set<std::string> lobby_clients_;
+
+	//games which have changed since the last update sent to the lobby.
+	//Every update increments the version.
+	std::set<int> lobby_changes_;
+	int lobby_version_;
+
+	//games in the lobby by id, which is the order they were created in.
+	std::map<int, game_info_ptr> games_;
+
+	//the games in the lobby which haven't started and have seats free.
+	matchmaking_queue matchmaking_;
 
 	std::map<std::string, player_info_ptr> player_info_;
 	player_info_ptr get_player_info(const std::string& id);
 
-	int nheartbeat_;
-	int scheduled_write_;
-	void schedule_write();
+	player_info_journal journal_;
+
+	gzip::compressor compressor_;
+
+	int ngames_created_;
 };
 
 #endif
@@ -1,17 +1,48 @@
 #include <iostream>
 
 #include "filesystem.hpp"
+#include "logging.hpp"
 #include "movement_type.hpp"
 #include "server.hpp"
 #include "terrain.hpp"
+#include "unit_test.hpp"
 #include "web_server.hpp"
 #include "wml_parser.hpp"
 
-int main()
+int main(int argc, char** argv)
 {
+	std::string utility_program;
+	std::vector<std::string> util_args;
+	for(int n = 0; n != argc; ++n) {
+		std::string arg(argv[n]);
+		if(arg == "--utility" && n + 1 != argc) {
+			++n;
+			utility_program = argv[n];
+			for(++n; n < argc; ++n) {
+				const std::string arg(argv[n]);
+				util_args.push_back(arg);
+			}
+
+			break;
+		} else if(arg == "--log-level" && n + 1 != argc) {
+			++n;
+			if(!logging::set_level(argv[n])) {
+				std::cerr << "unknown log level: " << argv[n] << "\n";
+				return -1;
+			}
+		}
+	}
+
 	terrain::init(wml::parse_wml_from_file("data/terrain.xml"));
 	movement_type::init(wml::parse_wml_from_file("data/move.xml"));
 
+	if(utility_program.empty() == false) {
+		test::run_utility(utility_program, util_args);
+		return 0;
+	}
+
+	const logging::manager log_manager;
+
 	boost::asio::io_service io_service;
 	server s(io_service);
 	web_server ws(io_service, s);
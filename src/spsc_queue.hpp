@@ -0,0 +1,62 @@
+#ifndef SPSC_QUEUE_HPP_INCLUDED
+#define SPSC_QUEUE_HPP_INCLUDED
+
+#include <vector>
+
+//a bounded queue for handing items from one thread to another without
+//locks. Only one thread may push, and only one other thread may pop.
+//Each index is written by one side and read by the other, so a barrier
+//before moving an index is all it takes to publish the slot it covers.
+template<typename T>
+class spsc_queue
+{
+public:
+	//the capacity must be a power of two.
+	explicit spsc_queue(unsigned int capacity)
+	  : items_(capacity), head_(0), tail_(0)
+	{}
+
+	//returns false, leaving the queue as it was, if it's full.
+	bool push(const T& item) {
+		const unsigned int tail = tail_;
+		if(tail - head_ == items_.size()) {
+			return false;
+		}
+
+		items_[tail&(items_.size()-1)] = item;
+		__sync_synchronize();
+		tail_ = tail + 1;
+		return true;
+	}
+
+	bool pop(T& item) {
+		const unsigned int head = head_;
+		if(head == tail_) {
+			return false;
+		}
+
+		__sync_synchronize();
+		T& slot = items_[head&(items_.size()-1)];
+		item = slot;
+
+		//the slot doesn't hold on to anything once it has been popped.
+		slot = T();
+		__sync_synchronize();
+		head_ = head + 1;
+		return true;
+	}
+
+	bool empty() const { return head_ == tail_; }
+
+private:
+	spsc_queue(const spsc_queue&);
+	void operator=(const spsc_queue&);
+
+	std::vector<T> items_;
+
+	//only the popping thread moves head_, and only the pushing thread
+	//moves tail_.
+	volatile unsigned int head_, tail_;
+};
+
+#endif
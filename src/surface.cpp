@@ -17,18 +17,19 @@ namespace graphics
 
 namespace {
 
-	SDL_PixelFormat& get_neutral_pixel_format()
+	SDL_PixelFormat create_neutral_pixel_format()
 	{
-		static bool first_time = true;
-		static SDL_PixelFormat format;
-
-		if(first_time) {
-			first_time = false;
-			surface surf(SDL_CreateRGBSurface(SDL_SWSURFACE,1,1,32,SURFACE_MASK));
-			format = *surf->format;
-			format.palette = NULL;
-		}
+		surface surf(SDL_CreateRGBSurface(SDL_SWSURFACE,1,1,32,SURFACE_MASK));
+		SDL_PixelFormat format = *surf->format;
+		format.palette = NULL;
+		return format;
+	}
 
+	//worker threads clone surfaces too, so this is made in a static
+	//initializer, which only one thread runs.
+	SDL_PixelFormat& get_neutral_pixel_format()
+	{
+		static SDL_PixelFormat format = create_neutral_pixel_format();
 		return format;
 	}
 
@@ -30,6 +30,9 @@ namespace graphics
 struct surface
 {
 private:
+	//neither this nor SDL_FreeSurface() changes the count atomically, so
+	//threads mustn't copy or release the same surface. Worker threads
+	//load surfaces of their own, with surface_cache::get_no_cache().
 	static void sdl_add_ref(SDL_Surface *surf)
 	{
 		if (surf != NULL)
@@ -1,5 +1,16 @@
+#include <stdlib.h>
+
+#include <algorithm>
 #include <iostream>
 #include <map>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include <boost/shared_ptr.hpp>
+
 #include <SDL.h>
 #ifndef SDL_VIDEO_OPENGL_ES
 #include <GL/glew.h>
@@ -29,6 +40,14 @@ cache_map cache;
 typedef std::pair<surface, int> team_color_cache_key;
 typedef std::map<team_color_cache_key, surface> team_color_cache_map;
 team_color_cache_map team_color_cache;
+
+//only guards the cache. Surfaces in it are shared with the main thread,
+//so worker threads don't use it: they color surfaces of their own with
+//create_surface_team_color().
+threading::mutex team_color_mutex;
+
+//guards the color tables, which worker threads share.
+threading::mutex team_color_lut_mutex;
 }
 
 #if 0
@@ -268,41 +287,279 @@ GLuint get_gl_shader(const std::vector<std::string>& vertex_shader_file,
 #endif
 }
 
-surface get_surface_team_color(surface input, int index)
+namespace {
+
+//the colors a team coloring replaces, compiled into an open addressed
+//hash table so that looking up a pixel doesn't mean searching the list.
+class color_lut
 {
-	surface team_color_definition(surface_cache::get("team_color.png"));
-	assert(team_color_definition.get());
+public:
+	color_lut(const Uint32* from, const Uint32* to, int ncolors) : shift_(32)
+	{
+		int size = 1;
+		while(size < ncolors*4) {
+			size *= 2;
+			--shift_;
+		}
 
-	++index;
-	assert(index < team_color_definition->w);
+		//empty slots hold a color which isn't being replaced.
+		empty_ = 0xFFFFFFFF;
+		while(std::find(from, from + ncolors, empty_) != from + ncolors) {
+			--empty_;
+		}
 
-	team_color_cache_key key(input, index);
-	surface& surf = team_color_cache[key];
-	if(surf.get() != NULL) {
-		return surf;
+		keys_.assign(size, empty_);
+		values_.resize(size);
+
+		//if a color is listed twice, the first one counts.
+		for(int n = ncolors - 1; n >= 0; --n) {
+			const int i = slot(from[n]);
+			keys_[i] = from[n];
+			values_[i] = to[n];
+		}
 	}
 
-	surf = input.clone();
+	//returns false if the color isn't replaced.
+	bool lookup(Uint32 color, Uint32* result) const {
+		const int i = slot(color);
+		if(keys_[i] == empty_) {
+			return false;
+		}
+
+		*result = values_[i];
+		return true;
+	}
 
-	Uint32* src_range = reinterpret_cast<Uint32*>(team_color_definition->pixels);
-	Uint32* end_src_range = src_range + team_color_definition->w;
+private:
+	int slot(Uint32 color) const {
+		int i = shift_ == 32 ? 0 : (color*2654435761U) >> shift_;
+		while(keys_[i] != color && keys_[i] != empty_) {
+			i = (i + 1)&(keys_.size() - 1);
+		}
 
-	for(Uint32* src = src_range; src != end_src_range; ++src) {
-		*src &= ~surf->format->Amask;
+		return i;
 	}
 
-	const Uint32* dst_range = src_range + team_color_definition->w*index;
+	int shift_;
+	Uint32 empty_;
+	std::vector<Uint32> keys_, values_;
+};
 
-	Uint32* pixels = reinterpret_cast<Uint32*>(surf->pixels);
-	Uint32* end_pixels = pixels + surf->w*surf->h;
-	while(pixels != end_pixels) {
-		const Uint32* tc_pixel = std::find(src_range, end_src_range, *pixels & ~surf->format->Amask);
-		if(tc_pixel != end_src_range) {
-			const int i = tc_pixel - src_range;
-			*pixels = (dst_range[i] & ~surf->format->Amask) + (*pixels & surf->format->Amask);
+//replaces the color of each pixel which is in the table, keeping its
+//alpha. Sprite sheets are mostly long runs of one color, so the last
+//lookup is remembered, and runs of it are done four pixels at a time.
+void remap_colors(Uint32* pixels, int w, int h, int pitch, Uint32 alpha_mask, const color_lut& lut)
+{
+	//what the last color becomes, which is itself if it isn't replaced.
+	Uint32 last = 0;
+	Uint32 last_result = 0;
+	bool last_mapped = lut.lookup(last, &last_result);
+	last_result = last_mapped ? last_result & ~alpha_mask : last;
+
+	for(int y = 0; y != h; ++y) {
+		Uint32* p = pixels + y*pitch;
+		Uint32* const end = p + w;
+		while(p != end) {
+			const Uint32 color = *p & ~alpha_mask;
+			if(color != last) {
+				last = color;
+				last_mapped = lut.lookup(color, &last_result);
+				last_result = last_mapped ? last_result & ~alpha_mask : color;
+			}
+
+			*p = last_result | (*p & alpha_mask);
+			++p;
+
+#if defined(__SSE2__)
+			if(end - p < 4 || (*p & ~alpha_mask) != last) {
+				continue;
+			}
+
+			//a run has started, so do the rest of it four at a time.
+			const __m128i color_mask = _mm_set1_epi32(~alpha_mask);
+			const __m128i last_color = _mm_set1_epi32(last);
+			const __m128i result = _mm_set1_epi32(last_result);
+			do {
+				const __m128i px = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+				if(_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(px, color_mask), last_color)) != 0xFFFF) {
+					break;
+				}
+
+				if(last_mapped) {
+					_mm_storeu_si128(reinterpret_cast<__m128i*>(p), _mm_or_si128(result, _mm_andnot_si128(color_mask, px)));
+				}
+
+				p += 4;
+			} while(end - p >= 4);
+#endif
 		}
-		++pixels;
+	}
+}
+
+//tables are built once for each team color, and shared by every surface
+//colored for that team.
+typedef std::map<std::pair<int, Uint32>, boost::shared_ptr<const color_lut> > color_lut_map;
+color_lut_map team_color_luts;
+
+//tables are never removed, so a reference to one stays good once the
+//lock is released.
+const color_lut& get_team_color_lut(int index, Uint32 alpha_mask)
+{
+	threading::lock lck(team_color_lut_mutex);
+	boost::shared_ptr<const color_lut>& lut = team_color_luts[std::make_pair(index, alpha_mask)];
+	if(!lut) {
+		//loaded privately, as the cached surface is the main thread's.
+		surface team_color_definition(surface_cache::get_no_cache("team_color.png"));
+		assert(team_color_definition.get());
+		assert(index < team_color_definition->h);
+
+		const Uint32* definition = reinterpret_cast<const Uint32*>(team_color_definition->pixels);
+		const int pitch = team_color_definition->pitch/4;
+		std::vector<Uint32> from(definition, definition + team_color_definition->w);
+		foreach(Uint32& color, from) {
+			color &= ~alpha_mask;
+		}
+
+		lut.reset(new color_lut(&from[0], definition + pitch*index, from.size()));
 	}
 
+	return *lut;
+}
+
+}
+
+int num_team_colors()
+{
+	//the first row of the definition holds the colors which are replaced,
+	//and each row after it holds one team's colors.
+	const surface team_color_definition(surface_cache::get_no_cache("team_color.png"));
+	return team_color_definition.get() ? team_color_definition->h - 1 : 0;
+}
+
+surface create_surface_team_color(surface input, int index)
+{
+	++index;
+
+	surface surf = input.clone();
+	remap_colors(reinterpret_cast<Uint32*>(surf->pixels), surf->w, surf->h, surf->pitch/4,
+	             surf->format->Amask, get_team_color_lut(index, surf->format->Amask));
 	return surf;
 }
+
+surface get_surface_team_color(surface input, int index)
+{
+	const team_color_cache_key key(input, index);
+	{
+		threading::lock lck(team_color_mutex);
+		const team_color_cache_map::const_iterator i = team_color_cache.find(key);
+		if(i != team_color_cache.end()) {
+			return i->second;
+		}
+	}
+
+	//colored without the lock held. If another thread colors the same
+	//surface meanwhile, the first one into the cache is used.
+	const surface surf = create_surface_team_color(input, index);
+
+	threading::lock lck(team_color_mutex);
+	return team_color_cache.insert(std::make_pair(key, surf)).first->second;
+}
+
+namespace {
+
+//the team coloring as it was done before it used a color_lut.
+void remap_colors_by_search(Uint32* pixels, int npixels, Uint32 alpha_mask, const Uint32* from, const Uint32* to, int ncolors)
+{
+	for(Uint32* p = pixels; p != pixels + npixels; ++p) {
+		const Uint32* i = std::find(from, from + ncolors, *p & ~alpha_mask);
+		if(i != from + ncolors) {
+			*p = (to[i - from] & ~alpha_mask) + (*p & alpha_mask);
+		}
+	}
+}
+
+//an image like a sprite sheet: short runs of detail between longer runs
+//of background, in colors some of which are team colors, with varying
+//alpha.
+std::vector<Uint32> test_image(int npixels, const Uint32* colors, int ncolors)
+{
+	std::vector<Uint32> pixels;
+	while(pixels.size() < npixels) {
+		const Uint32 color = colors[rand()%ncolors] | (rand()%4 ? 0xFF000000 : (rand()%256) << 24);
+		pixels.resize(std::min<int>(npixels, pixels.size() + 1 + rand()%(rand()%2 ? 3 : 64)), color);
+	}
+
+	return pixels;
+}
+
+}
+
+UNIT_TEST(team_color_lut) {
+	const Uint32 AlphaMask = 0xFF000000;
+	Uint32 from[19], to[19];
+	for(int n = 0; n != 19; ++n) {
+		from[n] = (rand()&0xFFFFFF) | (n%3 << 24);
+		to[n] = rand();
+	}
+
+	from[7] = from[3] & ~AlphaMask;
+	from[8] = 0;
+
+	//the colors of the image are a mixture of team colors and others.
+	Uint32 colors[40];
+	for(int n = 0; n != 40; ++n) {
+		colors[n] = n < 19 ? from[n] & ~AlphaMask : rand()&0xFFFFFF;
+	}
+
+	std::vector<Uint32> masked(from, from + 19);
+	foreach(Uint32& color, masked) {
+		color &= ~AlphaMask;
+	}
+
+	const color_lut lut(&masked[0], to, masked.size());
+	for(int w = 1; w < 40; w += 3) {
+		const int h = 5;
+		const int pitch = w + 3;
+		std::vector<Uint32> expected = test_image(pitch*h, colors, 40);
+		std::vector<Uint32> result = expected;
+		for(int y = 0; y != h; ++y) {
+			remap_colors_by_search(&expected[y*pitch], w, AlphaMask, &masked[0], to, masked.size());
+		}
+
+		remap_colors(&result[0], w, h, pitch, AlphaMask, lut);
+		for(int n = 0; n != expected.size(); ++n) {
+			CHECK(result[n] == expected[n], "pixel " << n << " of " << w << "x" << h << " image: " << result[n] << " != " << expected[n]);
+		}
+	}
+}
+
+BENCHMARK_ARG(team_color_remap, const std::string& method)
+{
+	const Uint32 AlphaMask = 0xFF000000;
+	Uint32 from[19], to[19];
+	for(int n = 0; n != 19; ++n) {
+		from[n] = rand()&0xFFFFFF;
+		to[n] = rand();
+	}
+
+	Uint32 colors[40];
+	for(int n = 0; n != 40; ++n) {
+		colors[n] = n < 19 ? from[n] : rand()&0xFFFFFF;
+	}
+
+	const int npixels = 512*512;
+	const std::vector<Uint32> image = test_image(npixels, colors, 40);
+	std::vector<Uint32> pixels;
+	const color_lut lut(from, to, 19);
+	test::set_benchmark_items(npixels, "pixels");
+	BENCHMARK_LOOP {
+		pixels = image;
+		if(method == "search") {
+			remap_colors_by_search(&pixels[0], npixels, AlphaMask, from, to, 19);
+		} else {
+			remap_colors(&pixels[0], 512, 512, 512, AlphaMask, lut);
+		}
+	}
+}
+
+BENCHMARK_ARG_CALL_COMMAND_LINE(team_color_remap);
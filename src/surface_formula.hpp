@@ -13,6 +13,15 @@ graphics::surface get_surface_formula(graphics::surface input, const std::string
 GLuint get_gl_shader(const std::vector<std::string>& vertex_shader,
                      const std::vector<std::string>& fragment_shader);
 
+//how many teams there are colors for in team_color.png.
+int num_team_colors();
+
+//colors a surface for a team, caching the result by the surface it was
+//made from. The cache shares surfaces, so this is for the main thread.
 graphics::surface get_surface_team_color(graphics::surface input, int color_index);
 
+//colors a new copy of a surface for a team, without caching it. Worker
+//threads may call this with surfaces no other thread uses.
+graphics::surface create_surface_team_color(graphics::surface input, int color_index);
+
 #endif
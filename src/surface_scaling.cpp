@@ -1,6 +1,12 @@
 #include <inttypes.h>
 #include <iostream>
 #include <cassert>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #include "surface_cache.hpp"
 #include "surface.hpp"
@@ -48,253 +54,368 @@ int calculate_difference(uint32_t sourcePixelOne, uint32_t sourcePixelTwo, uint3
 	return ((sourcePixelOne != sourcePixelThree || sourcePixelOne != sourcePixelFour) - (sourcePixelTwo != sourcePixelThree || sourcePixelTwo != sourcePixelFour));
 }
 
-	
-	
-	
+namespace {
+
+//Both scalers write each input pixel out as a 2x2 block, so they work a
+//row at a time: a row of the input becomes the two output rows 'top' and
+//'bottom'. Pixels too near the edge to have the neighbours an algorithm
+//looks at are scaled with nearest neighbour in a separate pass, so the
+//inner loops never need to check where they are.
+
+//the SSE2 loops can be turned off, leaving the plain loops, which are
+//the reference the SSE2 ones must match exactly.
+bool use_sse2 = true;
+
+#if defined(__SSE2__)
+inline __m128i load4(const uint32_t* p)
+{
+	return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+}
+
+inline void store4(uint32_t* p, __m128i v)
+{
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(p), v);
+}
+
+//the corner where it matches both its neighbours, otherwise the center.
+inline __m128i eagle_select(__m128i corner, __m128i a, __m128i b, __m128i center)
+{
+	const __m128i mask = _mm_and_si128(_mm_cmpeq_epi32(corner, a), _mm_cmpeq_epi32(corner, b));
+	return _mm_or_si128(_mm_and_si128(mask, corner), _mm_andnot_si128(mask, center));
+}
+#endif
+
+//nearest neighbour for the pixels in [begin, end) of a row.
+void scale_row_nearest(const uint32_t* in, uint32_t* top, uint32_t* bottom, int begin, int end)
+{
+	int x = begin;
+#if defined(__SSE2__)
+	for(; use_sse2 && x + 4 <= end; x += 4) {
+		const __m128i c = load4(in + x);
+		const __m128i lo = _mm_unpacklo_epi32(c, c);
+		const __m128i hi = _mm_unpackhi_epi32(c, c);
+		store4(top + x*2, lo);
+		store4(top + x*2 + 4, hi);
+		store4(bottom + x*2, lo);
+		store4(bottom + x*2 + 4, hi);
+	}
+#endif
+
+	for(; x < end; ++x) {
+		top[x*2] = top[x*2 + 1] = bottom[x*2] = bottom[x*2 + 1] = in[x];
+	}
+}
+
+// Eagle is a pixel art scaling algorithm designed to smooth rough edges.  It works as follows:  First, it doubles the scale of the art, turning every source pixel into four destination pixels, just like nearest neighbor scaling would.
+
+// Then, to smooth things out, it conditionally alters each of these four pixels.  Each of the four destination pixels represents a quadrant of the source pixel, and likewise a direction pointing away from the center of the source pixel.  To choose if it 'smoothes an edge" in a given direction, it checks additional, adjacent source pixels in the direction represented by the quadrant.  If they're all the same color, it represents a diagonal slope of pixels, and the given quadrant pixel is filled in with the same color to smooth out the diagonal.
+
+// The following diagram illustrates first the scaling of a single input pixel into 4 output pixels (left side of diagram), and then the choices made to choose which color the output pixels are given (right side of diagram)
+
+//   first:        |Then
+//   . . . --\ CC  |S T U  --\ 1 2
+//   . C . --/ CC  |V C W  --/ 3 4
+//   . . .         |X Y Z
+//                 | IF V==S==T => 1=S
+//                 | IF T==U==W => 2=U
+//                 | IF V==X==Y => 3=X
+//                 | IF W==Z==Y => 4=Z
+
+//Eagle for the pixels in [begin, end) of a row which has rows above and
+//below it, and a pixel either side of every pixel in the range.
+void scale_row_eagle(const uint32_t* up, const uint32_t* in, const uint32_t* down, uint32_t* top, uint32_t* bottom, int begin, int end)
+{
+	int x = begin;
+#if defined(__SSE2__)
+	//four pixels at a time: each comparison gives a mask per pixel, which
+	//picks between the diagonal neighbour and the pixel itself.
+	for(; use_sse2 && x + 4 <= end; x += 4) {
+		const __m128i up_left = load4(up + x - 1), up_mid = load4(up + x), up_right = load4(up + x + 1);
+		const __m128i left = load4(in + x - 1), center = load4(in + x), right = load4(in + x + 1);
+		const __m128i down_left = load4(down + x - 1), down_mid = load4(down + x), down_right = load4(down + x + 1);
+
+		const __m128i q1 = eagle_select(up_left, up_mid, left, center);
+		const __m128i q2 = eagle_select(up_right, up_mid, right, center);
+		const __m128i q3 = eagle_select(down_left, down_mid, left, center);
+		const __m128i q4 = eagle_select(down_right, down_mid, right, center);
+
+		store4(top + x*2, _mm_unpacklo_epi32(q1, q2));
+		store4(top + x*2 + 4, _mm_unpackhi_epi32(q1, q2));
+		store4(bottom + x*2, _mm_unpacklo_epi32(q3, q4));
+		store4(bottom + x*2 + 4, _mm_unpackhi_epi32(q3, q4));
+	}
+#endif
+
+	for(; x < end; ++x) {
+		const uint32_t c = in[x];
+		top[x*2] = (up[x-1] == up[x] && up[x-1] == in[x-1]) ? up[x-1] : c;
+		top[x*2 + 1] = (up[x+1] == up[x] && up[x+1] == in[x+1]) ? up[x+1] : c;
+		bottom[x*2] = (down[x-1] == down[x] && down[x-1] == in[x-1]) ? down[x-1] : c;
+		bottom[x*2 + 1] = (down[x+1] == down[x] && down[x+1] == in[x+1]) ? down[x+1] : c;
+	}
+}
+
+//  2xSai works on a square group of sixteen pixels, rather than the square group of nine that Eagle works on.  In Eagle, the current pixel being upsized is the one in the middle of this square of nine; in 2xSai, the current pixel is the one in the upper-left of the middle four.  The other pixels in this group are all input pixels that are being examined to determine if we have an edge to smooth out.
+
+//  X X X X  |  0  1  2  3
+//  X * X X  |  4  5  6  7
+//  X X X X  |  8  9  10 11
+//  X X X X  |  12 13 14 15
+
+//2xSaI for a single pixel, given the four rows around it, starting with
+//the row above.
+void scale_pixel_2xsai(const uint32_t* const* rows, uint32_t* top, uint32_t* bottom, int x)
+{
+	uint32_t p[4][4]; //[y][x]
+	for(int row = 0; row != 4; ++row) {
+		for(int col = 0; col != 4; ++col) {
+			p[row][col] = rows[row][x - 1 + col];
+		}
+	}
+
+	//these are the four output pixels corresponding to the one input
+	//pixel, which start out as they would be with nearest neighbor.
+	uint32_t ul = p[1][1], ur = p[1][1], ll = p[1][1], lr = p[1][1];
+
+	if ( (p[1][1] == p[2][2]) && (p[1][2] != p[2][1]) ) {
+		if ( ((p[1][1] == p[0][1]) && (p[1][2] == p[2][3])) || ((p[1][1] == p[2][1]) && (p[1][1] == p[0][2]) && (p[1][2] != p[0][1]) && (p[1][2] == p[0][3]))){
+			ur = p[1][1];
+		}else{
+			if( ! ((p[1][1] == p[0][1])) ){
+				ur = interpolate_pixels(p[1][1],p[1][2]);
+			}
+		}
+
+		if ( ((p[1][1] == p[1][0]) && (p[2][1] == p[3][2])) || ((p[1][1] == p[1][2]) && (p[1][1] == p[2][0]) && (p[1][0] != p[2][1]) && (p[2][1] == p[3][0]))){
+			ll = p[1][1];
+		}else{
+			if( ! ((p[1][1] == p[1][0])) ){
+				ll = interpolate_pixels(p[1][1],p[2][1]);
+			}
+		}
+		lr = p[1][1];
+	} else if ( (p[1][2] == p[2][1]) && (p[1][1] != p[2][2]) ) {
+		if ( ((p[1][2] == p[0][2]) && (p[1][1] == p[2][0])) || ((p[1][2] == p[0][1]) && (p[1][2] == p[2][2]) && (p[1][2] != p[0][2]) && (p[1][1] == p[0][0]))){
+			ur = p[1][2];
+		}else{
+			ur = interpolate_pixels(p[1][1],p[1][2]);
+		}
+
+		if ( ((p[2][1] == p[2][0]) && (p[1][1] == p[0][2])) || ((p[2][1] == p[1][0]) && (p[2][1] == p[2][2]) && (p[1][1] != p[2][0]) && (p[1][1] == p[0][0]))){
+			ll = p[2][1];
+		}else{
+			ll = interpolate_pixels(p[1][1],p[2][1]);
+		}
+		lr = p[1][2];
+
+	}else if ( (p[1][1] == p[2][2]) && (p[1][2] == p[2][1]) ) {
+		// these are crossed diagonal pairs of pixels in the inner, center set of four.
+		// if they're the same, then we weight them against a surrounding ring of pixels, and see which
+		// pair is more different from the ring.  The ring is this asterisked set of pixels:
+		//  X * * X
+		//  * X X *
+		//  * X X *
+		//  X * * X
+		if (p[1][1] == p[1][2]){
+			lr = p[1][1];
+			ll = p[1][1];
+			ur = p[1][1];
+			ul = p[1][1];
+
+		} else {
+
+			int difference_direction = 0;
+			ur = interpolate_pixels(p[1][1],p[1][2]);
+			ll = interpolate_pixels(p[1][1],p[2][1]);
+
+			difference_direction += calculate_difference(p[1][2],p[1][1],p[0][1],p[1][0]);
+			difference_direction += calculate_difference(p[1][2],p[1][1],p[0][2],p[1][3]);
+			difference_direction += calculate_difference(p[1][2],p[1][1],p[3][2],p[2][3]);
+			difference_direction += calculate_difference(p[1][2],p[1][1],p[2][0],p[3][1]);
+
+			if (difference_direction > 0){
+				lr = interpolate_pixels(p[1][1],p[1][2],p[1][2],p[1][2]);
+				ur = interpolate_pixels(p[1][1],p[1][2],p[1][2],p[1][2]);
+			}else if(difference_direction < 0){
+				lr = interpolate_pixels(p[1][1],p[1][1],p[1][1],p[1][2]);
+				ur = interpolate_pixels(p[1][1],p[1][1],p[1][1],p[1][2]);
+			}else{
+				lr = interpolate_pixels(p[1][1],p[1][2],p[2][1],p[2][2]);
+				ur = interpolate_pixels(p[1][1],p[1][2],p[2][1],p[2][2]);
+			}
+
+		}
+	} else {
+		if ( ( (p[1][1] != p[2][1]) || (p[1][1] != p[0][1]) ) && ( (p[0][2] == p[1][2]) && (p[1][2] == p[2][2]) ) ){
+			ur = interpolate_pixels(p[1][1],p[1][1],p[1][1],p[1][2]);
+			lr = interpolate_pixels(p[1][1],p[1][1],p[1][1],p[1][2]);
+		}
+
+		if ( ( (p[0][2] == p[1][1]) || (p[1][1] == p[2][0]) ) && ( (p[1][1] != p[2][1]) && (p[1][1] != p[1][2])) ){
+			ur = interpolate_pixels(p[1][1],p[1][1],p[1][1],p[1][2]);
+			ll = interpolate_pixels(p[1][1],p[1][1],p[1][1],p[2][1]);
+			lr = interpolate_pixels(p[1][1],p[1][2],p[1][1],p[2][1]);
+		}
+
+		if ( ((p[1][1] == p[0][0]) && (p[1][1] == p[1][2])) && ( (p[1][1] != p[1][0]) && (p[1][1] != p[2][1]) ) ){
+			ul = interpolate_pixels(p[1][1],p[1][1],p[1][1],p[1][0]);
+			lr = interpolate_pixels(p[1][1],p[1][1],p[1][1],p[2][1]);
+			ll = interpolate_pixels(p[1][0],p[2][1]);
+		}
+
+
+		if ( (p[1][1] == p[2][1]) && (p[1][1] == p[0][2]) && (p[1][2] != p[0][1]) && (p[1][2] == p[0][3]) ){
+			 ur = p[1][1];
+		} else if ( (p[1][2] == p[0][1]) && (p[1][2] == p[2][2]) && (p[1][1] != p[0][2]) && (p[1][1] == p[0][0]) ){
+			 ur = p[1][2];
+		} else {
+			//ur = interpolate_pixels(p[1][1],p[1][2]);
+			//lr = interpolate_pixels(p[1][1],p[1][2]);
+		}
+
+		if ( (p[1][1] == p[1][2]) && (p[1][1] == p[2][0]) && (p[1][0] != p[2][1]) && (p[2][1] == p[3][0]) ){
+			ll = p[1][1];
+		} else if ( (p[2][1] == p[1][0]) && (p[2][1] == p[2][2]) && (p[1][1] != p[2][0]) && (p[1][1] == p[0][0]) ){
+			ll = p[2][1];
+		} else {
+			//lr = interpolate_pixels(p[1][1],p[2][1]);
+			//ll = interpolate_pixels(p[1][1],p[2][1]);
+		}
+		//lr = interpolate_pixels(p[1][1],p[1][2],p[2][1],p[2][2]);
+		//ur = interpolate_pixels(p[1][1],p[1][2],p[2][1],p[2][2]);
+	}
+
+	top[x*2] = ul;
+	top[x*2 + 1] = ur;
+	bottom[x*2] = ll;
+	bottom[x*2 + 1] = lr;
+}
+
+//2xSaI for the pixels in [begin, end) of a row, which must have a row
+//above and two below, and a pixel to the left and two to the right of
+//every pixel in the range.
+void scale_row_2xsai(const uint32_t* const* rows, uint32_t* top, uint32_t* bottom, int begin, int end)
+{
+	int x = begin;
+#if defined(__SSE2__)
+	//where the middle four pixels are all the same colour every branch
+	//leaves the output as nearest neighbor, and that's most of any sprite,
+	//so check four pixels at a time for it and only go through the full
+	//kernel when they aren't.
+	for(; use_sse2 && x + 4 <= end; x += 4) {
+		const __m128i a = load4(rows[1] + x);
+		const __m128i b = load4(rows[1] + x + 1);
+		const __m128i c = load4(rows[2] + x);
+		const __m128i d = load4(rows[2] + x + 1);
+		const __m128i same = _mm_and_si128(_mm_cmpeq_epi32(a, b), _mm_and_si128(_mm_cmpeq_epi32(a, c), _mm_cmpeq_epi32(a, d)));
+		if(_mm_movemask_epi8(same) == 0xFFFF) {
+			scale_row_nearest(rows[1], top, bottom, x, x + 4);
+		} else {
+			for(int n = x; n != x + 4; ++n) {
+				scale_pixel_2xsai(rows, top, bottom, n);
+			}
+		}
+	}
+#endif
+
+	for(; x < end; ++x) {
+		scale_pixel_2xsai(rows, top, bottom, x);
+	}
+}
+
+}
+
 surface scale_surface_eagle(surface input) {
 	surface result(surface::create(input->w*2, input->h*2));
-	
+
+	const int w = input->w, h = input->h;
 	const uint32_t* in = reinterpret_cast<const uint32_t*>(input->pixels);
 	uint32_t* out = reinterpret_cast<uint32_t*>(result->pixels);
-	for(int y = 0; y != input->h; ++y) {
-		for(int x = 0; x != input->w; ++x) {
-			//do nearest neighbor interpolation
-			out[(y*2)*result->w + x*2] = in[y*input->w + x];
-			out[(y*2 + 1)*result->w + x*2] = in[y*input->w + x];
-			out[(y*2 + 1)*result->w + x*2 + 1] = in[y*input->w + x];
-			out[(y*2)*result->w + x*2 + 1] = in[y*input->w + x];
-			
-			if ((y > 0) && (y < input->h - 1) && (x > 0) && (x < input->w - 1)){
-				//do additional eagle interpolation
-				
-				// Eagle is a pixel art scaling algorithm designed to smooth rough edges.  It works as follows:  First, it doubles the scale of the art, turning every source pixel into four destination pixels, just like nearest neighbor scaling would.
-				
-				// Then, to smooth things out, it conditionally alters each of these four pixels.  Each of the four destination pixels represents a quadrant of the source pixel, and likewise a direction pointing away from the center of the source pixel.  To choose if it 'smoothes an edge" in a given direction, it checks additional, adjacent source pixels in the direction represented by the quadrant.  If they're all the same color, it represents a diagonal slope of pixels, and the given quadrant pixel is filled in with the same color to smooth out the diagonal.
-				
-				// The following diagram illustrates first the scaling of a single input pixel into 4 output pixels (left side of diagram), and then the choices made to choose which color the output pixels are given (right side of diagram)
-				
-				//   first:        |Then 
-				//   . . . --\ CC  |S T U  --\ 1 2
-				//   . C . --/ CC  |V C W  --/ 3 4
-				//   . . .         |X Y Z
-				//                 | IF V==S==T => 1=S
-				//                 | IF T==U==W => 2=U
-				//                 | IF V==X==Y => 3=X
-				//                 | IF W==Z==Y => 4=Z
-				
-				const int index_up_left = y*input->w + x - input->w - 1;
-				 const int index_up = y*input->w + x - input->w;
-				 const int index_up_right = y*input->w + x - input->w + 1;
-				 const int index_right = y*input->w + x + 1;
-				 const int index_down_right = y*input->w + x + input->w + 1;
-				 const int index_down = y*input->w + x + input->w;
-				 const int index_down_left = y*input->w + x + input->w - 1;
-				 const int index_left = y*input->w + x - 1;
-				 const int max_index = input->w*input->h;
-				 
-				 assert(index_down_left < max_index);
-				 assert(index_down_right < max_index);
-				 assert(index_down < max_index);
-				 
-				 if ( (in[index_up_left] == in[index_up]) && (in[index_up_left] == in[index_left]) ) {
-				 out[(y*2)*result->w + x*2] = in[index_up_left];
-				 }
-				 if ( (in[index_up_right] == in[index_up]) && (in[index_up_right] == in[index_right]) ) {
-				 out[(y*2)*result->w + x*2 + 1] = in[index_up_right];
-				 }
-				 if ( (in[index_down_left] == in[index_down]) && (in[index_down_left] == in[index_left]) ) {
-				 out[(y*2 + 1)*result->w + x*2] = in[index_down_left];
-				 }
-				 if ( (in[index_down_right] == in[index_down]) && (in[index_down_right] == in[index_right]) ) {
-				 out[(y*2 + 1)*result->w + x*2 + 1] = in[index_down_right];
-				 }
-			}
+	for(int y = 0; y != h; ++y) {
+		const uint32_t* row = in + y*w;
+		uint32_t* top = out + (y*2)*result->w;
+		uint32_t* bottom = top + result->w;
+		if(y == 0 || y == h - 1 || w < 3) {
+			scale_row_nearest(row, top, bottom, 0, w);
+			continue;
 		}
+
+		scale_row_nearest(row, top, bottom, 0, 1);
+		scale_row_eagle(row - w, row, row + w, top, bottom, 1, w - 1);
+		scale_row_nearest(row, top, bottom, w - 1, w);
 	}
-	
+
 	return result;
 }
-	
-
 
 surface scale_surface(surface input) {
 	surface result(surface::create(input->w*2, input->h*2));
 
+	const int w = input->w, h = input->h;
 	const uint32_t* in = reinterpret_cast<const uint32_t*>(input->pixels);
 	uint32_t* out = reinterpret_cast<uint32_t*>(result->pixels);
-	for(int y = 0; y != input->h; ++y) {
-		for(int x = 0; x != input->w; ++x) {
-		  //do nearest neighbor interpolation
-			out[(y*2)*result->w + x*2] = in[y*input->w + x];
-			out[(y*2 + 1)*result->w + x*2] = in[y*input->w + x];
-			out[(y*2 + 1)*result->w + x*2 + 1] = in[y*input->w + x];
-			out[(y*2)*result->w + x*2 + 1] = in[y*input->w + x];
-			
-			if ((y > 0) && (y < input->h - 2) && (x > 0) && (x < input->w - 2)){
-				
-				
-			//do additional 2xSaI interpolation
-				
-			//  2xSai works on a square group of sixteen pixels, rather than the square group of nine that Eagle works on.  In Eagle, the current pixel being upsized is the one in the middle of this square of nine; in 2xSai, the current pixel is the one in the upper-left of the middle four.  The other pixels in this group are all input pixels that are being examined to determine if we have an edge to smooth out.
-			
-			//  X X X X  |  0  1  2  3
-			//  X * X X  |  4  5  6  7
-			//  X X X X  |  8  9  10 11
-			//  X X X X  |  12 13 14 15
-						const int px[4][4] = {{	//[x][y]
-							y*input->w + x - input->w - 1,
-							y*input->w + x - input->w,
-							y*input->w + x - input->w + 1,
-							y*input->w + x - input->w + 2},
-							{y*input->w + x - 1,
-							y*input->w + x,
-							y*input->w + x + 1,
-							y*input->w + x + 2},
-							{y*input->w + x + input->w - 1,
-							y*input->w + x + input->w,
-							y*input->w + x + input->w + 1,
-							y*input->w + x + input->w + 2},
-							{y*input->w + x + 2*input->w - 1,
-							y*input->w + x + 2*input->w,
-							y*input->w + x + 2*input->w + 1,
-							y*input->w + x + 2*input->w + 2}};
-						
-						//these are the four output pixels corresponding to the one input pixel
-						const int out_index_upper_left = (y*2)*result->w + x*2;
-						const int out_index_upper_right = (y*2)*result->w + x*2 + 1;
-						const int out_index_lower_left = (y*2 + 1)*result->w + x*2;
-						const int out_index_lower_right = (y*2 + 1)*result->w + x*2 + 1;
-
-						//make sure we're not going out-of-bounds
-						const int max_index = input->w*input->h;
-						assert(px[0][2] < max_index);
-						assert(px[0][3] < max_index);
-						assert(px[1][2] < max_index);
-						assert(px[1][3] < max_index);
-						assert(px[2][0] < max_index);
-						assert(px[2][1] < max_index);
-						assert(px[2][2] < max_index);
-						assert(px[2][3] < max_index);
-						assert(px[3][0] < max_index);
-						assert(px[3][1] < max_index);
-						assert(px[3][2] < max_index);
-						assert(px[3][3] < max_index);
-
-						if ( (in[px[1][1]] == in[px[2][2]]) && (in[px[1][2]] != in[px[2][1]]) ) {
-							if ( ((in[px[1][1]] == in[px[0][1]]) && (in[px[1][2]] == in[px[2][3]])) || ((in[px[1][1]] == in[px[2][1]]) && (in[px[1][1]] == in[px[0][2]]) && (in[px[1][2]] != in[px[0][1]]) && (in[px[1][2]] == in[px[0][3]]))){
-								out[out_index_upper_right] = in[px[1][1]];
-							}else{
-								if( ! ((in[px[1][1]] == in[px[0][1]])) ){
-									out[out_index_upper_right] = interpolate_pixels(in[px[1][1]],in[px[1][2]]);
-								}
-							}
-							
-							if ( ((in[px[1][1]] == in[px[1][0]]) && (in[px[2][1]] == in[px[3][2]])) || ((in[px[1][1]] == in[px[1][2]]) && (in[px[1][1]] == in[px[2][0]]) && (in[px[1][0]] != in[px[2][1]]) && (in[px[2][1]] == in[px[3][0]]))){
-								out[out_index_lower_left] = in[px[1][1]];
-							}else{
-								if( ! ((in[px[1][1]] == in[px[1][0]])) ){
-									out[out_index_lower_left] = interpolate_pixels(in[px[1][1]],in[px[2][1]]);
-								}
-							}
-							out[out_index_lower_right] = in[px[1][1]];
-						} else if ( (in[px[1][2]] == in[px[2][1]]) && (in[px[1][1]] != in[px[2][2]]) ) {
-							if ( ((in[px[1][2]] == in[px[0][2]]) && (in[px[1][1]] == in[px[2][0]])) || ((in[px[1][2]] == in[px[0][1]]) && (in[px[1][2]] == in[px[2][2]]) && (in[px[1][2]] != in[px[0][2]]) && (in[px[1][1]] == in[px[0][0]]))){
-								out[out_index_upper_right] = in[px[1][2]];
-							}else{
-								out[out_index_upper_right] = interpolate_pixels(in[px[1][1]],in[px[1][2]]);
-							}
-							
-							if ( ((in[px[2][1]] == in[px[2][0]]) && (in[px[1][1]] == in[px[0][2]])) || ((in[px[2][1]] == in[px[1][0]]) && (in[px[2][1]] == in[px[2][2]]) && (in[px[1][1]] != in[px[2][0]]) && (in[px[1][1]] == in[px[0][0]]))){
-								out[out_index_lower_left] = in[px[2][1]];
-							}else{
-								out[out_index_lower_left] = interpolate_pixels(in[px[1][1]],in[px[2][1]]);
-							}
-							out[out_index_lower_right] = in[px[1][2]];
-							
-						}else if ( (in[px[1][1]] == in[px[2][2]]) && (in[px[1][2]] == in[px[2][1]]) ) {
-							// these are crossed diagonal pairs of pixels in the inner, center set of four.
-							// if they're the same, then we weight them against a surrounding ring of pixels, and see which
-							// pair is more different from the ring.  The ring is this asterisked set of pixels:
-							//  X * * X
-							//  * X X *
-							//  * X X *
-							//  X * * X
-							if (in[px[1][1]] == in[px[1][2]]){
-								out[out_index_lower_right] = in[px[1][1]];
-								out[out_index_lower_left] = in[px[1][1]];
-								out[out_index_upper_right] = in[px[1][1]];
-								out[out_index_upper_left] = in[px[1][1]];
-
-							} else {
-								
-								int difference_direction = 0;
-								out[out_index_upper_right] = interpolate_pixels(in[px[1][1]],in[px[1][2]]);
-								out[out_index_lower_left] = interpolate_pixels(in[px[1][1]],in[px[2][1]]);
-								
-								difference_direction += calculate_difference(in[px[1][2]],in[px[1][1]],in[px[0][1]],in[px[1][0]]);
-								difference_direction += calculate_difference(in[px[1][2]],in[px[1][1]],in[px[0][2]],in[px[1][3]]);
-								difference_direction += calculate_difference(in[px[1][2]],in[px[1][1]],in[px[3][2]],in[px[2][3]]);
-								difference_direction += calculate_difference(in[px[1][2]],in[px[1][1]],in[px[2][0]],in[px[3][1]]);
-								
-								if (difference_direction > 0){
-									out[out_index_lower_right] = interpolate_pixels(in[px[1][1]],in[px[1][2]],in[px[1][2]],in[px[1][2]]);
-									out[out_index_upper_right] = interpolate_pixels(in[px[1][1]],in[px[1][2]],in[px[1][2]],in[px[1][2]]);
-								}else if(difference_direction < 0){
-									out[out_index_lower_right] = interpolate_pixels(in[px[1][1]],in[px[1][1]],in[px[1][1]],in[px[1][2]]);
-									out[out_index_upper_right] = interpolate_pixels(in[px[1][1]],in[px[1][1]],in[px[1][1]],in[px[1][2]]);
-								}else{
-									out[out_index_lower_right] = interpolate_pixels(in[px[1][1]],in[px[1][2]],in[px[2][1]],in[px[2][2]]);
-									out[out_index_upper_right] = interpolate_pixels(in[px[1][1]],in[px[1][2]],in[px[2][1]],in[px[2][2]]);
-								}								
-								
-							}
-						} else {
-							if ( ( (in[px[1][1]] != in[px[2][1]]) || (in[px[1][1]] != in[px[0][1]]) ) && ( (in[px[0][2]] == in[px[1][2]]) && (in[px[1][2]] == in[px[2][2]]) ) ){
-								out[out_index_upper_right] = interpolate_pixels(in[px[1][1]],in[px[1][1]],in[px[1][1]],in[px[1][2]]);
-								out[out_index_lower_right] = interpolate_pixels(in[px[1][1]],in[px[1][1]],in[px[1][1]],in[px[1][2]]);
-							}
-							
-							if ( ( (in[px[0][2]] == in[px[1][1]]) || (in[px[1][1]] == in[px[2][0]]) ) && ( (in[px[1][1]] != in[px[2][1]]) && (in[px[1][1]] != in[px[1][2]])) ){
-								out[out_index_upper_right] = interpolate_pixels(in[px[1][1]],in[px[1][1]],in[px[1][1]],in[px[1][2]]);
-								out[out_index_lower_left] = interpolate_pixels(in[px[1][1]],in[px[1][1]],in[px[1][1]],in[px[2][1]]);
-								out[out_index_lower_right] = interpolate_pixels(in[px[1][1]],in[px[1][2]],in[px[1][1]],in[px[2][1]]);
-							}
-							
-							if ( ((in[px[1][1]] == in[px[0][0]]) && (in[px[1][1]] == in[px[1][2]])) && ( (in[px[1][1]] != in[px[1][0]]) && (in[px[1][1]] != in[px[2][1]]) ) ){
-								out[out_index_upper_left] = interpolate_pixels(in[px[1][1]],in[px[1][1]],in[px[1][1]],in[px[1][0]]);
-								out[out_index_lower_right] = interpolate_pixels(in[px[1][1]],in[px[1][1]],in[px[1][1]],in[px[2][1]]);
-								out[out_index_lower_left] = interpolate_pixels(in[px[1][0]],in[px[2][1]]);
-							}
-							
-							
-							if ( (in[px[1][1]] == in[px[2][1]]) && (in[px[1][1]] == in[px[0][2]]) && (in[px[1][2]] != in[px[0][1]]) && (in[px[1][2]] == in[px[0][3]]) ){
-								 out[out_index_upper_right] = in[px[1][1]];
-							} else if ( (in[px[1][2]] == in[px[0][1]]) && (in[px[1][2]] == in[px[2][2]]) && (in[px[1][1]] != in[px[0][2]]) && (in[px[1][1]] == in[px[0][0]]) ){
-								 out[out_index_upper_right] = in[px[1][2]];
-							} else {
-								//out[out_index_upper_right] = interpolate_pixels(in[px[1][1]],in[px[1][2]]);
-								//out[out_index_lower_right] = interpolate_pixels(in[px[1][1]],in[px[1][2]]);
-							}
-							
-							if ( (in[px[1][1]] == in[px[1][2]]) && (in[px[1][1]] == in[px[2][0]]) && (in[px[1][0]] != in[px[2][1]]) && (in[px[2][1]] == in[px[3][0]]) ){
-								out[out_index_lower_left] = in[px[1][1]];
-							} else if ( (in[px[2][1]] == in[px[1][0]]) && (in[px[2][1]] == in[px[2][2]]) && (in[px[1][1]] != in[px[2][0]]) && (in[px[1][1]] == in[px[0][0]]) ){
-								out[out_index_lower_left] = in[px[2][1]];
-							} else {
-								//out[out_index_lower_right] = interpolate_pixels(in[px[1][1]],in[px[2][1]]);
-								//out[out_index_lower_left] = interpolate_pixels(in[px[1][1]],in[px[2][1]]);
-							}
-							//out[out_index_lower_right] = interpolate_pixels(in[px[1][1]],in[px[1][2]],in[px[2][1]],in[px[2][2]]);
-							//out[out_index_upper_right] = interpolate_pixels(in[px[1][1]],in[px[1][2]],in[px[2][1]],in[px[2][2]]);
-						}
-							
-			}
+	for(int y = 0; y != h; ++y) {
+		const uint32_t* row = in + y*w;
+		uint32_t* top = out + (y*2)*result->w;
+		uint32_t* bottom = top + result->w;
+		if(y == 0 || y >= h - 2 || w < 4) {
+			scale_row_nearest(row, top, bottom, 0, w);
+			continue;
 		}
+
+		const uint32_t* rows[4] = { row - w, row, row + w, row + 2*w };
+		scale_row_nearest(row, top, bottom, 0, 1);
+		scale_row_2xsai(rows, top, bottom, 1, w - 2);
+		scale_row_nearest(row, top, bottom, w - 2, w);
 	}
 
 	return result;
 }
 
+namespace {
+//a surface of random pixels from a few colours, so that runs of equal
+//pixels, which the scalers look for, are common.
+surface random_surface(int w, int h)
+{
+	const uint32_t colors[] = { 0xFF000000, 0xFFFFFFFF, 0xFF2080C0, 0x00000000 };
+	surface s(surface::create(w, h));
+	uint32_t* pixels = reinterpret_cast<uint32_t*>(s->pixels);
+	for(int n = 0; n != w*h; ++n) {
+		pixels[n] = colors[rand()%4];
+	}
+
+	return s;
+}
+
+bool same_pixels(surface a, surface b)
+{
+	return a->w == b->w && a->h == b->h && memcmp(a->pixels, b->pixels, a->w*a->h*4) == 0;
+}
+}
+
+UNIT_TEST(surface_scaling_sse2_matches_scalar) {
+	//every width up to a few runs of four, so each count of tail pixels
+	//is covered, and heights either side of the edge cases.
+	for(int w = 1; w != 20; ++w) {
+		for(int h = 1; h != 7; ++h) {
+			for(int n = 0; n != 4; ++n) {
+				surface s = random_surface(w, h);
+				use_sse2 = true;
+				surface eagle = scale_surface_eagle(s);
+				surface sai = scale_surface(s);
+
+				use_sse2 = false;
+				const bool eagle_same = same_pixels(eagle, scale_surface_eagle(s));
+				const bool sai_same = same_pixels(sai, scale_surface(s));
+				use_sse2 = true;
+
+				CHECK(eagle_same, "eagle differs with SSE2 on a " << w << "x" << h << " surface");
+				CHECK(sai_same, "2xSaI differs with SSE2 on a " << w << "x" << h << " surface");
+			}
+		}
+	}
+}
+
 BENCHMARK(surface_scaling)
 {
 	surface s(graphics::surface_cache::get("characters/frogatto-spritesheet1.png"));
@@ -302,9 +423,23 @@ BENCHMARK(surface_scaling)
 
 	surface target(SDL_CreateRGBSurface(SDL_SWSURFACE,s->w,s->h,32,SURFACE_MASK));
 	SDL_BlitSurface(s.get(), NULL, target.get(), NULL);
+	test::set_benchmark_items(target->w*target->h, "pixels");
 	BENCHMARK_LOOP {
 		scale_surface(target);
 	}
 }
 
+BENCHMARK(surface_scaling_eagle)
+{
+	surface s(graphics::surface_cache::get("characters/frogatto-spritesheet1.png"));
+	assert(s.get());
+
+	surface target(SDL_CreateRGBSurface(SDL_SWSURFACE,s->w,s->h,32,SURFACE_MASK));
+	SDL_BlitSurface(s.get(), NULL, target.get(), NULL);
+	test::set_benchmark_items(target->w*target->h, "pixels");
+	BENCHMARK_LOOP {
+		scale_surface_eagle(target);
+	}
+}
+
 }
@@ -1,5 +1,6 @@
 #include <iostream>
 
+#include "random.hpp"
 #include "resource.hpp"
 #include "string_utils.hpp"
 #include "terrain.hpp"
@@ -72,5 +73,5 @@ terrain::terrain(wml::const_node_ptr node)
 
 int terrain::calculate_production_value() const
 {
-	return production_difficulty_ + rand()%6 + 1;
+	return production_difficulty_ + rng::generate()%6 + 1;
 }
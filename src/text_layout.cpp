@@ -0,0 +1,155 @@
+#include <stdlib.h>
+
+#include <algorithm>
+
+#include "text_layout.hpp"
+#include "unit_test.hpp"
+
+namespace font {
+
+text_layout::text_layout(const std::string& text, int ascent, int line_height, const metrics_function& metrics)
+  : width_(0), height_(0)
+{
+	const std::vector<uint16_t> chars = decode_utf8(text);
+	std::vector<uint16_t>::const_iterator begin = chars.begin();
+	for(;;) {
+		const std::vector<uint16_t>::const_iterator end = std::find(begin, chars.end(), '\n');
+
+		//the line is measured as TTF_SizeUTF8() measures it, and its
+		//glyphs placed where TTF_RenderUTF8_Blended() draws them, which
+		//is moved right if the first glyph starts left of the origin.
+		int x = 0, minx = 0, maxx = 0, xstart = 0;
+		for(std::vector<uint16_t>::const_iterator i = begin; i != end; ++i) {
+			const glyph_metrics m = metrics(*i);
+			if(i == begin && m.minx < 0) {
+				xstart = -m.minx;
+			}
+
+			minx = std::min(minx, x + m.minx);
+			maxx = std::max(maxx, x + std::max(m.advance, m.maxx));
+
+			const glyph_placement g = { *i, xstart + x + m.minx, height_ + ascent - m.maxy };
+			glyphs_.push_back(g);
+			x += m.advance;
+		}
+
+		width_ = std::max(width_, maxx - minx);
+		height_ += line_height;
+
+		if(end == chars.end()) {
+			break;
+		}
+
+		begin = end + 1;
+	}
+}
+
+std::vector<uint16_t> decode_utf8(const std::string& text)
+{
+	std::vector<uint16_t> result;
+	result.reserve(text.size());
+
+	const unsigned char* i = reinterpret_cast<const unsigned char*>(text.data());
+	const unsigned char* end = i + text.size();
+	while(i != end) {
+		const unsigned char c = *i++;
+		int extra;
+		uint32_t ch;
+		if(c < 0x80) {
+			result.push_back(c);
+			continue;
+		} else if((c&0xE0) == 0xC0) {
+			extra = 1;
+			ch = c&0x1F;
+		} else if((c&0xF0) == 0xE0) {
+			extra = 2;
+			ch = c&0x0F;
+		} else if((c&0xF8) == 0xF0) {
+			extra = 3;
+			ch = c&0x07;
+		} else {
+			result.push_back('?');
+			continue;
+		}
+
+		while(extra && i != end && (*i&0xC0) == 0x80) {
+			ch = (ch << 6) | (*i++&0x3F);
+			--extra;
+		}
+
+		result.push_back(extra || ch > 0xFFFF ? '?' : uint16_t(ch));
+	}
+
+	return result;
+}
+
+}
+
+namespace {
+
+//a font where every glyph is a box of its own width, some reaching left
+//of the origin or past their advance.
+font::glyph_metrics test_metrics(uint16_t ch)
+{
+	const font::glyph_metrics m = { int(ch%3) - 1, int(ch%7) + 4, -2, int(ch%5) + 6, int(ch%4) + 5 };
+	return m;
+}
+
+//a few glyphs whose metrics are easy to follow by hand: 'j' reaches left
+//of the origin, 'f' past its advance, and '.' starts right of it.
+font::glyph_metrics hand_metrics(uint16_t ch)
+{
+	font::glyph_metrics m = { 0, 6, 0, 8, 7 };
+	switch(ch) {
+	case 'j': { const font::glyph_metrics j = { -2, 3, -3, 8, 4 }; m = j; break; }
+	case 'f': { const font::glyph_metrics f = { 0, 6, 0, 9, 4 }; m = f; break; }
+	case '.': { const font::glyph_metrics dot = { 1, 2, 0, 1, 3 }; m = dot; break; }
+	}
+
+	return m;
+}
+
+}
+
+UNIT_TEST(decode_utf8) {
+	const std::vector<uint16_t> chars = font::decode_utf8("a\xC3\xA9\xE2\x82\xAC\xF0\x9F\x98\x80\xC3");
+	CHECK_EQ(chars.size(), 5);
+	CHECK_EQ(chars[0], 'a');
+	CHECK_EQ(chars[1], 0xE9);
+	CHECK_EQ(chars[2], 0x20AC);
+	CHECK_EQ(chars[3], '?');
+	CHECK_EQ(chars[4], '?');
+}
+
+UNIT_TEST(text_layout) {
+	const font::text_layout layout("jA\n\nAf.", 10, 14, hand_metrics);
+
+	//the first line is moved 2 right, since 'j' starts 2 left of the
+	//origin. Each glyph's top is the ascent less its maxy below the top
+	//of its line.
+	const font::glyph_placement expected[] = {
+		{ 'j', 0, 2 }, { 'A', 6, 2 },
+		{ 'A', 0, 30 }, { 'f', 7, 29 }, { '.', 12, 37 },
+	};
+
+	CHECK_EQ(layout.glyphs().size(), sizeof(expected)/sizeof(*expected));
+	for(int n = 0; n != layout.glyphs().size(); ++n) {
+		CHECK_EQ(layout.glyphs()[n].ch, expected[n].ch);
+		CHECK_EQ(layout.glyphs()[n].x, expected[n].x);
+		CHECK_EQ(layout.glyphs()[n].y, expected[n].y);
+	}
+
+	//the first line is 13 wide, from 'j' reaching 2 left to the end of
+	//'A' at 11. The last is 14, to the end of the '.' advance, which is
+	//past where 'f' overhangs its own.
+	CHECK_EQ(layout.width(), 14);
+	CHECK_EQ(layout.height(), 42);
+}
+
+BENCHMARK(text_layout)
+{
+	const std::string text = "Summon a creature of the deep, which takes\nthree turns to arrive.";
+	BENCHMARK_LOOP {
+		font::text_layout layout(text, 10, 14, test_metrics);
+	}
+}
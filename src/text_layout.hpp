@@ -0,0 +1,55 @@
+#ifndef TEXT_LAYOUT_HPP_INCLUDED
+#define TEXT_LAYOUT_HPP_INCLUDED
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include <boost/function.hpp>
+
+namespace font {
+
+//the metrics of a glyph, as TTF_GlyphMetrics() gives them.
+struct glyph_metrics {
+	int minx, maxx, miny, maxy, advance;
+};
+
+struct glyph_placement {
+	uint16_t ch;
+
+	//the top left of the glyph's bitmap, from the top left of the text.
+	int x, y;
+};
+
+//where each glyph of some text goes, worked out from the font's metrics
+//alone so it can be done without rendering anything. Glyphs go where
+//SDL_ttf would draw them, and lines are stacked the way render_text()
+//stacks them, each 'line_height' below the last. Kerning isn't applied,
+//so with a font that has kerning pairs, and an SDL_ttf which uses them,
+//glyphs after a kerned pair are off by the kerning.
+class text_layout
+{
+public:
+	typedef boost::function<glyph_metrics(uint16_t)> metrics_function;
+
+	text_layout(const std::string& text, int ascent, int line_height, const metrics_function& metrics);
+
+	const std::vector<glyph_placement>& glyphs() const { return glyphs_; }
+
+	//the size render_text() would make the text's texture.
+	int width() const { return width_; }
+	int height() const { return height_; }
+
+private:
+	std::vector<glyph_placement> glyphs_;
+	int width_, height_;
+};
+
+//decodes UTF-8 into the 16 bit characters SDL_ttf uses. Anything which
+//can't be decoded, or is outside 16 bits, becomes '?'.
+std::vector<uint16_t> decode_utf8(const std::string& text);
+
+}
+
+#endif
@@ -18,6 +18,7 @@
 #include "concurrent_cache.hpp"
 #include "filesystem.hpp"
 #include "foreach.hpp"
+#include "frame_profiler.hpp"
 #include "preferences.hpp"
 #include "raster.hpp"
 #include "surface_cache.hpp"
@@ -76,6 +77,24 @@ namespace {
 		return cache;
 	}
 
+	palette_texture_map& team_color_texture_cache() {
+		static palette_texture_map cache;
+		return cache;
+	}
+
+	//puts a texture in a cache unless something is already there, which
+	//can happen if the texture was prefetched while it was being built.
+	template<typename Cache, typename Key>
+	bool put_if_absent(Cache& cache, const Key& k, const texture& t) {
+		typename Cache::lock lck(cache);
+		if(lck.map().count(k)) {
+			return false;
+		}
+
+		lck.map()[k] = t;
+		return true;
+	}
+
 	const size_t TextureBufSize = 128;
 	GLuint texture_buf[TextureBufSize];
 	size_t texture_buf_pos = TextureBufSize;
@@ -254,6 +273,8 @@ texture texture::get_portion(int x1, int y1, int x2, int y2) const
 
 	result.width_ = std::abs(x2 - x1);
 	result.height_ = std::abs(y2 - y1);
+	result.alpha_x_ = alpha_x_ + std::min(x1, x2);
+	result.alpha_y_ = alpha_y_ + std::min(y1, y2);
 	result.u_ = u_ + (GLfloat(x1)/GLfloat(width_))*ratio_w_;
 	result.v_ = v_ + (GLfloat(y1)/GLfloat(height_))*ratio_h_;
 	result.ratio_w_ = (GLfloat(x2 - x1)/GLfloat(width_))*ratio_w_;
@@ -261,13 +282,14 @@ texture texture::get_portion(int x1, int y1, int x2, int y2) const
 	return result;
 }
 
-texture::texture() : width_(0), height_(0), u_(0), v_(0)
+texture::texture() : width_(0), height_(0), u_(0), v_(0), alpha_x_(0), alpha_y_(0)
 {
 	add_texture_to_registry(this);
 }
 
 texture::texture(const key& surfs)
-   : width_(0), height_(0), u_(0), v_(0), ratio_w_(1.0), ratio_h_(1.0)
+   : width_(0), height_(0), u_(0), v_(0), ratio_w_(1.0), ratio_h_(1.0),
+     alpha_x_(0), alpha_y_(0)
 {
 	add_texture_to_registry(this);
 	initialize(surfs);
@@ -276,7 +298,7 @@ texture::texture(const key& surfs)
 texture::texture(const texture& t)
   : id_(t.id_), width_(t.width_), height_(t.height_), u_(t.u_), v_(t.v_),
    ratio_w_(t.ratio_w_), ratio_h_(t.ratio_h_),
-   alpha_map_(t.alpha_map_)
+   alpha_map_(t.alpha_map_), alpha_x_(t.alpha_x_), alpha_y_(t.alpha_y_)
 {
 	add_texture_to_registry(this);
 }
@@ -338,7 +360,6 @@ void texture::initialize(const key& k)
 
 	width_ = k.front()->w;
 	height_ = k.front()->h;
-	alpha_map_.reset(new std::vector<bool>(width_*height_));
 
 	unsigned int surf_width = width_;
 	unsigned int surf_height = height_;
@@ -372,17 +393,7 @@ void texture::initialize(const key& k)
 
 	set_alpha_for_transparent_colors_in_rgba_surface(s.get());
 
-	const int npixels = s->w*s->h;
-	for(int n = 0; n != npixels; ++n) {
-		const unsigned char* pixel = reinterpret_cast<const unsigned char*>(s->pixels) + n*4;
-		if(pixel[3] == 0) {
-			const int x = n%s->w;
-			const int y = n/s->w;
-			if(x < width_ && y < height_) {
-				(*alpha_map_)[y*width_ + x] = true;
-			}
-		}
-	}
+	alpha_map_.reset(new alpha_map(reinterpret_cast<const uint32_t*>(s->pixels), width_, height_, s->pitch/4, s->format->Amask, preferences::alpha_map_scale()));
 
 	if(!id_) {
 		id_.reset(new ID);
@@ -407,6 +418,17 @@ namespace {
 threading::mutex id_to_build_mutex;
 }
 
+void texture::prepare_id() const
+{
+	if(id_->scaled == false) {
+		if(preferences::use_pretty_scaling()) {
+			id_->s = scale_surface(id_->s);
+		}
+
+		id_->scaled = true;
+	}
+}
+
 GLuint texture::get_id() const
 {
 	if(!valid()) {
@@ -414,10 +436,9 @@ GLuint texture::get_id() const
 	}
 
 	if(id_->init() == false) {
+		const frame_profiler::zone z("texture_upload");
 		id_->id = get_texture_id();
-		if(preferences::use_pretty_scaling()) {
-			id_->s = scale_surface(id_->s);
-		}
+		prepare_id();
 
 		if(!pthread_equal(graphics_thread_id, pthread_self())) {
 			threading::lock lck(id_to_build_mutex);
@@ -430,15 +451,99 @@ GLuint texture::get_id() const
 	return id_->id;
 }
 
-void texture::build_textures_from_worker_threads()
+void texture::build_textures_from_worker_threads(int budget_ms)
 {
 	ASSERT_LOG(pthread_equal(pthread_self(), graphics_thread_id), "CALLED build_textures_from_worker_threads from thread other than the main one");
+	const frame_profiler::zone z("worker_texture_uploads");
+	const int start_time = SDL_GetTicks();
 	threading::lock lck(id_to_build_mutex);
-	foreach(boost::shared_ptr<ID> id, id_to_build_) {
-		id->build_id();
+	std::vector<boost::shared_ptr<ID> >::iterator i = id_to_build_.begin();
+	for(; i != id_to_build_.end(); ++i) {
+		if(budget_ms >= 0 && i != id_to_build_.begin() && int(SDL_GetTicks()) - start_time >= budget_ms) {
+			break;
+		}
+
+		ID& id = **i;
+
+		//a prefetched texture which was drawn before we got to it has
+		//already been built by get_id().
+		if(!id.s) {
+			continue;
+		}
+
+		if(!id.init()) {
+			id.id = get_texture_id();
+		}
+
+		id.build_id();
+	}
+
+	id_to_build_.erase(id_to_build_.begin(), i);
+}
+
+void texture::init_worker_threads()
+{
+	ASSERT_LOG(pthread_equal(pthread_self(), graphics_thread_id), "CALLED init_worker_threads from thread other than the main one");
+	npot_allowed = is_npot_allowed();
+}
+
+void texture::prefetch(const std::string& str)
+{
+	if(texture_cache().count(str)) {
+		return;
+	}
+
+	texture result(key(1, surface_cache::get_no_cache(str)));
+	if(!result.valid()) {
+		return;
+	}
+
+	//the scaling has to be done before anyone else can see the texture.
+	result.prepare_id();
+	if(put_if_absent(texture_cache(), str, result)) {
+		threading::lock lck(id_to_build_mutex);
+		id_to_build_.push_back(result.id_);
+	}
+}
+
+void texture::prefetch_team_color(const std::string& str, int team_color)
+{
+	std::pair<std::string,int> k(str, team_color);
+	if(team_color_texture_cache().count(k)) {
+		return;
+	}
+
+	texture result(key(1, create_surface_team_color(surface_cache::get_no_cache(str), team_color)));
+	if(!result.valid()) {
+		return;
+	}
+
+	//the scaling has to be done before anyone else can see the texture.
+	result.prepare_id();
+	if(put_if_absent(team_color_texture_cache(), k, result)) {
+		threading::lock lck(id_to_build_mutex);
+		id_to_build_.push_back(result.id_);
+	}
+}
+
+void texture::prefetch_palette_mapped(const std::string& str, int palette)
+{
+	std::pair<std::string,int> k(str, palette);
+	if(palette_texture_cache().count(k)) {
+		return;
+	}
+
+	texture result(key(1, map_palette(surface_cache::get_no_cache(str), palette)));
+	if(!result.valid()) {
+		return;
 	}
 
-	id_to_build_.clear();
+	//the scaling has to be done before anyone else can see the texture.
+	result.prepare_id();
+	if(put_if_absent(palette_texture_cache(), k, result)) {
+		threading::lock lck(id_to_build_mutex);
+		id_to_build_.push_back(result.id_);
+	}
 }
 
 void texture::set_current_texture(GLuint id)
@@ -456,6 +561,11 @@ void texture::set_as_current_texture() const
 	width_multiplier = ratio_w_;
 	height_multiplier = ratio_h_;
 
+	//portions of the same texture share an id but not a position, so
+	//this has to be set even when the texture is already bound.
+	u_position = u_;
+	v_position = v_;
+
 	const GLuint id = get_id();
 	if(!id || current_texture == id) {
 		return;
@@ -465,9 +575,6 @@ void texture::set_as_current_texture() const
 
 	glBindTexture(GL_TEXTURE_2D,id);
 	//std::cerr << gluErrorString(glGetError()) << "~set_as_current_texture~\n";
-
-	u_position = u_;
-	v_position = v_;
 }
 
 texture texture::get(const std::string& str)
@@ -504,10 +611,17 @@ texture texture::get(const std::string& str, const std::string& algorithm)
 
 texture texture::get_team_color(const std::string& str, int team_color)
 {
-	surface s(get_surface_team_color(surface_cache::get(str), team_color));
-	std::vector<surface> v;
-	v.push_back(s);
-	return texture(v);
+	std::pair<std::string,int> k(str, team_color);
+	texture result = team_color_texture_cache().get(k);
+	if(!result.valid()) {
+		surface s(get_surface_team_color(surface_cache::get(str), team_color));
+		std::vector<surface> v;
+		v.push_back(s);
+		result = texture(v);
+		team_color_texture_cache().put(k, result);
+	}
+
+	return result;
 }
 
 texture texture::get_palette_mapped(const std::string& str, int palette)
@@ -526,6 +640,16 @@ texture texture::get_palette_mapped(const std::string& str, int palette)
 	return result;
 }
 
+void texture::set_cached(const std::string& str, const texture& t)
+{
+	texture_cache().put(str, t);
+}
+
+void texture::set_cached_team_color(const std::string& str, int team_color, const texture& t)
+{
+	team_color_texture_cache().put(std::pair<std::string,int>(str, team_color), t);
+}
+
 texture texture::get_no_cache(const key& surfs)
 {
 	return texture(surfs);
@@ -548,17 +672,18 @@ GLfloat texture::get_coord_y(GLfloat y)
 
 GLfloat texture::translate_coord_x(GLfloat x) const
 {
-	return u_position + x*ratio_w_;
+	return u_ + x*ratio_w_;
 }
 
 GLfloat texture::translate_coord_y(GLfloat y) const
 {
-	return v_position + y*ratio_h_;
+	return v_ + y*ratio_h_;
 }
 
 void texture::clear_cache()
 {
 	texture_cache().clear();
+	team_color_texture_cache().clear();
 }
 
 const unsigned char* texture::color_at(int x, int y) const
@@ -576,10 +701,17 @@ std::set<texture::ID*>& texture_id_registry() {
 	static std::set<texture::ID*>* instance = new std::set<texture::ID*>;
 	return *instance;
 }
+
+//IDs are created in worker threads when textures are prefetched.
+threading::mutex& texture_id_registry_mutex() {
+	static threading::mutex* m = new threading::mutex;
+	return *m;
+}
 }
 
 void texture::rebuild_all()
 {
+	threading::lock lck(texture_id_registry_mutex());
 	for(std::set<texture::ID*>::iterator i = texture_id_registry().begin();
 	    i != texture_id_registry().end(); ++i) {
 		if((*i)->s.get() != NULL && (*i)->id != GLuint(-1)) {
@@ -590,13 +722,15 @@ void texture::rebuild_all()
 
 void texture::unbuild_all()
 {
+	threading::lock lck(texture_id_registry_mutex());
 	for(std::set<texture::ID*>::iterator i = texture_id_registry().begin();
 	    i != texture_id_registry().end(); ++i) {
 		(*i)->unbuild_id();
 	}
 }
 
-texture::ID::ID() : id(GLuint(-1)), width(0), height(0) {
+texture::ID::ID() : id(GLuint(-1)), scaled(false), width(0), height(0) {
+	threading::lock lck(texture_id_registry_mutex());
 	texture_id_registry().insert(this);
 }
 
@@ -604,6 +738,7 @@ texture::ID::ID() : id(GLuint(-1)), width(0), height(0) {
 texture::ID::~ID()
 {
 	destroy();
+	threading::lock lck(texture_id_registry_mutex());
 	texture_id_registry().erase(this);
 }
 
@@ -671,6 +806,7 @@ void texture::ID::destroy()
 
 	id = GLuint(-1);
 	s = surface();
+	scaled = false;
 }
 
 std::vector<boost::shared_ptr<texture::ID> > texture::id_to_build_;
@@ -20,6 +20,7 @@
 
 #include <GL/gl.h>
 
+#include "alpha_map.hpp"
 #include "surface.hpp"
 
 namespace graphics
@@ -43,8 +44,21 @@ public:
 
 	//complete construction of any textures that were accessed in worker threads
 	//but which need to be completed in the main thread. May only be called
-	//in the main thread.
-	static void build_textures_from_worker_threads();
+	//in the main thread. If given a budget in milliseconds, it stops once
+	//the budget is used up and leaves the rest for next time.
+	static void build_textures_from_worker_threads(int budget_ms=-1);
+
+	//must be called in the main thread, once there is an OpenGL context,
+	//before any textures are created in worker threads.
+	static void init_worker_threads();
+
+	//create a texture and put it in the cache, ready for any of the get
+	//functions below to find, doing everything except uploading it. Meant
+	//to be called from worker threads, ahead of the texture being needed,
+	//with the upload done by build_textures_from_worker_threads().
+	static void prefetch(const std::string& str);
+	static void prefetch_team_color(const std::string& str, int team_color);
+	static void prefetch_palette_mapped(const std::string& str, int palette);
 
 	texture();
 	texture(const texture& t);
@@ -62,6 +76,12 @@ public:
 	static texture get_team_color(const std::string& str, int team_color);
 
 	static texture get_palette_mapped(const std::string& str, int palette);
+
+	//puts a texture in the cache for get() or get_team_color() to return
+	//in place of loading the image, such as part of an atlas page.
+	static void set_cached(const std::string& str, const texture& t);
+	static void set_cached_team_color(const std::string& str, int team_color, const texture& t);
+
 	static texture get_no_cache(const surface& surf);
 	static GLfloat get_coord_x(GLfloat x);
 	static GLfloat get_coord_y(GLfloat y);
@@ -74,9 +94,7 @@ public:
 	unsigned int width() const { return width_; }
 	unsigned int height() const { return height_; }
 
-	bool is_alpha(int x, int y) const { return (*alpha_map_)[y*width_ + x]; }
-	std::vector<bool>::const_iterator get_alpha_row(int x, int y) const { return alpha_map_->begin() + y*width_ + x; }
-	std::vector<bool>::const_iterator end_alpha() const { return alpha_map_->end(); }
+	bool is_alpha(int x, int y) const { return alpha_map_->is_alpha(alpha_x_ + x, alpha_y_ + y); }
 
 	const unsigned char* color_at(int x, int y) const;
 
@@ -105,18 +123,27 @@ public:
 		//surface in here.
 		surface s;
 
+		//whether pretty scaling, if it's on, has been done to the surface.
+		bool scaled;
+
 		int width, height;
 	};
 
 private:
 	static texture get_no_cache(const key& k);
 
+	//does the part of building the ID which doesn't need OpenGL.
+	void prepare_id() const;
+
 	mutable boost::shared_ptr<ID> id_;
 	unsigned int width_, height_;
 	GLfloat u_, v_;
 	GLfloat ratio_w_, ratio_h_;
 
-	boost::shared_ptr<std::vector<bool> > alpha_map_;
+	//shared with every portion of the texture, each of which knows where
+	//it starts in the map.
+	const_alpha_map_ptr alpha_map_;
+	int alpha_x_, alpha_y_;
 
 	//a list of ID objects that we assigned GL ID's to in a worker thread,
 	//but which need binding to a texture in the main thread.
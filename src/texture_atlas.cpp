@@ -0,0 +1,404 @@
+#include <stdio.h>
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "IMG_savepng.h"
+#include "filesystem.hpp"
+#include "foreach.hpp"
+#include "formatter.hpp"
+#include "preferences.hpp"
+#include "surface.hpp"
+#include "surface_cache.hpp"
+#include "surface_formula.hpp"
+#include "texture.hpp"
+#include "texture_atlas.hpp"
+#include "unit_test.hpp"
+#include "wml_node.hpp"
+#include "wml_parser.hpp"
+#include "wml_utils.hpp"
+#include "xml_parser.hpp"
+#include "xml_writer.hpp"
+
+namespace graphics
+{
+
+namespace {
+
+//space left between images, so that filtering or scaling one never
+//picks up pixels from its neighbour.
+const int Padding = 2;
+
+//a row of images along a page, as tall as the tallest of them.
+struct shelf {
+	int page, y, height, used;
+};
+
+bool taller(const std::pair<texture_atlas_layout::key, rect>& a,
+            const std::pair<texture_atlas_layout::key, rect>& b)
+{
+	if(a.second.h() != b.second.h()) {
+		return a.second.h() > b.second.h();
+	}
+
+	if(a.second.w() != b.second.w()) {
+		return a.second.w() > b.second.w();
+	}
+
+	return a.first < b.first;
+}
+
+}
+
+texture_atlas_layout::texture_atlas_layout(int page_width, int page_height)
+  : page_width_(page_width), page_height_(page_height), num_pages_(0)
+{}
+
+texture_atlas_layout::texture_atlas_layout(wml::const_node_ptr node)
+  : page_width_(wml::get_int(node, "page_width")),
+    page_height_(wml::get_int(node, "page_height")),
+    num_pages_(wml::get_int(node, "pages"))
+{
+	for(wml::node::const_child_iterator i = node->begin_child("image");
+	    i != node->end_child("image"); ++i) {
+		wml::const_node_ptr image = i->second;
+		entry& e = entries_[key(image->attr("image"), wml::get_int(image, "team_color", -1))];
+		e.page = wml::get_int(image, "page", -1);
+		e.area = rect(image->attr("area"));
+	}
+}
+
+void texture_atlas_layout::add(const key& k, int w, int h)
+{
+	entry& e = entries_[k];
+	e.page = -1;
+	e.area = rect(0, 0, w, h);
+}
+
+void texture_atlas_layout::pack()
+{
+	std::vector<std::pair<key, rect> > images;
+	for(entry_map::const_iterator i = entries_.begin(); i != entries_.end(); ++i) {
+		images.push_back(std::make_pair(i->first, rect(0, 0, i->second.area.w(), i->second.area.h())));
+	}
+
+	std::sort(images.begin(), images.end(), taller);
+
+	//the height used on each page so far.
+	std::vector<int> page_used;
+	std::vector<shelf> shelves;
+	for(int n = 0; n != images.size(); ++n) {
+		entry& e = entries_[images[n].first];
+		const int w = images[n].second.w();
+		const int h = images[n].second.h();
+		e.page = -1;
+		e.area = rect(0, 0, w, h);
+		if(w > page_width_ || h > page_height_) {
+			continue;
+		}
+
+		//since images come tallest first, the first shelf with room
+		//across it is always tall enough.
+		shelf* found = NULL;
+		foreach(shelf& s, shelves) {
+			if(s.used + w <= page_width_) {
+				found = &s;
+				break;
+			}
+		}
+
+		if(!found) {
+			int page = 0;
+			while(page != page_used.size() && page_used[page] + h > page_height_) {
+				++page;
+			}
+
+			if(page == page_used.size()) {
+				page_used.push_back(0);
+			}
+
+			shelf s = { page, page_used[page], h, 0 };
+			page_used[page] += h + Padding;
+			shelves.push_back(s);
+			found = &shelves.back();
+		}
+
+		e.page = found->page;
+		e.area = rect(found->used, found->y, w, h);
+		found->used += w + Padding;
+	}
+
+	num_pages_ = page_used.size();
+}
+
+const texture_atlas_layout::entry* texture_atlas_layout::find(const key& k) const
+{
+	entry_map::const_iterator i = entries_.find(k);
+	if(i == entries_.end() || i->second.page < 0) {
+		return NULL;
+	}
+
+	return &i->second;
+}
+
+wml::node_ptr texture_atlas_layout::write() const
+{
+	wml::node_ptr node(new wml::node("atlas"));
+	node->set_attr("page_width", formatter() << page_width_);
+	node->set_attr("page_height", formatter() << page_height_);
+	node->set_attr("pages", formatter() << num_pages_);
+	for(entry_map::const_iterator i = entries_.begin(); i != entries_.end(); ++i) {
+		wml::node_ptr image(new wml::node("image"));
+		image->set_attr("image", i->first.first);
+		if(i->first.second >= 0) {
+			image->set_attr("team_color", formatter() << i->first.second);
+		}
+
+		image->set_attr("page", formatter() << i->second.page);
+		image->set_attr("area", i->second.area.to_string());
+		node->add_child(image);
+	}
+
+	return node;
+}
+
+namespace texture_atlas {
+
+namespace {
+
+const int PageSize = 1024;
+
+const char* LayoutFile = "data/compiled/atlas.xml";
+
+std::string page_image(int page)
+{
+	return formatter() << "compiled/atlas-" << page << ".png";
+}
+
+//adds the images a node and its children use, in each team color if
+//there are any. Elements marked tiled="yes" are drawn with their image
+//repeated, which a part of a page can't be, so are left out.
+void add_images(wml::const_node_ptr node, int team_colors, std::vector<texture_atlas_layout::key>& images)
+{
+	if(wml::get_bool(node, "tiled", false)) {
+		return;
+	}
+
+	static const char* Attributes[] = { "image", "overlay_image" };
+	foreach(const char* attr, Attributes) {
+		const std::string& img = node->attr(attr).str();
+		if(img.empty()) {
+			continue;
+		}
+
+		images.push_back(texture_atlas_layout::key(img, -1));
+		for(int n = 0; n < team_colors; ++n) {
+			images.push_back(texture_atlas_layout::key(img, n));
+		}
+	}
+
+	for(wml::node::const_all_child_iterator i = node->begin_children();
+	    i != node->end_children(); ++i) {
+		add_images(*i, team_colors, images);
+	}
+}
+
+//every image which goes in the atlas, each only once.
+std::vector<texture_atlas_layout::key> manifest()
+{
+	std::vector<texture_atlas_layout::key> images;
+	add_images(wml::parse_wml_from_file("data/terrain.xml"), 0, images);
+	add_images(wml::parse_wml_from_file("data/gui.xml"), 0, images);
+	add_images(wml::parse_wml_from_file("data/unit_overlays.xml"), 0, images);
+
+	//units are drawn in the color of the side they're on, which may be
+	//any of the team colors.
+	const int team_colors = num_team_colors();
+	std::vector<std::string> files;
+	sys::get_files_in_dir("data/units", &files);
+	foreach(const std::string& file, files) {
+		if(file.size() > 4 && file.substr(file.size() - 4) == ".xml") {
+			add_images(wml::parse_wml_from_file("data/units/" + file), team_colors, images);
+		}
+	}
+
+	std::sort(images.begin(), images.end());
+	images.erase(std::unique(images.begin(), images.end()), images.end());
+	return images;
+}
+
+//the image as texture::get() or texture::get_team_color() would load it.
+surface load_image(const texture_atlas_layout::key& k)
+{
+	if(k.second >= 0) {
+		return get_surface_team_color(surface_cache::get(k.first), k.second);
+	}
+
+	return surface_cache::get_no_cache(k.first);
+}
+
+void build_pages(texture_atlas_layout& layout, std::vector<surface>& pages)
+{
+	std::vector<std::pair<texture_atlas_layout::key, surface> > images;
+	foreach(const texture_atlas_layout::key& k, manifest()) {
+		surface s = load_image(k);
+		if(s) {
+			layout.add(k, s->w, s->h);
+			images.push_back(std::make_pair(k, s));
+		}
+	}
+
+	layout.pack();
+
+	for(int n = 0; n != layout.num_pages(); ++n) {
+		pages.push_back(surface(SDL_CreateRGBSurface(SDL_SWSURFACE, layout.page_width(), layout.page_height(), 32, SURFACE_MASK)));
+	}
+
+	for(int n = 0; n != images.size(); ++n) {
+		const texture_atlas_layout::entry* e = layout.find(images[n].first);
+		if(!e) {
+			std::cerr << "IMAGE TOO LARGE FOR TEXTURE ATLAS: " << images[n].first.first << "\n";
+			continue;
+		}
+
+		//copy the alpha channel across as it is, rather than blending.
+		SDL_Rect dst = e->area.sdl_rect();
+		SDL_SetAlpha(images[n].second.get(), 0, SDL_ALPHA_OPAQUE);
+		SDL_BlitSurface(images[n].second.get(), NULL, pages[e->page].get(), &dst);
+	}
+}
+
+}
+
+void init()
+{
+	const Uint32 start_time = SDL_GetTicks();
+	texture_atlas_layout layout(PageSize, PageSize);
+	std::vector<surface> pages;
+	if(preferences::load_compiled() && sys::file_exists(LayoutFile)) {
+		layout = texture_atlas_layout(wml::parse_wml_from_file(LayoutFile));
+		for(int n = 0; n != layout.num_pages(); ++n) {
+			pages.push_back(surface_cache::get_no_cache(page_image(n)));
+		}
+	} else {
+		build_pages(layout, pages);
+	}
+
+	std::vector<texture> page_textures;
+	foreach(const surface& s, pages) {
+		page_textures.push_back(texture::get_no_cache(s));
+	}
+
+	const texture_atlas_layout::entry_map& entries = layout.entries();
+	for(texture_atlas_layout::entry_map::const_iterator i = entries.begin(); i != entries.end(); ++i) {
+		const texture_atlas_layout::entry& e = i->second;
+		if(e.page < 0 || e.page >= page_textures.size() || !page_textures[e.page].valid()) {
+			continue;
+		}
+
+		const texture t = page_textures[e.page].get_portion(e.area.x(), e.area.y(), e.area.x2(), e.area.y2());
+		if(i->first.second >= 0) {
+			texture::set_cached_team_color(i->first.first, i->first.second, t);
+		} else {
+			texture::set_cached(i->first.first, t);
+		}
+	}
+
+	std::cerr << "TEXTURE ATLAS: " << entries.size() << " IMAGES ON " << pages.size() << " PAGES IN " << (SDL_GetTicks() - start_time) << "ms\n";
+}
+
+}
+
+}
+
+UNIT_TEST(texture_atlas_layout) {
+	using graphics::texture_atlas_layout;
+
+	texture_atlas_layout layout(256, 128);
+	const int sizes[][2] = { {100, 60}, {100, 60}, {60, 100}, {30, 20}, {200, 10}, {256, 128}, {300, 10}, {10, 10}, {120, 70}, {50, 50} };
+	const int nsizes = sizeof(sizes)/sizeof(*sizes);
+	for(int n = 0; n != nsizes; ++n) {
+		layout.add(texture_atlas_layout::key(formatter() << "image" << n, n%2 ? -1 : n), sizes[n][0], sizes[n][1]);
+	}
+
+	layout.pack();
+
+	CHECK(layout.num_pages() > 1, "images which can't share a page weren't spread across pages");
+
+	std::vector<std::pair<int, rect> > placed;
+	for(int n = 0; n != nsizes; ++n) {
+		const texture_atlas_layout::entry* e = layout.find(texture_atlas_layout::key(formatter() << "image" << n, n%2 ? -1 : n));
+		if(sizes[n][0] > 256) {
+			CHECK(e == NULL, "an image wider than the page was placed");
+			continue;
+		}
+
+		CHECK(e != NULL, "image " << n << " wasn't placed");
+		CHECK_EQ(e->area.w(), sizes[n][0]);
+		CHECK_EQ(e->area.h(), sizes[n][1]);
+		CHECK(e->page >= 0 && e->page < layout.num_pages(), "bad page " << e->page);
+		CHECK(e->area.x() >= 0 && e->area.y() >= 0 && e->area.x2() <= 256 && e->area.y2() <= 128, "image " << n << " is off the page: " << e->area);
+
+		//images on the same page are never closer than the padding.
+		for(int m = 0; m != placed.size(); ++m) {
+			if(placed[m].first == e->page) {
+				const rect& a = placed[m].second;
+				const rect padded(a.x() - 1, a.y() - 1, a.w() + 2, a.h() + 2);
+				CHECK(!rects_intersect(padded, e->area), "images overlap: " << a << " and " << e->area);
+			}
+		}
+
+		placed.push_back(std::make_pair(e->page, e->area));
+	}
+
+	CHECK(layout.find(texture_atlas_layout::key("image1", 1)) == NULL, "found an image in a team color it wasn't added in");
+
+	//the layout is saved with compiled data, and must read back the same.
+	const texture_atlas_layout copy(wml::parse_xml(wml::output_xml(layout.write())));
+	CHECK_EQ(copy.num_pages(), layout.num_pages());
+	CHECK_EQ(copy.page_width(), layout.page_width());
+	CHECK_EQ(copy.page_height(), layout.page_height());
+	CHECK_EQ(copy.entries().size(), layout.entries().size());
+	for(texture_atlas_layout::entry_map::const_iterator i = layout.entries().begin(); i != layout.entries().end(); ++i) {
+		const texture_atlas_layout::entry_map::const_iterator j = copy.entries().find(i->first);
+		CHECK(j != copy.entries().end(), "image missing after reading back: " << i->first.first);
+		CHECK_EQ(j->second.page, i->second.page);
+		CHECK_EQ(j->second.area, i->second.area);
+	}
+}
+
+UNIT_TEST(texture_atlas_manifest) {
+	//tiled elements are left out, along with everything inside them.
+	const wml::const_node_ptr node = wml::parse_xml(
+	  "<gui><a image=\"a.png\"/><b image=\"b.png\" tiled=\"yes\"><c image=\"c.png\"/></b>"
+	  "<d image=\"d.png\" overlay_image=\"e.png\" tiled=\"no\"/></gui>");
+	std::vector<graphics::texture_atlas_layout::key> images;
+	graphics::texture_atlas::add_images(node, 2, images);
+	CHECK_EQ(images.size(), 9);
+	CHECK(std::count(images.begin(), images.end(), graphics::texture_atlas_layout::key("b.png", -1)) == 0, "a tiled image was added");
+	CHECK(std::count(images.begin(), images.end(), graphics::texture_atlas_layout::key("c.png", -1)) == 0, "an image inside a tiled element was added");
+	CHECK(std::count(images.begin(), images.end(), graphics::texture_atlas_layout::key("e.png", 1)) == 1, "an overlay wasn't added in a team color");
+}
+
+//packs the atlas and saves it to be loaded with compiled data, so the
+//game doesn't have to pack it each time it starts.
+UTILITY(build_texture_atlas)
+{
+	using namespace graphics;
+
+	texture_atlas_layout layout(texture_atlas::PageSize, texture_atlas::PageSize);
+	std::vector<surface> pages;
+	texture_atlas::build_pages(layout, pages);
+
+	sys::make_dir("data/compiled");
+	sys::make_dir("images/compiled");
+	for(int n = 0; n != pages.size(); ++n) {
+		const std::string fname = "images/" + texture_atlas::page_image(n);
+		fprintf(stderr, "OUTPUT IMAGE: %s\n", fname.c_str());
+		IMG_SavePNG(fname.c_str(), pages[n].get());
+	}
+
+	sys::write_file(texture_atlas::LayoutFile, wml::output_xml(layout.write()));
+}
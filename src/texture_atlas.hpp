@@ -0,0 +1,75 @@
+#ifndef TEXTURE_ATLAS_HPP_INCLUDED
+#define TEXTURE_ATLAS_HPP_INCLUDED
+
+#include <map>
+#include <string>
+#include <utility>
+
+#include "geometry.hpp"
+#include "wml_node_fwd.hpp"
+
+namespace graphics
+{
+
+//where each image goes on a set of texture atlas pages. It's kept apart
+//from the pages themselves, so it can be worked out and checked without
+//any graphics, and saved along with compiled data.
+class texture_atlas_layout
+{
+public:
+	//an image and the team color it's drawn in, or -1 for none.
+	typedef std::pair<std::string,int> key;
+
+	struct entry {
+		entry() : page(-1) {}
+
+		//-1 if the image didn't fit on a page.
+		int page;
+		rect area;
+	};
+
+	typedef std::map<key,entry> entry_map;
+
+	texture_atlas_layout(int page_width, int page_height);
+	explicit texture_atlas_layout(wml::const_node_ptr node);
+
+	void add(const key& k, int w, int h);
+
+	//places everything which has been added, tallest first, on shelves
+	//across as few pages as it can.
+	void pack();
+
+	//returns NULL if the image isn't on a page.
+	const entry* find(const key& k) const;
+
+	int num_pages() const { return num_pages_; }
+	int page_width() const { return page_width_; }
+	int page_height() const { return page_height_; }
+	const entry_map& entries() const { return entries_; }
+
+	wml::node_ptr write() const;
+
+private:
+	int page_width_, page_height_;
+	int num_pages_;
+	entry_map entries_;
+};
+
+namespace texture_atlas {
+
+//builds the atlas pages for the terrain, unit and gui images and puts
+//each image on them in the texture cache, so texture::get() and
+//texture::get_team_color() return the part of a page it is on. Must be
+//called in the main thread, after the video mode is set. Parts of a page
+//can't be wrapped, so images which are drawn tiled mustn't be on one:
+//their elements are marked tiled="yes".
+//
+//Without compiled data, the images are loaded, colored and packed here,
+//before the game starts; the time that takes is logged.
+void init();
+
+}
+
+}
+
+#endif
@@ -20,6 +20,7 @@
 #include "tile_logic.hpp"
 #include "util.hpp"
 #include "wml_node.hpp"
+#include "wml_visitor.hpp"
 
 namespace hex
 {
@@ -38,6 +39,19 @@ wml::node_ptr write_location(const std::string& name, const location& loc)
 	return res;
 }
 
+void write_location_attr(wml::visitor& v, const location& loc)
+{
+	v.attr("x", loc.x());
+	v.attr("y", loc.y());
+}
+
+void write_location(wml::visitor& v, const std::string& name, const location& loc)
+{
+	v.begin_element(name);
+	write_location_attr(v, loc);
+	v.end_element();
+}
+
 wml::node_ptr write_src_dst_location(const std::string& name, const location& src, const location& dst)
 {
 	wml::node_ptr res(new wml::node(name));
@@ -38,6 +38,11 @@ namespace hex
 	};
 
 	wml::node_ptr write_location(const std::string& name, const location& loc);
+
+	//give the x and y attributes of a location, or a whole element
+	//holding just the location.
+	void write_location_attr(wml::visitor& v, const location& loc);
+	void write_location(wml::visitor& v, const std::string& name, const location& loc);
 	wml::node_ptr write_src_dst_location(const std::string& name,
 					                     const location& src, const location& dst);
 
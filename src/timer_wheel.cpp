@@ -0,0 +1,115 @@
+#include <boost/bind.hpp>
+
+#include "timer_wheel.hpp"
+#include "unit_test.hpp"
+
+timer_wheel::timer_wheel(int tick_ms, int nslots)
+  : tick_ms_(tick_ms), slots_(nslots), current_(0), next_id_(1)
+{}
+
+timer_wheel::timer_id timer_wheel::schedule(int delay_ms, const callback& fn)
+{
+	//round up, and never run in the tick which is already under way.
+	int ticks = (delay_ms + tick_ms_ - 1)/tick_ms_;
+	if(ticks < 1) {
+		ticks = 1;
+	}
+
+	const int nslots = slots_.size();
+	const int slot_index = (current_ + ticks)%nslots;
+
+	entry e;
+	e.id = next_id_++;
+	e.rounds = (ticks - 1)/nslots;
+	e.fn = fn;
+
+	slot& s = slots_[slot_index];
+	index_[e.id] = std::make_pair(slot_index, s.insert(s.end(), e));
+	return e.id;
+}
+
+void timer_wheel::cancel(timer_id id)
+{
+	std::map<timer_id, std::pair<int, slot::iterator> >::iterator i = index_.find(id);
+	if(i == index_.end()) {
+		return;
+	}
+
+	slots_[i->second.first].erase(i->second.second);
+	index_.erase(i);
+}
+
+void timer_wheel::tick()
+{
+	current_ = (current_ + 1)%slots_.size();
+
+	//take the due timers out before running any of them, so callbacks
+	//can change the wheel freely.
+	slot& s = slots_[current_];
+	slot due;
+	for(slot::iterator i = s.begin(); i != s.end(); ) {
+		if(i->rounds > 0) {
+			--i->rounds;
+			++i;
+			continue;
+		}
+
+		index_.erase(i->id);
+		due.splice(due.end(), s, i++);
+	}
+
+	for(slot::iterator i = due.begin(); i != due.end(); ++i) {
+		i->fn();
+	}
+}
+
+namespace {
+void record(std::vector<int>* fired, int n)
+{
+	fired->push_back(n);
+}
+
+void reschedule(timer_wheel* wheel, std::vector<int>* fired, int n)
+{
+	fired->push_back(n);
+	wheel->schedule(20, boost::bind(record, fired, n + 1));
+}
+}
+
+UNIT_TEST(timer_wheel) {
+	timer_wheel wheel(10, 4);
+	std::vector<int> fired;
+	wheel.schedule(0, boost::bind(record, &fired, 1));
+	wheel.schedule(25, boost::bind(record, &fired, 3));
+	const timer_wheel::timer_id cancelled = wheel.schedule(20, boost::bind(record, &fired, 2));
+
+	//further away than one trip round the wheel.
+	wheel.schedule(100, boost::bind(record, &fired, 10));
+	wheel.schedule(40, boost::bind(reschedule, &wheel, &fired, 4));
+	CHECK_EQ(wheel.size(), 5);
+
+	wheel.cancel(cancelled);
+	wheel.cancel(cancelled);
+	CHECK_EQ(wheel.size(), 4);
+
+	std::vector<std::vector<int> > fired_by_tick;
+	for(int n = 0; n != 10; ++n) {
+		fired.clear();
+		wheel.tick();
+		fired_by_tick.push_back(fired);
+	}
+
+	CHECK_EQ(fired_by_tick[0].size(), 1);
+	CHECK_EQ(fired_by_tick[0][0], 1);
+	CHECK(fired_by_tick[1].empty(), "timer ran early");
+	CHECK_EQ(fired_by_tick[2].size(), 1);
+	CHECK_EQ(fired_by_tick[2][0], 3);
+	CHECK_EQ(fired_by_tick[3].size(), 1);
+	CHECK_EQ(fired_by_tick[3][0], 4);
+	CHECK_EQ(fired_by_tick[5].size(), 1);
+	CHECK_EQ(fired_by_tick[5][0], 5);
+	CHECK(fired_by_tick[8].empty(), "timer ran a trip early");
+	CHECK_EQ(fired_by_tick[9].size(), 1);
+	CHECK_EQ(fired_by_tick[9][0], 10);
+	CHECK_EQ(wheel.size(), 0);
+}
@@ -0,0 +1,62 @@
+#ifndef TIMER_WHEEL_HPP_INCLUDED
+#define TIMER_WHEEL_HPP_INCLUDED
+
+#include <stdint.h>
+
+#include <list>
+#include <map>
+#include <vector>
+
+#include <boost/function.hpp>
+
+//runs callbacks after a delay, to a resolution of one tick. Timers are
+//hashed into a ring of slots by the tick they're due on, so a tick only
+//looks at the timers in one slot, rather than every timer there is.
+//Timers further away than one trip round the ring wait in their slot
+//for the number of trips left.
+//
+//The wheel doesn't keep time itself; its owner calls tick() once every
+//tick_ms, normally from a timer on its io_service.
+class timer_wheel
+{
+public:
+	typedef boost::function<void()> callback;
+
+	//identifies a timer so that it can be cancelled. Never 0, so 0 can
+	//be used for no timer.
+	typedef int64_t timer_id;
+
+	timer_wheel(int tick_ms, int nslots);
+
+	//runs fn once, at least delay_ms from now.
+	timer_id schedule(int delay_ms, const callback& fn);
+
+	//does nothing if the timer has already run or been cancelled.
+	void cancel(timer_id id);
+
+	//moves on one tick, running every timer which is now due. Timers
+	//may be scheduled and cancelled from the callbacks.
+	void tick();
+
+	int tick_ms() const { return tick_ms_; }
+	size_t size() const { return index_.size(); }
+private:
+	struct entry {
+		timer_id id;
+		int rounds;
+		callback fn;
+	};
+
+	typedef std::list<entry> slot;
+
+	int tick_ms_;
+	std::vector<slot> slots_;
+	int current_;
+	timer_id next_id_;
+
+	//where each pending timer is, so it can be cancelled without a
+	//search.
+	std::map<timer_id, std::pair<int, slot::iterator> > index_;
+};
+
+#endif
@@ -1,4 +1,5 @@
 #include "asserts.hpp"
+#include "document_cache.hpp"
 #include "foreach.hpp"
 #include "formatter.hpp"
 #include "game.hpp"
@@ -10,9 +11,17 @@
 #include "wml_node.hpp"
 #include "wml_parser.hpp"
 #include "wml_utils.hpp"
+#include "wml_visitor.hpp"
 
 void unit::assign_new_unit_key()
 {
+	//units in a game are numbered by the game, so a replay of the game
+	//hands out the same keys.
+	if(game::current()) {
+		key_ = game::current()->allocate_unit_key();
+		return;
+	}
+
 	static int unit_key = 1;
 	key_ = unit_key++;
 }
@@ -32,13 +41,20 @@ unit::modification::modification(wml::const_node_ptr node)
 
 wml::node_ptr unit::modification::write() const
 {
-	wml::node_ptr node(new wml::node("mod"));
-	node->set_attr("id", formatter() << id);
-	node->set_attr("life", formatter() << life);
-	node->set_attr("armor", formatter() << armor);
-	node->set_attr("move", formatter() << move);
-	node->set_attr("expires_end_of_turn", expires_end_of_turn ? "yes" : "no");
-	return node;
+	wml::node_builder builder;
+	write(builder);
+	return builder.result();
+}
+
+void unit::modification::write(wml::visitor& v) const
+{
+	v.begin_element("mod");
+	v.attr("id", id);
+	v.attr("life", life);
+	v.attr("armor", armor);
+	v.attr("move", move);
+	v.attr("expires_end_of_turn", expires_end_of_turn ? "yes" : "no");
+	v.end_element();
 }
 
 int unit::resource_type() const
@@ -62,7 +78,10 @@ const_unit_ptr unit::get_prototype(const std::string& id)
 	static std::map<std::string, const_unit_ptr> cache;
 	const_unit_ptr& u = cache[id];
 	if(!u.get()) {
-		u.reset(new unit(wml::parse_wml_from_file("data/units/" + id + ".xml")));
+		//prototypes are shared by every game, so don't take a key from
+		//whichever game happens to load them first.
+		const game_context context(NULL);
+		u.reset(new unit(document_cache::get_wml("data/units/" + id + ".xml")));
 	}
 
 	return u;
@@ -140,69 +159,74 @@ unit::unit(wml::const_node_ptr node)
 
 wml::node_ptr unit::write() const
 {
-	wml::node_ptr node(new wml::node("unit"));
-	node->set_attr("movement_type", move_type_->id());
-	node->set_attr("key", formatter() << key_);
-	node->set_attr("id", id_);
-	node->set_attr("overlays", util::join(overlays_));
-	node->set_attr("underlays", util::join(underlays_));
-	node->set_attr("name", name_);
-	node->set_attr("upkeep", upkeep_);
-	node->set_attr("side", formatter() << side_);
-	node->set_attr("x", formatter() << loc_.x());
-	node->set_attr("y", formatter() << loc_.y());
-	node->set_attr("life", formatter() << life_);
-	node->set_attr("armor", formatter() << armor_);
-	node->set_attr("move", formatter() << move_);
-	node->set_attr("damage_taken", formatter() << damage_taken_);
+	wml::node_builder builder;
+	write(builder);
+	return builder.result();
+}
+
+void unit::write(wml::visitor& v) const
+{
+	v.begin_element("unit");
+	v.attr("movement_type", move_type_->id());
+	v.attr("key", key_);
+	v.attr("id", id_);
+	v.attr("overlays", util::join(overlays_));
+	v.attr("underlays", util::join(underlays_));
+	v.attr("name", name_);
+	v.attr("upkeep", upkeep_);
+	v.attr("side", side_);
+	hex::write_location_attr(v, loc_);
+	v.attr("life", life_);
+	v.attr("armor", armor_);
+	v.attr("move", move_);
+	v.attr("damage_taken", damage_taken_);
 
 	//derived stats after temporary modifications are applied.
 	//Useful for some clients though won't be used when reading the unit
 	//back in again.
-	node->set_attr("effective_life", formatter() << life());
-	node->set_attr("effective_armor", formatter() << armor());
+	v.attr("effective_life", life());
+	v.attr("effective_armor", armor());
 
 	if(maintenance_cost_ != 1) {
-		node->set_attr("maintenance_cost", formatter() << maintenance_cost_);
+		v.attr("maintenance_cost", maintenance_cost_);
 	}
 
 	if(has_moved_) {
-		node->set_attr("has_moved", "yes");
+		v.attr("has_moved", "yes");
 	}
 
 	if(scout_) {
-		node->set_attr("scout", "yes");
+		v.attr("scout", "yes");
 	}
 
-	node->set_attr("mod_id", formatter() << mod_id_);
+	v.attr("mod_id", mod_id_);
+	v.attr("can_summon", can_summon_);
+	v.attr("can_cast", can_cast_);
+	v.attr("can_produce", can_produce_ ? "yes" : "no");
 
-	foreach(mod_ptr m, mods_) {
-		node->add_child(m->write());
+	for(handlers_map::const_iterator i = handlers_.begin(); i != handlers_.end(); ++i) {
+		if(i->second) {
+			v.attr("on_" + i->first, i->second->str());
+		}
 	}
 
-	node->set_attr("can_summon", can_summon_);
-	node->set_attr("can_cast", can_cast_);
-	node->set_attr("can_produce", can_produce_ ? "yes" : "no");
-
-	foreach(unit_ability_ptr a, abilities_) {
-		node->add_child(a->write());
+	foreach(mod_ptr m, mods_) {
+		m->write(v);
 	}
 
-	for(handlers_map::const_iterator i = handlers_.begin(); i != handlers_.end(); ++i) {
-		if(i->second) {
-			node->set_attr("on_" + i->first, i->second->str());
-		}
+	foreach(unit_ability_ptr a, abilities_) {
+		a->write(v);
 	}
 
-	wml::node_ptr vars_node(new wml::node("vars"));
-	vars_->write(vars_node);
-	node->add_child(vars_node);
+	v.begin_element("vars");
+	vars_->write(v);
+	v.end_element();
 
-	wml::node_ptr vars_turn_node(new wml::node("vars_turn"));
-	vars_turn_->write(vars_turn_node);
-	node->add_child(vars_turn_node);
+	v.begin_element("vars_turn");
+	vars_turn_->write(v);
+	v.end_element();
 
-	return node;
+	v.end_element();
 }
 
 const hex::location& unit::loc() const
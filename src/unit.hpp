@@ -28,6 +28,7 @@ public:
 		modification();
 		explicit modification(wml::const_node_ptr node);
 		wml::node_ptr write() const;
+		void write(wml::visitor& v) const;
 		int id;
 		int life, armor, move;
 		bool expires_end_of_turn;
@@ -40,6 +41,7 @@ public:
 	explicit unit(wml::const_node_ptr node);
 
 	wml::node_ptr write() const;
+	void write(wml::visitor& v) const;
 
 	typedef boost::shared_ptr<modification> mod_ptr;
 
@@ -10,6 +10,7 @@
 #include "unit_ability.hpp"
 #include "wml_node.hpp"
 #include "wml_utils.hpp"
+#include "wml_visitor.hpp"
 
 unit_ability::unit_ability(const std::string& unit_id, wml::const_node_ptr node)
   : name_(node->attr("name")), id_(node->attr("id")),
@@ -25,20 +26,27 @@ unit_ability::unit_ability(const std::string& unit_id, wml::const_node_ptr node)
 
 wml::node_ptr unit_ability::write() const
 {
-	wml::node_ptr node(new wml::node("ability"));
-	node->set_attr("name", name_);
-	node->set_attr("id", id_);
-	node->set_attr("description", description_);
-	node->set_attr("targets", formatter() << ntargets_);
-	node->set_attr("range", formatter() << range_);
-	node->set_attr("taps_caster", taps_caster_ ? "yes" : "no");
-	node->set_attr("icon", formatter() << icon_);
+	wml::node_builder builder;
+	write(builder);
+	return builder.result();
+}
+
+void unit_ability::write(wml::visitor& v) const
+{
+	v.begin_element("ability");
+	v.attr("name", name_);
+	v.attr("id", id_);
+	v.attr("description", description_);
+	v.attr("targets", ntargets_);
+	v.attr("range", range_);
+	v.attr("taps_caster", taps_caster_ ? "yes" : "no");
+	v.attr("icon", icon_);
 
 	if(valid_targets_.get() != NULL) {
-		node->set_attr("valid_targets", valid_targets_->str());
+		v.attr("valid_targets", valid_targets_->str());
 	}
 
-	return node;
+	v.end_element();
 }
 
 namespace {
@@ -18,6 +18,7 @@ public:
 	explicit unit_ability(const std::string& unit_id, wml::const_node_ptr node);
 
 	wml::node_ptr write() const;
+	void write(wml::visitor& v) const;
 
 	bool is_ability_usable(unit& u, card_selector& selector) const;
 	wml::node_ptr use_ability(unit& u, card_selector& selector);
@@ -1,7 +1,9 @@
 #include <map>
 
+#include "asset_loader.hpp"
 #include "color_utils.hpp"
 #include "debug_console.hpp"
+#include "document_cache.hpp"
 #include "draw_number.hpp"
 #include "draw_utils.hpp"
 #include "game.hpp"
@@ -34,7 +36,7 @@ const_anim_set_ptr get_animations_for_unit(const std::string& id, int color)
 {
 	const_anim_set_ptr& a = anim_set_cache[std::make_pair(id, color)];
 	if(a.get() == NULL) {
-		a.reset(new unit_animation_set(wml::parse_wml_from_file("data/units/" + id + ".xml"), color));
+		a.reset(new unit_animation_set(document_cache::get_wml("data/units/" + id + ".xml"), color));
 	}
 
 	return a;
@@ -72,6 +74,21 @@ unit_avatar::unit_avatar(unit_ptr u)
    dead_(false), time_in_path_(0)
 {}
 
+void unit_avatar::prefetch(const std::string& id, int side, graphics::asset_loader& loader)
+{
+	wml::const_node_ptr stand = document_cache::get_wml("data/units/" + id + ".xml")->get_child("stand");
+	if(!stand) {
+		return;
+	}
+
+	//the same choice unit_animation_team_colored makes.
+	if(side >= 0) {
+		loader.add_team_color(stand->attr("image"), side);
+	} else {
+		loader.add(stand->attr("image"));
+	}
+}
+
 void unit_avatar::draw(int time) const
 {
 	int x = tile_center_x(unit_->loc());
@@ -9,10 +9,18 @@
 
 class unit_animation_set;
 
+namespace graphics {
+class asset_loader;
+}
+
 class unit_avatar
 {
 public:
 	explicit unit_avatar(unit_ptr u);
+
+	//has the loader build the textures an avatar for the unit will use.
+	static void prefetch(const std::string& id, int side, graphics::asset_loader& loader);
+
 	void draw(int time=0) const;
 	void draw(int x, int y, int time=0) const;
 	unit_ptr get_unit() { return unit_; }
@@ -97,9 +97,22 @@ int register_benchmark_cl(const std::string& name, CommandLineBenchmarkTest test
 	return 0;
 }
 
+namespace {
+int64_t benchmark_items = 0;
+std::string benchmark_items_name;
+}
+
+void set_benchmark_items(int64_t items, const std::string& name)
+{
+	benchmark_items = items;
+	benchmark_items_name = name;
+}
+
 namespace {
 void run_benchmark(const std::string& name, BenchmarkTest fn)
 {
+	benchmark_items = 0;
+
 	//run it once without counting it to let any initialization code be run.
 	fn(1);
 
@@ -125,7 +138,12 @@ void run_benchmark(const std::string& name, BenchmarkTest fn)
 			}
 
 			const char* units[] = {"ns", "us", "ms", "s"};
-			std::cerr << "BENCH " << name << ": " << nruns << " iterations, " << time_taken_per_iter << units[time_taken_per_iter_units] << "/iteration; total, " << time_taken << units[time_taken_units] << "\n";
+			std::cerr << "BENCH " << name << ": " << nruns << " iterations, " << time_taken_per_iter << units[time_taken_per_iter_units] << "/iteration; total, " << time_taken << units[time_taken_units];
+			if(benchmark_items > 0) {
+				std::cerr << "; " << (double(benchmark_items)*nruns/(time_taken_ms*1000.0)) << "M " << benchmark_items_name << "/s";
+			}
+
+			std::cerr << "\n";
 			return;
 		}
 	}
@@ -1,6 +1,8 @@
 #ifndef UNIT_TEST_HPP_INCLUDED
 #define UNIT_TEST_HPP_INCLUDED
 
+#include <stdint.h>
+
 #include <boost/function.hpp>
 
 #include <iostream>
@@ -26,6 +28,10 @@ void run_benchmarks(const std::vector<std::string>* benchmarks=NULL);
 void run_command_line_benchmark(const std::string& benchmark_name, const std::string& arg);
 void run_utility(const std::string& utility_name, const std::vector<std::string>& arg);
 
+//called from within a benchmark to say how many items, such as pixels or
+//bytes, each iteration processes. The results then include a throughput.
+void set_benchmark_items(int64_t items, const std::string& name);
+
 }
 
 #define CHECK(cond, msg) if(!(cond)) { std::cerr << __FILE__ << ":" << __LINE__ << ": TEST CHECK FAILED: " << #cond << ": " << msg << "\n"; throw test::failure_exception(); }
@@ -5,6 +5,8 @@
 
 #include "filesystem.hpp"
 #include "foreach.hpp"
+#include "logging.hpp"
+#include "metrics.hpp"
 #include "server.hpp"
 #include "string_utils.hpp"
 #include "web_server.hpp"
@@ -27,16 +29,21 @@ void web_server::start_accept()
 
 namespace {
 int nconnections = 0;
+
+metrics::counter connections_accepted("wizard_connections_accepted_total", "listener", "web", "Connections accepted.");
+metrics::counter bytes_received("wizard_bytes_received_total", "listener", "web", "Bytes read from clients.");
+metrics::counter bytes_sent("wizard_bytes_sent_total", "listener", "web", "Bytes written to clients.");
 }
 
 void web_server::handle_accept(socket_ptr socket, const boost::system::error_code& error)
 {
 	if(error) {
-		std::cerr << "ERROR IN ACCEPT\n";
+		LOG_ERROR("error in accept: " << error.message());
 		return;
 	}
 
-	std::cerr << "RECEIVED CONNECTION. Listening " << ++nconnections << "\n";
+	LOG_DEBUG("received connection " << ++nconnections);
+	connections_accepted.add();
 
 	start_receive(socket);
 
@@ -53,12 +60,12 @@ void web_server::handle_receive(socket_ptr socket, buffer_ptr buf, const boost::
 {
 	if(e) {
 		//TODO: handle error
-		std::cerr << "SOCKET ERROR: " << e.message() << "\n";
-		std::cerr << "CLOSESOCKA\n";
+		LOG_WARN("socket error: " << e.message());
 		disconnect(socket);
 		return;
 	}
 
+	bytes_received.add(nbytes);
 	handle_incoming_data(socket, &(*buf)[0], &(*buf)[0] + nbytes);
 
 //	start_receive(socket);
@@ -80,7 +87,7 @@ Request parse_request(const std::string& str) {
 	Request request;
 	request.path.assign(str.begin(), end_path);
 
-	std::cerr << "PATH: '" << request.path << "'\n";
+	LOG_DEBUG("path: '" << request.path << "'");
 
 	if(end_path != str.end()) {
 		++end_path;
@@ -93,7 +100,7 @@ Request parse_request(const std::string& str) {
 				const std::string value(equal_itor+1, a.end());
 				request.args[name] = value;
 
-				std::cerr << "ARG: " << name << " -> " << value << "\n";
+				LOG_DEBUG("arg: " << name << " -> " << value);
 			}
 		}
 	}
@@ -117,7 +124,7 @@ std::map<std::string, std::string> parse_env(const std::string& str)
 		std::transform(key.begin(), key.end(), key.begin(), tolower);
 		env[key] = value;
 
-		std::cerr << "PARM: " << key << " -> " << value << "\n";
+		LOG_DEBUG("parm: " << key << " -> " << value);
 	}
 
 	return env;
@@ -128,17 +135,15 @@ std::map<std::string, std::string> parse_env(const std::string& str)
 void web_server::handle_message(socket_ptr socket, const std::string& msg)
 {
 	if(msg.size() < 16) {
-		std::cerr << "CLOSESOCKB\n";
 		disconnect(socket);
 		return;
 	}
 
-	std::cerr << "MESSAGE RECEIVED: " << msg << "\n";
+	LOG_DEBUG("message received: " << msg);
 
 	if(std::equal(msg.begin(), msg.begin()+4, "GET ")) {
 		std::string::const_iterator end_url = std::find(msg.begin()+4, msg.end(), ' ');
 		if(end_url == msg.end()) {
-		std::cerr << "CLOSESOCKC\n";
 			disconnect(socket);
 			return;
 		}
@@ -150,11 +155,9 @@ void web_server::handle_message(socket_ptr socket, const std::string& msg)
 		boost::algorithm::replace_first(request.path, "/dave/wizard-images/", "alpha-images/");
 		boost::algorithm::replace_first(request.path, "/dave/", "www/");
 
-		std::cerr << "MESSAGE: (((" << msg.c_str() << ")))\n";
-
 		std::string::const_iterator begin_env = std::find(msg.begin(), msg.end(), '\n');
 		if(begin_env == msg.end()) {
-			std::cerr << "COULD NOT FIND ENV\n";
+			LOG_WARN("could not find env in request");
 			return;
 		}
 
@@ -162,7 +165,12 @@ void web_server::handle_message(socket_ptr socket, const std::string& msg)
 
 		std::map<std::string, std::string> env = parse_env(std::string(begin_env, msg.end()));
 
-		if(request.path == "/" && request.args.count("user")) {
+		if(request.path == "/stats") {
+			std::string stats;
+			metrics::write_stats(stats);
+			server_.write_stats(stats);
+			send_msg(socket, "text/plain; version=0.0.4", stats);
+		} else if(request.path == "/" && request.args.count("user")) {
 			std::string contents = sys::read_file("www/main_template.html");
 			boost::algorithm::replace_first(contents, "__HOSTNAME__", env["host"]);
 			boost::algorithm::replace_first(contents, "__USERID__", request.args["user"]);
@@ -187,7 +195,7 @@ void web_server::handle_message(socket_ptr socket, const std::string& msg)
 
 			const std::string content = sys::read_file(request.path);
 			if(!content.empty()) {
-				std::cerr << "SENDING FILE " << request.path << " -> " << content.size() << "\n";
+				LOG_DEBUG("sending file " << request.path << " -> " << content.size());
 				send_msg(socket, content_type, content);
 			} else {
 				send_404(socket);
@@ -208,11 +216,11 @@ void web_server::handle_message(socket_ptr socket, const std::string& msg)
 			const int content_length = atoi(env["content-length"].c_str());
 			buf.resize(content_length);
 			const size_t nbytes = socket->read_some(boost::asio::buffer(buf));
+			bytes_received.add(nbytes);
 
-			std::cerr << "POST READ " << nbytes << "/" << buf.size() << "\n";
+			LOG_DEBUG("post read " << nbytes << "/" << buf.size());
 			if(nbytes == buf.size() && !buf.empty()) {
 				buf.push_back(0);
-				std::cerr << "(((" << &buf[0] << ")))\n";
 				begin_msg = &buf[0];
 				begin_xml = strstr(begin_msg+1, "\n<");
 			}
@@ -233,23 +241,28 @@ void web_server::handle_message(socket_ptr socket, const std::string& msg)
 
 		std::string user(begin_user, begin_xml);
 
-		std::cerr << "USER: (" << user << ")\n";
+		//the headers come before the line giving the user, unless that
+		//arrived separately, in which case they're the whole message.
+		const char* end_headers = begin_msg == msg.c_str() ? begin_user : msg.c_str() + msg.size();
+		std::map<std::string, std::string> env = parse_env(std::string(msg.c_str(), end_headers));
+		const bool accepts_gzip = env["accept-encoding"].find("gzip") != std::string::npos;
+
+		LOG_DEBUG_FIELDS(logging::fields().nick(user), "ajax post");
 
 		++begin_xml;
 
 		std::vector<char> xml_msg(begin_xml, begin_xml + strlen(begin_xml));
 
-		server_.adopt_ajax_socket(socket, user, xml_msg);
+		server_.adopt_ajax_socket(socket, user, xml_msg, accepts_gzip);
 	} else {
-		std::cerr << "CLOSESOCKE\n";
 		disconnect(socket);
 	}
 }
 
 void web_server::handle_send(socket_ptr socket, const boost::system::error_code& e, size_t nbytes, size_t max_bytes, boost::shared_ptr<std::string> buf)
 {
-	std::cerr << "SENT: " << nbytes << " / " << max_bytes << " " << e << "\n";
-		std::cerr << "CLOSESOCKF\n";
+	LOG_DEBUG("sent: " << nbytes << " / " << max_bytes << " " << e);
+	bytes_sent.add(nbytes);
 	if(nbytes == max_bytes) {
 		disconnect(socket);
 	}
@@ -12,6 +12,8 @@
 */
 #include <algorithm>
 
+#include "foreach.hpp"
+#include "unit_test.hpp"
 #include "wml_node.hpp"
 
 namespace wml
@@ -19,11 +21,55 @@ namespace wml
 
 namespace {
 	const value empty_value("");
+	const std::vector<std::string> empty_attr_order;
+	const std::map<std::string, wml::const_node_ptr> empty_base_elements;
+
+	struct attr_key_less {
+		bool operator()(const node::attr_map::value_type& a, const std::string& b) const {
+			return a.first < b;
+		}
+	};
+
+	node::attr_map::const_iterator find_attr(const node::attr_map& attr, const std::string& key)
+	{
+		node::attr_map::const_iterator i = std::lower_bound(attr.begin(), attr.end(), key, attr_key_less());
+		if(i != attr.end() && i->first == key) {
+			return i;
+		}
+
+		return attr.end();
+	}
+}
+
+struct node::metadata {
+	metadata() : schema(NULL)
+	{}
+
+	const wml::schema* schema;
+	std::string comment;
+	std::map<std::string, std::string> attr_comments;
+	std::vector<std::string> attr_order;
+	std::map<std::string, wml::const_node_ptr> base_elements;
+};
+
+node::node(const std::string& name) : name_(name)
+{}
+
+node::~node()
+{}
+
+node::metadata& node::get_metadata()
+{
+	if(!metadata_) {
+		metadata_.reset(new metadata);
+	}
+
+	return *metadata_;
 }
 
 const value& node::operator[](const std::string& key) const
 {
-		attr_map::const_iterator itor = attr_.find(key);
+		attr_map::const_iterator itor = find_attr(attr_, key);
 		if(itor == attr_.end()) {
 			return empty_value;
 		}
@@ -38,7 +84,18 @@ const value& node::attr(const std::string& key) const
 
 void node::set_attr(const std::string& key, const value& val)
 {
-	attr_[key] = val;
+	//attributes are usually written in order, so check the end first.
+	if(attr_.empty() || attr_.back().first < key) {
+		attr_.push_back(attr_map::value_type(key, val));
+		return;
+	}
+
+	attr_map::iterator i = std::lower_bound(attr_.begin(), attr_.end(), key, attr_key_less());
+	if(i != attr_.end() && i->first == key) {
+		i->second = val;
+	} else {
+		attr_.insert(i, attr_map::value_type(key, val));
+	}
 }
 
 void node::set_or_erase_attr(const std::string& key, const std::string& value)
@@ -46,21 +103,26 @@ void node::set_or_erase_attr(const std::string& key, const std::string& value)
 	if(value.empty() == false) {
 		set_attr(key,value);
 	} else {
-		attr_.erase(key);
+		erase_attr(key);
 	}
 }
 
 void node::erase_attr(const std::string& key)
 {
-	attr_.erase(key);
-	if(!attr_order_.empty()) {
-		attr_order_.erase(std::find(attr_order_.begin(), attr_order_.end(), key));
+	attr_map::iterator i = std::lower_bound(attr_.begin(), attr_.end(), key, attr_key_less());
+	if(i != attr_.end() && i->first == key) {
+		attr_.erase(i);
+	}
+
+	if(metadata_) {
+		std::vector<std::string>& attr_order = metadata_->attr_order;
+		attr_order.erase(std::remove(attr_order.begin(), attr_order.end(), key), attr_order.end());
 	}
 }
 
 bool node::has_attr(const std::string& key) const
 {
-	attr_map::const_iterator itor = attr_.find(key);
+	attr_map::const_iterator itor = find_attr(attr_, key);
 	return itor != attr_.end() && itor->second.empty() == false;
 }
 
@@ -76,33 +138,33 @@ node::const_attr_iterator node::end_attr() const
 
 node::child_iterator node::begin_child(const std::string& key)
 {
-	return childmap_.lower_bound(key);
+	return child_iterator(children_.begin(), children_.end(), key);
 }
 
 node::const_child_iterator node::begin_child(const std::string& key) const
 {
-	return childmap_.lower_bound(key);
+	return const_child_iterator(children_.begin(), children_.end(), key);
 }
 
 node::child_iterator node::end_child(const std::string& key)
 {
-	return childmap_.upper_bound(key);
+	return child_iterator(children_.end(), children_.end(), key);
 }
 
 node::const_child_iterator node::end_child(const std::string& key) const
 {
-	return childmap_.upper_bound(key);
+	return const_child_iterator(children_.end(), children_.end(), key);
 }
 
 node::child_range node::get_child_range(const std::string& key)
 {
-	return childmap_.equal_range(key);
+	return child_range(begin_child(key), end_child(key));
 }
 
 node::const_child_range
 node::get_child_range(const std::string& key) const
 {
-	return childmap_.equal_range(key);
+	return const_child_range(begin_child(key), end_child(key));
 }
 
 node::all_child_iterator node::begin_children()
@@ -127,28 +189,29 @@ node::const_all_child_iterator node::end_children() const
 
 void node::add_child(boost::shared_ptr<node> child)
 {
-	childmap_.insert(std::pair<std::string,boost::shared_ptr<node> >(
-							child->name(),child));
 	children_.push_back(child);
 }
 
 const_node_ptr node::get_child(const std::string& key) const
 {
-	const const_child_range range = get_child_range(key);
-	if(range.first == range.second) {
-		return const_node_ptr();
-	} else {
-		return range.first->second;
+	for(const_all_child_iterator i = children_.begin(); i != children_.end(); ++i) {
+		if((*i)->name() == key) {
+			return *i;
+		}
 	}
+
+	return const_node_ptr();
 }
+
 node_ptr node::get_child(const std::string& key)
 {
-	const child_range range = get_child_range(key);
-	if(range.first == range.second) {
-		return node_ptr();
-	} else {
-		return range.first->second;
+	for(all_child_iterator i = children_.begin(); i != children_.end(); ++i) {
+		if((*i)->name() == key) {
+			return *i;
+		}
 	}
+
+	return node_ptr();
 }
 
 void node::clear_attr()
@@ -158,7 +221,6 @@ void node::clear_attr()
 
 void node::clear_children()
 {
-	childmap_.clear();
 	children_.clear();
 }
 
@@ -177,21 +239,11 @@ public:
 
 void node::clear_children(const std::string& name)
 {
-	childmap_.erase(name);
 	children_.erase(std::remove_if(children_.begin(),children_.end(),node_name_equals(name)), children_.end());
 }
 
 void node::erase_child(const boost::shared_ptr<node>& child_node)
 {
-	child_range range = get_child_range(child_node->name());
-	while(range.first != range.second) {
-		if(range.first->second == child_node) {
-			childmap_.erase(range.first);
-			break;
-		}
-		++range.first;
-	}
-
 	std::vector<boost::shared_ptr<node> >::iterator i = std::find(children_.begin(),children_.end(),child_node);
 	if(i != children_.end()) {
 		children_.erase(i);
@@ -200,55 +252,89 @@ void node::erase_child(const boost::shared_ptr<node>& child_node)
 
 void node::set_comment(const std::string& comment)
 {
-	comment_ = comment;
+	if(metadata_ || comment.empty() == false) {
+		get_metadata().comment = comment;
+	}
 }
 
 const std::string& node::get_comment() const
 {
-	return comment_;
+	return metadata_ ? metadata_->comment : empty_value.str();
 }
 
 void node::set_attr_comment(const std::string& name, const std::string& comment)
 {
-	attr_comments_[name] = comment;
+	get_metadata().attr_comments[name] = comment;
 }
 
 const std::string& node::get_attr_comment(const std::string& name) const
 {
-	attr_map::const_iterator i = attr_comments_.find(name);
-	if(i != attr_comments_.end()) {
+	if(!metadata_) {
+		return empty_value.str();
+	}
+
+	std::map<std::string, std::string>::const_iterator i = metadata_->attr_comments.find(name);
+	if(i != metadata_->attr_comments.end()) {
 		return i->second;
 	} else {
-		return empty_value;
+		return empty_value.str();
+	}
+}
+
+const schema* node::get_schema() const
+{
+	return metadata_ ? metadata_->schema : NULL;
+}
+
+void node::set_schema(const schema* s)
+{
+	if(metadata_ || s) {
+		get_metadata().schema = s;
 	}
 }
 
 void node::add_attr_order(const std::string& attr)
 {
-	attr_order_.push_back(attr);
+	get_metadata().attr_order.push_back(attr);
+}
+
+const std::vector<std::string>& node::attr_order() const
+{
+	return metadata_ ? metadata_->attr_order : empty_attr_order;
 }
 
 void node::set_base_element(const std::string& key, wml::const_node_ptr node)
 {
-	base_elements_[key] = node;
+	get_metadata().base_elements[key] = node;
 }
 
 wml::const_node_ptr node::get_base_element(const std::string& key) const
 {
-	std::map<std::string, wml::const_node_ptr>::const_iterator itor = base_elements_.find(key);
-	if(itor != base_elements_.end()) {
+	if(!metadata_) {
+		return wml::const_node_ptr();
+	}
+
+	std::map<std::string, wml::const_node_ptr>::const_iterator itor = metadata_->base_elements.find(key);
+	if(itor != metadata_->base_elements.end()) {
 		return itor->second;
 	} else {
 		return wml::const_node_ptr();
 	}
 }
 
+const std::map<std::string, wml::const_node_ptr>& node::base_elements() const
+{
+	return metadata_ ? metadata_->base_elements : empty_base_elements;
+}
+
 void node::strip_prettiness()
 {
-	comment_.clear();
-	attr_comments_.clear();
-	attr_order_.clear();
-	base_elements_.clear();
+	//the schema is all that is left once the rest is gone.
+	if(metadata_) {
+		const schema* s = metadata_->schema;
+		metadata_.reset();
+		set_schema(s);
+	}
 
 	for(std::vector<boost::shared_ptr<node> >::iterator i = children_.begin();
 	    i != children_.end(); ++i) {
@@ -256,5 +342,55 @@ void node::strip_prettiness()
 	}
 }
 
+}
+
+UNIT_TEST(wml_node) {
+	wml::node_ptr node(new wml::node("a"));
+	node->set_attr("y", "1");
+	node->set_attr("x", "2");
+	node->set_attr("z", "3");
+	node->set_attr("x", "4");
+	node->erase_attr("z");
+
+	std::string attr;
+	for(wml::node::const_attr_iterator i = node->begin_attr(); i != node->end_attr(); ++i) {
+		attr += i->first + "=" + i->second.str() + " ";
+	}
+
+	CHECK_EQ(attr, "x=4 y=1 ");
+	CHECK_EQ(node->attr("y").str(), "1");
+	CHECK(!node->has_attr("z"), "erased attribute still present");
+
+	const char* names[] = { "b", "c", "b", "d", "b" };
+	foreach(const char* name, names) {
+		node->add_child(wml::node_ptr(new wml::node(name)));
+	}
+
+	int count = 0;
+	wml::node::const_child_range range = wml::const_node_ptr(node)->get_child_range("b");
+	for(; range.first != range.second; ++range.first) {
+		CHECK_EQ(range.first->second->name(), "b");
+		++count;
+	}
 
+	CHECK_EQ(count, 3);
+	CHECK(node->begin_child("e") == node->end_child("e"), "found a child which doesn't exist");
+
+	//the iterator refers to the node's own pointer to the child, so
+	//assigning through it replaces the child.
+	wml::node::child_iterator b = node->begin_child("b");
+	CHECK(&b->second == &node->begin_children()[0], "the iterator refers to a copy");
+	b->second = wml::node_ptr(new wml::node("e"));
+	CHECK_EQ(node->begin_children()[0]->name(), "e");
+	b->second = wml::node_ptr(new wml::node("b"));
+
+	node->erase_child(node->get_child("b"));
+	node->clear_children("d");
+	CHECK_EQ(node->begin_children()[0]->name(), "c");
+	CHECK_EQ(node->end_children() - node->begin_children(), 3);
+
+	CHECK(node->attr_order().empty(), "unexpected attribute order");
+	node->set_comment("comment");
+	node->strip_prettiness();
+	CHECK_EQ(node->get_comment(), "");
 }
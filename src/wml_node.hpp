@@ -13,9 +13,12 @@
 #ifndef WML_NODE_HPP_INCLUDED
 #define WML_NODE_HPP_INCLUDED
 
+#include <boost/scoped_ptr.hpp>
 #include <boost/shared_ptr.hpp>
+#include <iterator>
 #include <map>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "wml_node_fwd.hpp"
@@ -26,12 +29,99 @@ namespace wml
 
 class schema;
 
-class node
+//iterates over those children of a node which have a given name. Like
+//the multimap children used to be kept in, the child is found in the
+//'second' member of what the iterator points to, which refers to the
+//node's own pointer to the child: assigning to it through a
+//child_iterator replaces the child. Like iterators into a vector, these
+//are invalidated by adding or removing children of the node.
+template<typename Iterator>
+class named_child_iterator
 {
 public:
-	explicit node(const std::string& name) : name_(name), schema_(NULL)
+	struct entry {
+		typename std::iterator_traits<Iterator>::reference second;
+	};
+
+	//operator-> returns this, so there is an entry for it to point to.
+	class arrow_proxy {
+	public:
+		explicit arrow_proxy(const entry& e) : entry_(e)
+		{}
+
+		const entry* operator->() const { return &entry_; }
+	private:
+		entry entry_;
+	};
+
+	typedef std::forward_iterator_tag iterator_category;
+	typedef entry value_type;
+	typedef ptrdiff_t difference_type;
+	typedef arrow_proxy pointer;
+	typedef entry reference;
+
+	named_child_iterator() : name_(NULL)
+	{}
+
+	named_child_iterator(Iterator i, Iterator end, const std::string& name)
+	  : i_(i), end_(end), name_(NULL)
+	{
+		while(i_ != end_ && (*i_)->name() != name) {
+			++i_;
+		}
+
+		//the name given is often a temporary, so compare against the
+		//name of the first match from now on.
+		if(i_ != end_) {
+			name_ = &(*i_)->name();
+		}
+	}
+
+	template<typename OtherIterator>
+	named_child_iterator(const named_child_iterator<OtherIterator>& o)
+	  : i_(o.base()), end_(o.end()), name_(o.name())
 	{}
 
+	reference operator*() const { const entry e = { *i_ }; return e; }
+	pointer operator->() const { return arrow_proxy(**this); }
+
+	named_child_iterator& operator++() {
+		++i_;
+		while(i_ != end_ && (*i_)->name() != *name_) {
+			++i_;
+		}
+
+		return *this;
+	}
+
+	named_child_iterator operator++(int) {
+		named_child_iterator res(*this);
+		++*this;
+		return res;
+	}
+
+	bool operator==(const named_child_iterator& o) const { return i_ == o.i_; }
+	bool operator!=(const named_child_iterator& o) const { return i_ != o.i_; }
+
+	const Iterator& base() const { return i_; }
+	const Iterator& end() const { return end_; }
+	const std::string* name() const { return name_; }
+private:
+	Iterator i_, end_;
+	const std::string* name_;
+};
+
+//Game snapshots create thousands of nodes, so a node keeps only what
+//nearly every node uses in line: attributes in a vector sorted by key
+//and children in a single vector. Comments, attribute order, base
+//elements and the schema are only used by documents being edited, and
+//are allocated the first time one of them is set.
+class node
+{
+public:
+	explicit node(const std::string& name);
+	~node();
+
 	void set_prefix(const std::string& p) { prefix_ = p; }
 	const std::string& prefix() const { return prefix_; }
 	const std::string& name() const { return name_; }
@@ -45,25 +135,23 @@ public:
 
 	bool has_attr(const std::string& key) const;
 
-	typedef std::map<std::string,value> attr_map;
+	typedef std::vector<std::pair<std::string,value> > attr_map;
 	typedef attr_map::const_iterator const_attr_iterator;
 	const_attr_iterator begin_attr() const;
 	const_attr_iterator end_attr() const;
 
-	typedef std::multimap<std::string,boost::shared_ptr<node> >::
-			iterator child_iterator;
-	typedef std::multimap<std::string,boost::shared_ptr<node> >::
-			const_iterator const_child_iterator;
-
-	typedef std::pair<child_iterator,child_iterator> child_range;
-	typedef std::pair<const_child_iterator,const_child_iterator>
-	        const_child_range;
-
 	typedef std::vector<boost::shared_ptr<node> >::iterator
 			all_child_iterator;
 	typedef std::vector<boost::shared_ptr<node> >::const_iterator
 			const_all_child_iterator;
 
+	typedef named_child_iterator<all_child_iterator> child_iterator;
+	typedef named_child_iterator<const_all_child_iterator> const_child_iterator;
+
+	typedef std::pair<child_iterator,child_iterator> child_range;
+	typedef std::pair<const_child_iterator,const_child_iterator>
+	        const_child_range;
+
 	child_iterator begin_child(const std::string& key);
 	const_child_iterator begin_child(const std::string& key) const;
 
@@ -94,34 +182,31 @@ public:
 	void set_attr_comment(const std::string& name, const std::string& comment);
 	const std::string& get_attr_comment(const std::string& name) const;
 
-	const schema* get_schema() const { return schema_; }
-	void set_schema(const schema* s) { schema_ = s; }
+	const schema* get_schema() const;
+	void set_schema(const schema* s);
 
 	void add_attr_order(const std::string& attr);
-	const std::vector<std::string>& attr_order() const { return attr_order_; }
+	const std::vector<std::string>& attr_order() const;
 
 	void set_base_element(const std::string& key, wml::const_node_ptr node);
 	wml::const_node_ptr get_base_element(const std::string& key) const;
 
-	const std::map<std::string, wml::const_node_ptr>& base_elements() const { return base_elements_; }
+	const std::map<std::string, wml::const_node_ptr>& base_elements() const;
 
 	void strip_prettiness();
 
 private:
+	node(const node&);
+	void operator=(const node&);
+
+	struct metadata;
+	metadata& get_metadata();
+
 	std::string name_, prefix_;
 	attr_map attr_;
-	std::multimap<std::string,boost::shared_ptr<node> > childmap_;
 	std::vector<boost::shared_ptr<node> > children_;
 
-	const schema* schema_;
-
-	//comment data
-	std::string comment_;
-	attr_map attr_comments_;
-
-	std::vector<std::string> attr_order_;
-
-	std::map<std::string, wml::const_node_ptr> base_elements_;
+	boost::scoped_ptr<metadata> metadata_;
 };
 
 }
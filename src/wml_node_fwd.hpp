@@ -19,6 +19,7 @@ namespace wml
 {
 
 class node;
+class visitor;
 typedef boost::shared_ptr<node> node_ptr;
 typedef boost::shared_ptr<const node> const_node_ptr;
 
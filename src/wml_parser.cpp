@@ -567,7 +567,7 @@ node_ptr parse_wml(const std::string& doc, bool must_have_doc, const schema* sch
 
 node_ptr parse_wml_from_file(const std::string& fname, const schema* schema, bool must_have_doc)
 {
-	const std::string data = preprocess(sys::read_file(fname));
+	const std::string data = preprocess_file(fname);
 	return parse_xml(data);
 /*
 	if(data.empty()) {
@@ -78,6 +78,33 @@ void copy_over(const_node_ptr src, node_ptr dst)
 	merge_over(src, dst);
 }
 
+bool equal(const_node_ptr a, const_node_ptr b)
+{
+	if(a->name() != b->name() ||
+	   a->end_attr() - a->begin_attr() != b->end_attr() - b->begin_attr() ||
+	   a->end_children() - a->begin_children() != b->end_children() - b->begin_children()) {
+		return false;
+	}
+
+	//attributes are kept sorted by key, so equal nodes have them in the
+	//same order.
+	for(node::const_attr_iterator i = a->begin_attr(), j = b->begin_attr();
+	    i != a->end_attr(); ++i, ++j) {
+		if(i->first != j->first || i->second.str() != j->second.str()) {
+			return false;
+		}
+	}
+
+	for(node::const_all_child_iterator i = a->begin_children(), j = b->begin_children();
+	    i != a->end_children(); ++i, ++j) {
+		if(!wml::equal(*i, *j)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
 node_ptr find_child_by_attribute(node_ptr node, const std::string& element_name, const std::string& attr, const std::string& value)
 {
 	node::child_iterator i1 = node->begin_child(element_name);
@@ -47,6 +47,10 @@ void merge_attr_over(const_node_ptr src, node_ptr dst);
 void merge_over(const_node_ptr src, node_ptr dst);
 void copy_over(const_node_ptr src, node_ptr dst);
 
+//whether two nodes have the same name, attributes and children, with
+//the children in the same order. Comments and schemas are ignored.
+bool equal(const_node_ptr a, const_node_ptr b);
+
 //find a child which has a given attribute matching
 node_ptr find_child_by_attribute(node_ptr node, const std::string& element_name, const std::string& attr, const std::string& value);
 
@@ -0,0 +1,54 @@
+#include <stdio.h>
+
+#include "asserts.hpp"
+#include "wml_node.hpp"
+#include "wml_visitor.hpp"
+
+namespace wml
+{
+
+visitor::~visitor()
+{}
+
+void visitor::attr(const std::string& name, const char* value)
+{
+	attr(name, std::string(value));
+}
+
+void visitor::attr(const std::string& name, int value)
+{
+	char buf[16];
+	const int len = snprintf(buf, sizeof(buf), "%d", value);
+	attr(name, std::string(buf, len));
+}
+
+node_builder::node_builder()
+{}
+
+void node_builder::begin_element(const std::string& name)
+{
+	node_ptr node(new wml::node(name));
+	if(stack_.empty()) {
+		if(!result_) {
+			result_ = node;
+		}
+	} else {
+		stack_.back()->add_child(node);
+	}
+
+	stack_.push_back(node);
+}
+
+void node_builder::attr(const std::string& name, const std::string& value)
+{
+	ASSERT_LOG(stack_.empty() == false, "attribute " << name << " given outside of any element");
+	stack_.back()->set_attr(name, value);
+}
+
+void node_builder::end_element()
+{
+	ASSERT_LOG(stack_.empty() == false, "element ended when none was begun");
+	stack_.pop_back();
+}
+
+}
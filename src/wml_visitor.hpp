@@ -0,0 +1,49 @@
+#ifndef WML_VISITOR_HPP_INCLUDED
+#define WML_VISITOR_HPP_INCLUDED
+
+#include <string>
+#include <vector>
+
+#include "wml_node_fwd.hpp"
+
+namespace wml
+{
+
+//receives a document one piece at a time, so that objects can describe
+//their state once and have it written straight to whatever form is
+//wanted, without building a tree of nodes first. All of an element's
+//attributes must be given before its first child.
+class visitor
+{
+public:
+	virtual ~visitor();
+
+	virtual void begin_element(const std::string& name) = 0;
+	virtual void attr(const std::string& name, const std::string& value) = 0;
+	virtual void end_element() = 0;
+
+	void attr(const std::string& name, const char* value);
+	void attr(const std::string& name, int value);
+};
+
+//builds a tree of nodes from what it's given.
+class node_builder : public visitor
+{
+public:
+	node_builder();
+
+	void begin_element(const std::string& name);
+	void attr(const std::string& name, const std::string& value);
+	void end_element();
+	using visitor::attr;
+
+	//the first top level element given.
+	const node_ptr& result() const { return result_; }
+private:
+	node_ptr result_;
+	std::vector<node_ptr> stack_;
+};
+
+}
+
+#endif
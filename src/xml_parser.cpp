@@ -11,6 +11,7 @@
    See the COPYING file for more details.
 */
 #include <cassert>
+#include <algorithm>
 #include <cctype>
 #include <iostream>
 #include <map>
@@ -19,10 +20,13 @@
 #include <string>
 #include <vector>
 
+#include <stdlib.h>
 #include <string.h>
 
+#include <boost/make_shared.hpp>
 #include <boost/shared_ptr.hpp>
 
+#include "arena_allocator.hpp"
 #include "asserts.hpp"
 #include "concurrent_cache.hpp"
 #include "filesystem.hpp"
@@ -55,9 +59,10 @@ wml::node_ptr xml_to_wml(const TiXmlElement& el)
 
 	return res;
 }
-}
 
-node_ptr parse_xml(const std::string& str)
+//the old way of parsing, through a TinyXML document. Kept to check the
+//parser below against.
+node_ptr parse_xml_with_tinyxml(const std::string& str)
 {
 	TiXmlDocument doc;
 	doc.Parse(str.c_str());
@@ -66,6 +71,395 @@ node_ptr parse_xml(const std::string& str)
 	return xml_to_wml(*el);
 }
 
+bool is_space(char c)
+{
+	return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+bool is_name_char(char c)
+{
+	return !is_space(c) && c != '=' && c != '/' && c != '>' && c != '<' && c != '"' && c != '\'' && c != 0;
+}
+
+//writes the code point c as UTF-8, returning the end of what was written.
+char* write_utf8(unsigned int c, char* out)
+{
+	if(c < 0x80) {
+		*out++ = c;
+	} else if(c < 0x800) {
+		*out++ = 0xC0 | (c >> 6);
+		*out++ = 0x80 | (c & 0x3F);
+	} else if(c < 0x10000) {
+		*out++ = 0xE0 | (c >> 12);
+		*out++ = 0x80 | ((c >> 6) & 0x3F);
+		*out++ = 0x80 | (c & 0x3F);
+	} else {
+		*out++ = 0xF0 | (c >> 18);
+		*out++ = 0x80 | ((c >> 12) & 0x3F);
+		*out++ = 0x80 | ((c >> 6) & 0x3F);
+		*out++ = 0x80 | (c & 0x3F);
+	}
+
+	return out;
+}
+
+//reads the code point of a character reference, such as "#65" or "#x41",
+//returning false if it isn't all digits or isn't a character which can
+//be written: NUL, a surrogate or beyond the last code point.
+bool parse_char_ref(const std::string& entity, unsigned int* c)
+{
+	const bool hex = entity.size() > 1 && (entity[1] == 'x' || entity[1] == 'X');
+	const char* digits = entity.c_str() + (hex ? 2 : 1);
+	if(hex ? !isxdigit(*digits) : !isdigit(*digits)) {
+		return false;
+	}
+
+	char* digits_end = NULL;
+	const unsigned long value = strtoul(digits, &digits_end, hex ? 16 : 10);
+	if(*digits_end != 0 || value == 0 || value > 0x10FFFF ||
+	   (value >= 0xD800 && value <= 0xDFFF)) {
+		return false;
+	}
+
+	*c = value;
+	return true;
+}
+
+//elements nested deeper than this are refused, rather than letting a
+//hostile document recurse until the stack runs out.
+const int MaxElementDepth = 256;
+
+//parses a document in a single pass, building WML nodes as it goes.
+//The parser works on its own copy of the text, and decodes entities in
+//attribute values in place, since a decoded value is never longer than
+//the text it came from. Names and values are still copied into the
+//nodes, which own their strings. Text content is skipped, as WML has no
+//place for it. All the nodes of a document are allocated from one
+//arena, which is released once the last of them has gone.
+class xml_reader
+{
+public:
+	xml_reader(char* begin, char* end)
+	  : begin_(begin), pos_(begin), end_(end), depth_(0),
+	    alloc_(arena_ptr(new arena))
+	{}
+
+	node_ptr parse_document() {
+		skip_misc();
+		if(pos_ == end_ || *pos_ != '<') {
+			error("no root element in xml document");
+		}
+
+		++pos_;
+		return parse_element();
+	}
+
+private:
+	void error(const char* msg) {
+		throw parse_error(formatter() << msg << " at offset " << (pos_ - begin_));
+	}
+
+	bool starts_with(const char* str) const {
+		const size_t len = strlen(str);
+		return size_t(end_ - pos_) >= len && memcmp(pos_, str, len) == 0;
+	}
+
+	void skip_past(const char* terminator) {
+		const size_t len = strlen(terminator);
+		while(size_t(end_ - pos_) >= len && memcmp(pos_, terminator, len) != 0) {
+			++pos_;
+		}
+
+		if(size_t(end_ - pos_) < len) {
+			error("unterminated xml markup");
+		}
+
+		pos_ += len;
+	}
+
+	void skip_space() {
+		while(pos_ != end_ && is_space(*pos_)) {
+			++pos_;
+		}
+	}
+
+	//skips anything which isn't an element: declarations, processing
+	//instructions and comments.
+	void skip_misc() {
+		for(;;) {
+			skip_space();
+			if(starts_with("<?")) {
+				skip_past("?>");
+			} else if(starts_with("<!--")) {
+				skip_past("-->");
+			} else if(starts_with("<!")) {
+				skip_past(">");
+			} else {
+				return;
+			}
+		}
+	}
+
+	//skips over a name, returning where it begins; it ends at pos_.
+	char* skip_name() {
+		char* begin = pos_;
+		while(pos_ != end_ && is_name_char(*pos_)) {
+			++pos_;
+		}
+
+		if(pos_ == begin) {
+			error("expected a name in xml document");
+		}
+
+		return begin;
+	}
+
+	//decodes entities in [begin, end) in place and returns the new end.
+	char* decode_entities(char* begin, char* end) {
+		char* out = std::find(begin, end, '&');
+		char* i = out;
+		while(i != end) {
+			if(*i != '&') {
+				*out++ = *i++;
+				continue;
+			}
+
+			char* const search_end = std::min(end, i + 12);
+			char* const semi = std::find(i, search_end, ';');
+			const std::string entity(i + 1, semi);
+			unsigned int c = 0;
+			if(semi == search_end || entity.empty()) {
+				*out++ = *i++;
+				continue;
+			} else if(entity == "amp") {
+				*out++ = '&';
+			} else if(entity == "lt") {
+				*out++ = '<';
+			} else if(entity == "gt") {
+				*out++ = '>';
+			} else if(entity == "quot") {
+				*out++ = '"';
+			} else if(entity == "apos") {
+				*out++ = '\'';
+			} else if(entity[0] == '#' && parse_char_ref(entity, &c)) {
+				out = write_utf8(c, out);
+			} else {
+				//not an entity we know, or not a character, so leave it
+				//alone.
+				*out++ = *i++;
+				continue;
+			}
+
+			i = semi + 1;
+		}
+
+		return out;
+	}
+
+	node_ptr parse_element() {
+		if(++depth_ > MaxElementDepth) {
+			error("xml elements nested too deeply");
+		}
+
+		char* name = skip_name();
+		node_ptr res = boost::allocate_shared<node>(alloc_, std::string(name, pos_));
+
+		for(;;) {
+			skip_space();
+			if(pos_ == end_) {
+				error("unexpected end of xml document in element");
+			}
+
+			if(*pos_ == '/') {
+				++pos_;
+				if(pos_ == end_ || *pos_ != '>') {
+					error("expected '>' after '/'");
+				}
+
+				++pos_;
+				--depth_;
+				return res;
+			}
+
+			if(*pos_ == '>') {
+				++pos_;
+				break;
+			}
+
+			char* attr_begin = skip_name();
+			const std::string attr(attr_begin, pos_);
+			skip_space();
+			if(pos_ == end_ || *pos_ != '=') {
+				error("expected '=' after attribute name");
+			}
+
+			++pos_;
+			skip_space();
+			if(pos_ == end_ || (*pos_ != '"' && *pos_ != '\'')) {
+				error("expected quoted attribute value");
+			}
+
+			const char quote = *pos_++;
+			char* value_begin = pos_;
+			pos_ = std::find(pos_, end_, quote);
+			if(pos_ == end_) {
+				error("unterminated attribute value");
+			}
+
+			char* value_end = decode_entities(value_begin, pos_);
+			++pos_;
+
+			res->set_attr(attr, std::string(value_begin, value_end));
+		}
+
+		for(;;) {
+			pos_ = std::find(pos_, end_, '<');
+			if(pos_ == end_) {
+				error("unexpected end of xml document in element content");
+			}
+
+			if(starts_with("<!--")) {
+				skip_past("-->");
+			} else if(starts_with("<![CDATA[")) {
+				skip_past("]]>");
+			} else if(starts_with("<?")) {
+				skip_past("?>");
+			} else if(starts_with("</")) {
+				pos_ += 2;
+				char* close_begin = skip_name();
+				if(size_t(pos_ - close_begin) != res->name().size() || !std::equal(close_begin, pos_, res->name().begin())) {
+					error("mismatched closing tag");
+				}
+
+				skip_space();
+				if(pos_ == end_ || *pos_ != '>') {
+					error("expected '>' in closing tag");
+				}
+
+				++pos_;
+				--depth_;
+				return res;
+			} else {
+				++pos_;
+				res->add_child(parse_element());
+			}
+		}
+	}
+
+	char* begin_;
+	char* pos_;
+	char* end_;
+	int depth_;
+	arena_allocator<node> alloc_;
+};
+
+}
+
+node_ptr parse_xml(const std::string& str)
+{
+	std::vector<char> buf(str.begin(), str.end());
+	buf.push_back(0);
+	return xml_reader(&buf[0], &buf[0] + str.size()).parse_document();
+}
+
+}
+
+namespace {
+const char* TestDocuments[] = {
+	"<a/>",
+	"<?xml version=\"1.0\"?>\n<!-- comment -->\n<a x=\"1\" y='two'><b z=\"&lt;&amp;&gt;&quot;&apos;\"/>text<c><!-- <d/> --><d w=\"&#65;&#x42;\"></d></c><b z=\"2\" /></a>",
+	"<game width=\"2\" height=\"1\" tiles=\"a,b\">\n\t<player name=\"x\" spells=\"a 0 1,b 0 0\">\n\t</player>\n</game>\n",
+};
+
+std::string output_sorted(wml::const_node_ptr node)
+{
+	std::string res = "<" + node->name();
+	for(wml::node::const_attr_iterator i = node->begin_attr(); i != node->end_attr(); ++i) {
+		res += " " + i->first + "=" + i->second.str();
+	}
+
+	res += ">";
+	for(wml::node::const_all_child_iterator i = node->begin_children(); i != node->end_children(); ++i) {
+		res += output_sorted(*i);
+	}
+
+	return res + "</" + node->name() + ">";
+}
+}
+
+UNIT_TEST(xml_parser_matches_tinyxml) {
+	foreach(const char* doc, TestDocuments) {
+		CHECK_EQ(output_sorted(wml::parse_xml(doc)), output_sorted(wml::parse_xml_with_tinyxml(doc)));
+	}
+
+	wml::node_ptr node = wml::parse_xml(TestDocuments[1]);
+	CHECK_EQ(node->get_child("b")->attr("z").str(), "<&>\"'");
+	CHECK_EQ(node->get_child("c")->get_child("d")->attr("w").str(), "AB");
+
+	//TinyXML drops an ampersand which doesn't begin an entity; we keep it.
+	CHECK_EQ(wml::parse_xml("<a x=\"unknown &entity; and a lone & ampersand\"/>")->attr("x").str(), "unknown &entity; and a lone & ampersand");
+
+	//character references which aren't a character are left as text.
+	CHECK_EQ(wml::parse_xml("<a x=\"&#; &#x; &#0; &#x110000; &#xD800; &#12a; &#-1; &#x 41;\"/>")->attr("x").str(), "&#; &#x; &#0; &#x110000; &#xD800; &#12a; &#-1; &#x 41;");
+	CHECK_EQ(wml::parse_xml("<a x=\"&#x10FFFF;&#xE9;\"/>")->attr("x").str(), "\xF4\x8F\xBF\xBF\xC3\xA9");
+
+	//a child must stay valid after the rest of its document has gone.
+	wml::const_node_ptr child = node->get_child("c");
+	node.reset();
+	CHECK_EQ(child->get_child("d")->attr("w").str(), "AB");
+}
+
+UNIT_TEST(xml_parser_errors) {
+	const char* bad_docs[] = { "", "just text", "<a>", "<a></b>", "<a x=\"1></a>", "<a x></a>" };
+	foreach(const char* doc, bad_docs) {
+		bool threw = false;
+		try {
+			wml::parse_xml(doc);
+		} catch(wml::parse_error& e) {
+			threw = true;
+		}
+
+		CHECK(threw, "no error parsing '" << doc << "'");
+	}
+
+	//nesting is limited, whether or not the document is well formed.
+	std::string deep;
+	for(int n = 0; n != 100000; ++n) {
+		deep += "<a>";
+	}
+
+	bool threw = false;
+	try {
+		wml::parse_xml(deep);
+	} catch(wml::parse_error& e) {
+		threw = true;
+	}
+
+	CHECK(threw, "no error parsing deeply nested elements");
+
+	std::string nested, closing;
+	for(int n = 0; n != 200; ++n) {
+		nested += "<a>";
+		closing += "</a>";
+	}
+
+	CHECK_EQ(wml::parse_xml(nested + closing)->name(), "a");
+}
+
+BENCHMARK(xml_parser)
+{
+	const std::string doc = sys::read_file("data/cards.xml");
+	BENCHMARK_LOOP {
+		wml::parse_xml(doc);
+	}
+}
+
+BENCHMARK(xml_parser_tinyxml)
+{
+	const std::string doc = sys::read_file("data/cards.xml");
+	BENCHMARK_LOOP {
+		wml::parse_xml_with_tinyxml(doc);
+	}
 }
 
 UTILITY(wml_to_xml)
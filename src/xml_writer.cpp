@@ -1,78 +1,331 @@
-#include <iostream>
-#include <set>
+#include <string.h>
+
+#include <algorithm>
+
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/streambuf.hpp>
 
 #include "foreach.hpp"
-#include "string_utils.hpp"
+#include "unit_test.hpp"
 #include "wml_node.hpp"
+#include "xml_parser.hpp"
 #include "xml_writer.hpp"
 
 namespace wml
 {
 
-void write_xml(const wml::const_node_ptr& node, std::string& res)
+namespace {
+
+//Output is produced in two passes over the tree: the first works out
+//exactly how long it will be, so the destination can be grown once, and
+//the second copies it straight into place. Both passes run the same code
+//with a different sink, so they can't disagree about the length.
+
+class size_sink
+{
+public:
+	size_sink() : size_(0)
+	{}
+
+	void put(char c) { ++size_; }
+	void put(const char* s, size_t len) { size_ += len; }
+	void put(const std::string& s) { size_ += s.size(); }
+	void put_indent(int depth) { size_ += depth; }
+
+	void put_escaped(const std::string& s) {
+		size_ += s.size();
+		for(std::string::const_iterator i = s.begin(); i != s.end(); ++i) {
+			switch(*i) {
+			case '&': size_ += 4; break;
+			case '<': size_ += 3; break;
+			case '"': size_ += 5; break;
+			}
+		}
+	}
+
+	size_t size() const { return size_; }
+private:
+	size_t size_;
+};
+
+class memory_sink
+{
+public:
+	explicit memory_sink(char* out) : out_(out)
+	{}
+
+	void put(char c) { *out_++ = c; }
+	void put(const char* s, size_t len) { memcpy(out_, s, len); out_ += len; }
+	void put(const std::string& s) { put(s.data(), s.size()); }
+	void put_indent(int depth) { memset(out_, '\t', depth); out_ += depth; }
+
+	void put_escaped(const std::string& s) {
+		const char* begin = s.data();
+		const char* end = begin + s.size();
+		for(const char* i = begin; i != end; ++i) {
+			const char* entity;
+			switch(*i) {
+			case '&': entity = "&amp;"; break;
+			case '<': entity = "&lt;"; break;
+			case '"': entity = "&quot;"; break;
+			default: continue;
+			}
+
+			put(begin, i - begin);
+			put(entity, strlen(entity));
+			begin = i + 1;
+		}
+
+		put(begin, end - begin);
+	}
+
+	char* end() const { return out_; }
+private:
+	char* out_;
+};
+
+template<typename Sink>
+void write_attr(Sink& out, const std::string& name, const std::string& val, int depth, XML_FORMAT format)
 {
-	std::string indent;
-	write_xml(node,res,indent);
+	if(format == XML_INDENTED) {
+		out.put_indent(depth);
+	} else {
+		out.put(' ');
+	}
+
+	out.put(name);
+	out.put("=\"", 2);
+	out.put_escaped(val);
+	out.put('"');
+	if(format == XML_INDENTED) {
+		out.put('\n');
+	}
+}
+
+bool matches_base(const wml::node* base, const std::string& name, const std::string& val)
+{
+	return base && base->attr(name).str() == val;
 }
 
-void write_xml(const wml::const_node_ptr& node, std::string& res,
-               std::string& indent, wml::const_node_ptr base)
+template<typename Sink>
+void write_node(Sink& out, const wml::node& node, int depth, const wml::node* base, XML_FORMAT format)
 {
-	res += indent + "<";
-	if(node->prefix().empty() == false) {
-		res += node->prefix() + ":";
+	const bool indented = format == XML_INDENTED;
+	if(indented) {
+		out.put_indent(depth);
 	}
-	
-	res += node->name() + " ";
 
-	const std::vector<std::string>& attr_order = node->attr_order();
-	foreach(const std::string& attr, attr_order) {
-		if(base && base->attr(attr).str() == node->attr(attr).str()) {
-			continue;
-		}
+	out.put('<');
+	if(node.prefix().empty() == false) {
+		out.put(node.prefix());
+		out.put(':');
+	}
 
-		res += indent + attr + "=\"" + node->attr(attr).str() + "\"\n";
+	out.put(node.name());
+	if(indented) {
+		out.put(' ');
 	}
 
-	for(wml::node::const_attr_iterator i = node->begin_attr();
-	    i != node->end_attr(); ++i) {
-		if(std::find(attr_order.begin(), attr_order.end(), i->first) != attr_order.end()) {
-			continue;
+	//attributes with an explicit order come first, followed by the rest
+	//in the order they're stored.
+	const std::vector<std::string>& attr_order = node.attr_order();
+	foreach(const std::string& attr, attr_order) {
+		const std::string& val = node.attr(attr).str();
+		if(!matches_base(base, attr, val)) {
+			write_attr(out, attr, val, depth, format);
 		}
+	}
 
-		if(base && base->attr(i->first).str() == i->second.str()) {
+	for(wml::node::const_attr_iterator i = node.begin_attr();
+	    i != node.end_attr(); ++i) {
+		if(!attr_order.empty() && std::find(attr_order.begin(), attr_order.end(), i->first) != attr_order.end()) {
 			continue;
 		}
 
-		res += indent + i->first + "=\"" + i->second.str() + "\"\n";
+		if(!matches_base(base, i->first, i->second.str())) {
+			write_attr(out, i->first, i->second.str(), depth, format);
+		}
 	}
 
-	res += ">\n";
+	if(!indented && node.begin_children() == node.end_children()) {
+		out.put("/>", 2);
+		return;
+	}
 
-	indent.push_back('\t');
+	if(indented) {
+		out.put(">\n", 2);
+	} else {
+		out.put('>');
+	}
 
-	std::set<std::string> base_written;
-	for(wml::node::const_all_child_iterator i = node->begin_children();
-	    i != node->end_children(); ++i) {
-		wml::const_node_ptr base_node = node->get_base_element((*i)->name());
-		if(base_node && base_written.count((*i)->name()) == 0) {
-			base_written.insert((*i)->name());
+	//a base element is written out just before the first child which
+	//uses it. Very few nodes have any, so only keep track when they do.
+	const bool has_bases = node.base_elements().empty() == false;
+	std::vector<const std::string*> base_written;
+	for(wml::node::const_all_child_iterator i = node.begin_children();
+	    i != node.end_children(); ++i) {
+		wml::const_node_ptr base_node;
+		if(has_bases) {
+			base_node = node.get_base_element((*i)->name());
 			if(base_node) {
-				write_xml(base_node, res, indent);
+				bool written = false;
+				foreach(const std::string* name, base_written) {
+					if(*name == (*i)->name()) {
+						written = true;
+						break;
+					}
+				}
+
+				if(!written) {
+					base_written.push_back(&(*i)->name());
+					write_node(out, *base_node, depth + 1, NULL, format);
+				}
 			}
 		}
 
-		write_xml(*i, res, indent, base_node);
+		write_node(out, **i, depth + 1, base_node.get(), format);
+	}
+
+	if(indented) {
+		out.put_indent(depth);
+	}
+
+	out.put("</", 2);
+	if(node.prefix().empty() == false) {
+		out.put(node.prefix());
+		out.put(':');
 	}
-	indent.resize(indent.size()-1);
-	res += indent + "</" + node->name() + ">\n\n";
+
+	out.put(node.name());
+	if(indented) {
+		out.put(">\n\n", 3);
+	} else {
+		out.put('>');
+	}
+}
+
 }
 
-std::string output_xml(const wml::const_node_ptr& node)
+size_t xml_size(const wml::const_node_ptr& node, XML_FORMAT format)
+{
+	size_sink sink;
+	write_node(sink, *node, 0, NULL, format);
+	return sink.size();
+}
+
+char* write_xml(const wml::const_node_ptr& node, char* out, XML_FORMAT format)
+{
+	memory_sink sink(out);
+	write_node(sink, *node, 0, NULL, format);
+	return sink.end();
+}
+
+void write_xml(const wml::const_node_ptr& node, std::string& res, XML_FORMAT format)
+{
+	const size_t start = res.size();
+	const size_t size = xml_size(node, format);
+	res.resize(start + size);
+	if(size) {
+		write_xml(node, &res[start], format);
+	}
+}
+
+void write_xml(const wml::const_node_ptr& node, boost::asio::basic_streambuf<>& buf, XML_FORMAT format)
+{
+	const size_t size = xml_size(node, format);
+	char* out = boost::asio::buffer_cast<char*>(buf.prepare(size));
+	write_xml(node, out, format);
+	buf.commit(size);
+}
+
+std::string output_xml(const wml::const_node_ptr& node, XML_FORMAT format)
 {
 	std::string res;
-	write_xml(node, res);
+	write_xml(node, res, format);
 	return res;
 }
 
+xml_visitor::xml_visitor(std::string& out) : out_(out), in_start_tag_(false)
+{}
+
+void xml_visitor::begin_element(const std::string& name)
+{
+	if(in_start_tag_) {
+		out_ += '>';
+	}
+
+	out_ += '<';
+	out_ += name;
+	stack_.push_back(name);
+	in_start_tag_ = true;
+}
+
+void xml_visitor::attr(const std::string& name, const std::string& value)
+{
+	out_ += ' ';
+	out_ += name;
+	out_ += "=\"";
+
+	const char* begin = value.data();
+	const char* end = begin + value.size();
+	for(const char* i = begin; i != end; ++i) {
+		const char* entity;
+		switch(*i) {
+		case '&': entity = "&amp;"; break;
+		case '<': entity = "&lt;"; break;
+		case '"': entity = "&quot;"; break;
+		default: continue;
+		}
+
+		out_.append(begin, i);
+		out_ += entity;
+		begin = i + 1;
+	}
+
+	out_.append(begin, end);
+	out_ += '"';
+}
+
+void xml_visitor::end_element()
+{
+	if(in_start_tag_) {
+		out_ += "/>";
+		in_start_tag_ = false;
+	} else {
+		out_ += "</";
+		out_ += stack_.back();
+		out_ += '>';
+	}
+
+	stack_.pop_back();
+}
+
+}
+
+UNIT_TEST(xml_writer) {
+	wml::node_ptr node(new wml::node("a"));
+	node->set_attr("x", "1 < 2 && \"3\" > 2");
+	node->set_attr("y", "2");
+	node->add_attr_order("y");
+	wml::node_ptr child(new wml::node("b"));
+	node->add_child(child);
+	child->add_child(wml::node_ptr(new wml::node("c")));
+
+	CHECK_EQ(wml::output_xml(node), "<a y=\"2\"\nx=\"1 &lt; 2 &amp;&amp; &quot;3&quot; > 2\"\n>\n"
+	                                 "\t<b >\n\t\t<c >\n\t\t</c>\n\n\t</b>\n\n</a>\n\n");
+	CHECK_EQ(wml::output_xml(node, wml::XML_COMPACT), "<a y=\"2\" x=\"1 &lt; 2 &amp;&amp; &quot;3&quot; > 2\"><b><c/></b></a>");
+
+	//everything written must read back the same, in either format.
+	for(int format = wml::XML_INDENTED; format <= wml::XML_COMPACT; ++format) {
+		std::string res = "prefix";
+		wml::write_xml(node, res, wml::XML_FORMAT(format));
+		CHECK_EQ(res.size(), strlen("prefix") + wml::xml_size(node, wml::XML_FORMAT(format)));
+		wml::const_node_ptr parsed = wml::parse_xml(res.substr(strlen("prefix")));
+		CHECK_EQ(parsed->attr("x").str(), node->attr("x").str());
+		CHECK(parsed->get_child("b")->get_child("c"), "child missing");
+
+		boost::asio::streambuf buf;
+		wml::write_xml(node, buf, wml::XML_FORMAT(format));
+		CHECK_EQ(std::string(boost::asio::buffer_cast<const char*>(buf.data()), buf.size()), res.substr(strlen("prefix")));
+	}
 }
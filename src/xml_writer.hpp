@@ -1,16 +1,63 @@
 #ifndef XML_WRITER_HPP_INCLUDED
 #define XML_WRITER_HPP_INCLUDED
 
+#include <stddef.h>
+
 #include <string>
+#include <vector>
+
+#include <boost/asio/basic_streambuf_fwd.hpp>
 
 #include "wml_node_fwd.hpp"
+#include "wml_visitor.hpp"
 
 namespace wml
 {
-void write_xml(const wml::const_node_ptr& node, std::string& res);
-void write_xml(const wml::const_node_ptr& node, std::string& res,
-           std::string& indent, wml::const_node_ptr base=wml::const_node_ptr());
-std::string output_xml(const wml::const_node_ptr& node);
+
+enum XML_FORMAT {
+	//one attribute per line with children indented by tabs; for files
+	//people will read.
+	XML_INDENTED,
+
+	//no whitespace between markup at all; for the wire.
+	XML_COMPACT,
+};
+
+//the exact number of bytes write_xml will produce for the node.
+size_t xml_size(const wml::const_node_ptr& node, XML_FORMAT format=XML_INDENTED);
+
+//these append to what is already in the buffer. The output is sized up
+//front, so the buffer grows at most once, and a buffer which is reused
+//between calls won't need to allocate at all.
+void write_xml(const wml::const_node_ptr& node, std::string& res, XML_FORMAT format=XML_INDENTED);
+
+void write_xml(const wml::const_node_ptr& node, boost::asio::basic_streambuf<>& buf, XML_FORMAT format=XML_INDENTED);
+
+//writes into memory which must have room for xml_size() bytes, and
+//returns the end of what was written.
+char* write_xml(const wml::const_node_ptr& node, char* out, XML_FORMAT format=XML_INDENTED);
+
+std::string output_xml(const wml::const_node_ptr& node, XML_FORMAT format=XML_INDENTED);
+
+//appends what it's given to a buffer as XML_COMPACT output, with no
+//tree in between.
+class xml_visitor : public visitor
+{
+public:
+	explicit xml_visitor(std::string& out);
+
+	void begin_element(const std::string& name);
+	void attr(const std::string& name, const std::string& value);
+	void end_element();
+	using visitor::attr;
+private:
+	std::string& out_;
+
+	//names of the elements which are open, and whether the start tag
+	//of the innermost one is still waiting for its closing '>'.
+	std::vector<std::string> stack_;
+	bool in_start_tag_;
+};
 }
 
 #endif
@@ -1147,7 +1147,40 @@ function Game(element) {
 
 var current_games_table = null;
 
+//the games in the lobby by id. The server sends the whole lobby when we
+//enter it, and after that only the games which were added, changed or
+//removed.
+var lobby_games = {};
+
+function update_lobby_games(element) {
+	var games = element.getElementsByTagName('game');
+	for(var n = 0; n != games.length; ++n) {
+		var g = games[n];
+		lobby_games[g.getAttribute('id')] = {
+			id: parseInt(g.getAttribute('id')),
+			clients: g.getAttribute('clients'),
+			started: g.getAttribute('started')
+		};
+	}
+
+	var removed = element.getElementsByTagName('remove_game');
+	for(var n = 0; n != removed.length; ++n) {
+		delete lobby_games[removed[n].getAttribute('id')];
+	}
+}
+
 function handle_lobby(element) {
+	lobby_games = {};
+	update_lobby_games(element);
+	draw_lobby();
+}
+
+function handle_lobby_update(element) {
+	update_lobby_games(element);
+	draw_lobby();
+}
+
+function draw_lobby() {
 
 	if(game != null) {
 		return;
@@ -1162,18 +1195,22 @@ function handle_lobby(element) {
 
 	var games_table = document.createElement('table');
 
-	var games = element.getElementsByTagName('game');
+	var games = [];
+	for(var id in lobby_games) {
+		games.push(lobby_games[id]);
+	}
+
+	games.sort(function(a, b) { return a.id - b.id; });
+
 	for(var n = 0; n != games.length; ++n) {
 		var g = games[n];
 		var row = document.createElement('tr');
 		var cell = document.createElement('td');
-		var text = document.createTextNode(g.getAttribute('clients'));
+		var text = document.createTextNode(g.clients);
 		cell.appendChild(text);
 		row.appendChild(cell);
 
-		console.log('game started: "' + g.getAttribute('started') + '"');
-
-		if(g.getAttribute('started') == 'no') {
+		if(g.started == 'no') {
 			cell = document.createElement('td');
 
 			var button = document.createElement('input');
@@ -1355,6 +1392,8 @@ function process_response(response) {
 		console.log('SERVER DEBUG MSG: ' + element.getAttribute('msg'));
 	} else if(element.tagName == 'lobby') {
 		handle_lobby(element);
+	} else if(element.tagName == 'lobby_update') {
+		handle_lobby_update(element);
 	} else if(element.tagName == 'player_info') {
 		handle_player_info(element);
 	} else if(element.tagName == 'game') {